@@ -1,7 +1,8 @@
 #include <iostream>
 #include <string>
-#include <unordered_map>
 #include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
@@ -16,7 +17,10 @@ class BottleneckCompileFinder : public IAnalyzer
     };
 
 public:
-    BottleneckCompileFinder()
+    BottleneckCompileFinder(ReportWriter& report):
+        report_{report},
+        arena_{},
+        concurrentInvocations_{ arena_ }
     {}
 
     AnalysisControl OnStartActivity(const EventStack& eventStack)
@@ -111,33 +115,64 @@ public:
             it->second.IsBottleneck &&
             !it->second.UsesParallelFlag)
         {
-            std::cout << std::endl << "WARNING: Found a compiler invocation that is a " <<
-                "bottleneck but that doesn't use the /MP flag. Consider adding " <<
-                "the /MP flag." << std::endl;
-
-            std::cout << "Information about the invocation:" << std::endl;
-            std::wcout << "Working directory: " << invocation.WorkingDirectory() << std::endl;
-            std::cout << "Duration: " << duration_cast<seconds>(invocation.Duration()).count() <<
-                " s" << std::endl;
+            PrintBottleneck(invocation);
         }
 
         concurrentInvocations_.erase(invocation.EventInstanceId());
     }
 
 private:
+    void PrintBottleneck(Invocation invocation)
+    {
+        using namespace std::chrono;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("BottleneckInvocation")
+                .Field("InvocationId", invocation.InvocationId())
+                .Field("WorkingDirectory", invocation.WorkingDirectory())
+                .Field("DurationMs", duration_cast<milliseconds>(
+                    invocation.Duration()).count())
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << "\nWARNING: Found a compiler invocation that is a " <<
+            "bottleneck but that doesn't use the /MP flag. Consider adding " <<
+            "the /MP flag.\n";
+
+        std::cout << "Information about the invocation:\n";
+        std::cout << "Working directory: " << ToUtf8(invocation.WorkingDirectory()) << "\n";
+        std::cout << "Duration: " << duration_cast<seconds>(invocation.Duration()).count() <<
+            " s\n";
+    }
+
+    ReportWriter& report_;
+
+    MonotonicArena arena_;
+
     // A hash table that maps cl or link invocations to a flag
     // that indicates whether this invocation is a bottleneck.
     // In this sample, an invocation is considered a bottleneck 
     // when no other compiler or linker is running alonside it 
     // at any point.
-    std::unordered_map<unsigned long long, InvocationInfo> concurrentInvocations_;
+    HashMap<unsigned long long, InvocationInfo> concurrentInvocations_;
 };
 
 int main(int argc, char* argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
     if (argc <= 1) return -1;
 
-    BottleneckCompileFinder bcf;
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    BottleneckCompileFinder bcf{ report };
 
     auto group = MakeStaticAnalyzerGroup(&bcf);
 
@@ -0,0 +1,670 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/BuildMetrics.hpp"
+#include "../Common/ReportWriter.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace Microsoft::Cpp::BuildInsights;
+
+// An append-only store of per-entity metrics for a series of builds.
+//
+// The file starts with the "BIHIST1" signature and a NUL byte, followed
+// by one block per recorded build. Integers are LEB128 varints:
+//
+// - Block size in bytes, not including this field
+// - Timestamp of the recording, in seconds since the epoch
+// - Label length and bytes
+// - Number of entities seen for the first time in this build, followed
+//   by their category and name length and bytes. Entity ids are assigned
+//   in order of appearance across the whole file.
+// - Number of metrics, followed by pairs of entity id delta (ids are
+//   sorted in increasing order) and duration in milliseconds.
+//
+// Recording a build only appends a block. A truncated last block, left
+// by an interrupted recording, is ignored when loading.
+class BuildHistoryStore
+{
+    struct Entity
+    {
+        BuildMetricCategory Category;
+        std::string Name;
+    };
+
+    struct Build
+    {
+        long long Timestamp;
+        std::string Label;
+        std::vector<std::pair<uint32_t, uint64_t>> Metrics;
+    };
+
+public:
+    BuildHistoryStore(const std::string& path):
+        path_{path},
+        validSize_{0},
+        entities_{},
+        entityIds_{},
+        builds_{}
+    {}
+
+    size_t EntityCount() const {
+        return entities_.size();
+    }
+
+    BuildMetricCategory EntityCategory(uint32_t id) const {
+        return entities_[id].Category;
+    }
+
+    const std::string& EntityName(uint32_t id) const {
+        return entities_[id].Name;
+    }
+
+    size_t BuildCount() const {
+        return builds_.size();
+    }
+
+    const std::string& BuildLabel(size_t build) const {
+        return builds_[build].Label;
+    }
+
+    const std::vector<std::pair<uint32_t, uint64_t>>& BuildMetrics(
+        size_t build) const
+    {
+        return builds_[build].Metrics;
+    }
+
+    // Reads all recorded builds. A missing file is an empty history, and
+    // so is a file that only holds the start of the signature, such as
+    // one left by a crash during the first recording. It gets rewritten
+    // by the next Append.
+    bool Load()
+    {
+        FILE* file = std::fopen(path_.c_str(), "rb");
+
+        if (file == nullptr) {
+            return true;
+        }
+
+        std::vector<unsigned char> data;
+        unsigned char buffer[1 << 16];
+        size_t size;
+
+        while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            data.insert(data.end(), buffer, buffer + size);
+        }
+
+        bool success = std::ferror(file) == 0;
+
+        std::fclose(file);
+
+        if (!success) {
+            return false;
+        }
+
+        if (data.size() < sizeof(SIGNATURE) &&
+            std::memcmp(data.data(), SIGNATURE, data.size()) == 0)
+        {
+            return true;
+        }
+
+        if (data.size() < sizeof(SIGNATURE) ||
+            std::memcmp(data.data(), SIGNATURE, sizeof(SIGNATURE)) != 0)
+        {
+            return false;
+        }
+
+        const unsigned char* p = data.data() + sizeof(SIGNATURE);
+        const unsigned char* end = data.data() + data.size();
+
+        validSize_ = sizeof(SIGNATURE);
+
+        uint64_t blockSize;
+
+        while (ReadVarint(p, end, blockSize) &&
+            blockSize <= static_cast<uint64_t>(end - p))
+        {
+            const unsigned char* blockEnd = p + blockSize;
+
+            if (!ReadBuild(p, blockEnd)) {
+                return false;
+            }
+
+            p = blockEnd;
+            validSize_ = p - data.data();
+        }
+
+        return true;
+    }
+
+    // Appends a build whose entities took at least minimumDuration.
+    bool Append(const std::string& label,
+        const BuildMetricsCollector& collector,
+        std::chrono::milliseconds minimumDuration)
+    {
+        using namespace std::chrono;
+
+        std::string block;
+        std::string newEntities;
+        size_t newEntityCount = 0;
+
+        std::vector<std::pair<uint32_t, uint64_t>> metrics;
+
+        for (int i = 0; i < BUILD_METRIC_CATEGORY_COUNT; ++i)
+        {
+            auto category = static_cast<BuildMetricCategory>(i);
+
+            for (auto& p : collector.Metrics(category))
+            {
+                milliseconds duration = duration_cast<milliseconds>(
+                    p.second.Duration);
+
+                if (duration < minimumDuration) {
+                    continue;
+                }
+
+                auto result = entityIds_.try_emplace(
+                    EntityKey(category, p.first),
+                    static_cast<uint32_t>(entities_.size()));
+
+                if (result.second)
+                {
+                    entities_.push_back({ category, p.first });
+
+                    AppendVarint(newEntities, category);
+                    AppendVarint(newEntities, p.first.size());
+                    newEntities += p.first;
+
+                    ++newEntityCount;
+                }
+
+                metrics.emplace_back(result.first->second,
+                    static_cast<uint64_t>(duration.count()));
+            }
+        }
+
+        std::sort(metrics.begin(), metrics.end());
+
+        long long timestamp = static_cast<long long>(std::time(nullptr));
+
+        AppendVarint(block, static_cast<uint64_t>(timestamp));
+        AppendVarint(block, label.size());
+        block += label;
+        AppendVarint(block, newEntityCount);
+        block += newEntities;
+        AppendVarint(block, metrics.size());
+
+        uint32_t previousId = 0;
+
+        for (auto& m : metrics)
+        {
+            AppendVarint(block, m.first - previousId);
+            AppendVarint(block, m.second);
+            previousId = m.first;
+        }
+
+        std::string header;
+
+        if (validSize_ == 0) {
+            header.append(SIGNATURE, sizeof(SIGNATURE));
+        }
+
+        AppendVarint(header, block.size());
+
+        // Drop a truncated block left by an interrupted recording, then
+        // append the new one. The file is cut at the end of the new block,
+        // in case the truncated one was longer.
+        FILE* file = std::fopen(path_.c_str(), validSize_ ? "r+b" : "wb");
+
+        if (file == nullptr) {
+            return false;
+        }
+
+        uint64_t newSize = validSize_ + header.size() + block.size();
+
+        bool success = Seek(file, validSize_);
+
+        success = success && std::fwrite(header.data(), 1, header.size(),
+            file) == header.size();
+        success = success && std::fwrite(block.data(), 1, block.size(),
+            file) == block.size();
+        success = success && std::fflush(file) == 0 &&
+            Truncate(file, newSize);
+        success = std::fclose(file) == 0 && success;
+
+        if (success)
+        {
+            validSize_ += header.size() + block.size();
+            builds_.push_back({ timestamp, label, std::move(metrics) });
+        }
+
+        return success;
+    }
+
+private:
+    static bool Seek(FILE* file, uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    static bool Truncate(FILE* file, uint64_t size)
+    {
+#ifdef _WIN32
+        return _chsize_s(_fileno(file), static_cast<long long>(size)) == 0;
+#else
+        return ftruncate(fileno(file), static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    static std::string EntityKey(BuildMetricCategory category,
+        const std::string& name)
+    {
+        std::string key(1, static_cast<char>('A' + category));
+        key += name;
+        return key;
+    }
+
+    static void AppendVarint(std::string& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<char>(value));
+    }
+
+    static bool ReadVarint(const unsigned char*& p, const unsigned char* end,
+        uint64_t& value)
+    {
+        value = 0;
+
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            unsigned char byte = *p++;
+
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static bool ReadString(const unsigned char*& p, const unsigned char* end,
+        std::string& str)
+    {
+        uint64_t length;
+
+        if (!ReadVarint(p, end, length) ||
+            length > static_cast<uint64_t>(end - p))
+        {
+            return false;
+        }
+
+        str.assign(reinterpret_cast<const char*>(p),
+            static_cast<size_t>(length));
+        p += length;
+
+        return true;
+    }
+
+    bool ReadBuild(const unsigned char* p, const unsigned char* end)
+    {
+        Build build;
+        uint64_t timestamp, count;
+
+        if (!ReadVarint(p, end, timestamp) ||
+            !ReadString(p, end, build.Label) ||
+            !ReadVarint(p, end, count))
+        {
+            return false;
+        }
+
+        build.Timestamp = static_cast<long long>(timestamp);
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t category;
+            Entity entity;
+
+            if (!ReadVarint(p, end, category) ||
+                category >= BUILD_METRIC_CATEGORY_COUNT ||
+                !ReadString(p, end, entity.Name))
+            {
+                return false;
+            }
+
+            entity.Category = static_cast<BuildMetricCategory>(category);
+
+            entityIds_.emplace(EntityKey(entity.Category, entity.Name),
+                static_cast<uint32_t>(entities_.size()));
+            entities_.push_back(std::move(entity));
+        }
+
+        if (!ReadVarint(p, end, count)) {
+            return false;
+        }
+
+        uint64_t id = 0;
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t idDelta, value;
+
+            if (!ReadVarint(p, end, idDelta) || !ReadVarint(p, end, value)) {
+                return false;
+            }
+
+            id += idDelta;
+
+            if (id >= entities_.size()) {
+                return false;
+            }
+
+            build.Metrics.emplace_back(static_cast<uint32_t>(id), value);
+        }
+
+        builds_.push_back(std::move(build));
+
+        return true;
+    }
+
+    static constexpr char SIGNATURE[8] = { 'B', 'I', 'H', 'I', 'S', 'T', '1', '\0' };
+
+    std::string path_;
+
+    // The size of the file up to the end of the last complete block.
+    size_t validSize_;
+
+    std::vector<Entity> entities_;
+    std::unordered_map<std::string, uint32_t> entityIds_;
+
+    std::vector<Build> builds_;
+};
+
+constexpr char BuildHistoryStore::SIGNATURE[8];
+
+// Finds, for each entity, the build at which its mean duration shifted
+// the most, and reports shifts that are statistically significant.
+//
+// For every possible split of an entity's series of durations into a
+// before and an after segment, a two-sample t statistic of the
+// difference of means is computed using prefix sums. The split with the
+// largest statistic is the change point. Builds in which an entity was
+// not recorded count as zero, since the entity was below the recording
+// threshold or absent from the build.
+class ChangePointDetector
+{
+    struct ChangePoint
+    {
+        uint32_t EntityId;
+        size_t Build;
+        double MeanBefore;
+        double MeanAfter;
+        double Score;
+
+        bool operator<(const ChangePoint& other) const
+        {
+            return std::abs(MeanAfter - MeanBefore) >
+                std::abs(other.MeanAfter - other.MeanBefore);
+        }
+    };
+
+public:
+    ChangePointDetector(const BuildHistoryStore& store, int changeCountToDump,
+        ReportWriter& report):
+        store_{store},
+        changeCountToDump_{changeCountToDump > 0 ?
+            static_cast<size_t>(changeCountToDump) : 20},
+        report_{report}
+    {}
+
+    void Run()
+    {
+        size_t buildCount = store_.BuildCount();
+
+        if (buildCount < MIN_BUILDS_BEFORE + MIN_BUILDS_AFTER)
+        {
+            if (report_.IsText())
+            {
+                std::cout << "At least " << MIN_BUILDS_BEFORE +
+                    MIN_BUILDS_AFTER << " builds are needed to detect " <<
+                    "changes. " << buildCount << " recorded.\n";
+            }
+
+            return;
+        }
+
+        // Transpose the builds into one series per entity.
+        std::vector<std::vector<double>> series(store_.EntityCount(),
+            std::vector<double>(buildCount, 0.));
+
+        for (size_t b = 0; b < buildCount; ++b)
+        {
+            for (auto& m : store_.BuildMetrics(b)) {
+                series[m.first][b] = static_cast<double>(m.second);
+            }
+        }
+
+        std::vector<ChangePoint> changes;
+
+        for (uint32_t id = 0; id < series.size(); ++id)
+        {
+            ChangePoint change{};
+
+            if (FindChangePoint(series[id], change))
+            {
+                change.EntityId = id;
+                changes.push_back(change);
+            }
+        }
+
+        size_t countToDump = std::min(changes.size(), changeCountToDump_);
+
+        std::partial_sort(changes.begin(), changes.begin() + countToDump,
+            changes.end());
+
+        if (report_.IsText())
+        {
+            std::cout << countToDump << " significant changes in " <<
+                buildCount << " builds:\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i) {
+            PrintChange(changes[i]);
+        }
+    }
+
+private:
+    static bool FindChangePoint(const std::vector<double>& values,
+        ChangePoint& best)
+    {
+        size_t n = values.size();
+
+        std::vector<double> sum(n + 1, 0.);
+        std::vector<double> sumOfSquares(n + 1, 0.);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            sum[i + 1] = sum[i] + values[i];
+            sumOfSquares[i + 1] = sumOfSquares[i] + values[i] * values[i];
+        }
+
+        bool found = false;
+
+        for (size_t k = MIN_BUILDS_BEFORE; k + MIN_BUILDS_AFTER <= n; ++k)
+        {
+            double countBefore = static_cast<double>(k);
+            double countAfter = static_cast<double>(n - k);
+
+            double meanBefore = sum[k] / countBefore;
+            double meanAfter = (sum[n] - sum[k]) / countAfter;
+
+            double squaredDeviations =
+                (sumOfSquares[k] - countBefore * meanBefore * meanBefore) +
+                (sumOfSquares[n] - sumOfSquares[k] -
+                    countAfter * meanAfter * meanAfter);
+
+            double variance = std::max(squaredDeviations, 0.) /
+                std::max(static_cast<double>(n) - 2., 1.);
+
+            // Keep nearly constant series from producing huge scores
+            // out of tiny fluctuations.
+            double noiseFloor = 1. + 0.01 * meanBefore;
+
+            double deviation = std::max(std::sqrt(variance), noiseFloor);
+
+            double score = std::abs(meanAfter - meanBefore) / (deviation *
+                std::sqrt(1. / countBefore + 1. / countAfter));
+
+            double relativeChange = std::abs(meanAfter - meanBefore) /
+                std::max(meanBefore, 1.);
+
+            if (score < MIN_SCORE || relativeChange < MIN_RELATIVE_CHANGE ||
+                std::abs(meanAfter - meanBefore) < MIN_ABSOLUTE_CHANGE_MS)
+            {
+                continue;
+            }
+
+            if (!found || score > best.Score)
+            {
+                best.Build = k;
+                best.MeanBefore = meanBefore;
+                best.MeanAfter = meanAfter;
+                best.Score = score;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    void PrintChange(const ChangePoint& change)
+    {
+        const char* category = BuildMetricCategoryName(
+            store_.EntityCategory(change.EntityId));
+
+        const std::string& name = store_.EntityName(change.EntityId);
+        const std::string& label = store_.BuildLabel(change.Build);
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("ChangePoint")
+                .Field("Category", category)
+                .Field("Build", change.Build)
+                .Field("BuildLabel", label)
+                .Field("MeanBeforeMs", change.MeanBefore)
+                .Field("MeanAfterMs", change.MeanAfter)
+                .Field("Score", change.Score)
+                .Field("Name", name)
+                .EndRecord();
+
+            return;
+        }
+
+        double percent = (change.MeanAfter - change.MeanBefore) /
+            std::max(change.MeanBefore, 1.) * 100.;
+
+        std::cout << category << ": " << std::fixed << std::setprecision(0) <<
+            change.MeanBefore << " ms -> " << change.MeanAfter << " ms (" <<
+            std::showpos << percent << std::noshowpos << "%)\n";
+        std::cout << "Since build " << change.Build << ": " << label << "\n";
+        std::cout << "Name: " << name << "\n\n";
+    }
+
+    static const size_t MIN_BUILDS_BEFORE = 3;
+    static const size_t MIN_BUILDS_AFTER = 1;
+
+    static constexpr double MIN_SCORE = 4.;
+    static constexpr double MIN_RELATIVE_CHANGE = 0.2;
+    static constexpr double MIN_ABSOLUTE_CHANGE_MS = 100.;
+
+    const BuildHistoryStore& store_;
+
+    size_t changeCountToDump_;
+
+    ReportWriter& report_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    // Usage:
+    //   BuildHistory record <history file> <trace> [label]
+    //   BuildHistory detect <history file> [change count to dump]
+    if (argc <= 2) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    BuildHistoryStore store{ argv[2] };
+
+    if (!store.Load()) return -1;
+
+    if (std::strcmp(argv[1], "record") == 0)
+    {
+        if (argc <= 3) return -1;
+
+        BuildMetricsCollector collector;
+
+        auto group = MakeStaticAnalyzerGroup(&collector);
+
+        int numberOfPasses = 1;
+        int result = Analyze(argv[3], numberOfPasses, group);
+
+        if (result != RESULT_CODE_SUCCESS) {
+            return result;
+        }
+
+        // Only keep entities that matter, so that the history stays small.
+        std::chrono::milliseconds minimumDuration{ 10 };
+
+        return store.Append(argc >= 5 ? argv[4] : argv[3], collector,
+            minimumDuration) ? 0 : -1;
+    }
+
+    if (std::strcmp(argv[1], "detect") == 0)
+    {
+        int changeCountToDump = 0;
+
+        if (argc >= 4) {
+            changeCountToDump = std::atoi(argv[3]);
+        }
+
+        ChangePointDetector detector{ store, changeCountToDump, report };
+
+        detector.Run();
+
+        return 0;
+    }
+
+    return -1;
+}
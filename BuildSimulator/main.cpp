@@ -0,0 +1,926 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+using namespace SimpleEvents;
+
+// The changes to simulate, as given on the command line.
+struct Scenario
+{
+    // Translation units whose path contains Pattern (case-insensitively)
+    // take Percent less time.
+    struct Speedup
+    {
+        std::string Pattern;
+        double Percent;
+    };
+
+    // 0 to keep the core count of the machine the trace was recorded on.
+    unsigned Cores = 0;
+
+    // The maximum number of translation units that each CL invocation
+    // compiles in parallel: KEEP_PARALLELISM to keep what each invocation
+    // recorded, 0 for /MP (as many as there are cores), 1 without /MP,
+    // and N for /MP:N.
+    int Parallelism = KEEP_PARALLELISM;
+
+    std::vector<Speedup> Speedups;
+
+    static const int KEEP_PARALLELISM = -1;
+};
+
+inline std::string ToLowercase(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+        [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+
+    return str;
+}
+
+// Extracts the /cores:<count>, /mp, /mp:<count>, /nomp and
+// /speedup:<percent>:<pattern> options from the command line, in the
+// same way as ParseReportOptions. Returns false if an option has an
+// invalid value.
+inline bool ParseScenario(int& argc, char* argv[], Scenario& scenario)
+{
+    int kept = 0;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+
+        if (i > 0 && std::strncmp(arg, "/cores:", 7) == 0)
+        {
+            int cores = std::atoi(arg + 7);
+
+            if (cores <= 0) {
+                return false;
+            }
+
+            scenario.Cores = static_cast<unsigned>(cores);
+            continue;
+        }
+
+        if (i > 0 && std::strcmp(arg, "/mp") == 0)
+        {
+            scenario.Parallelism = 0;
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/mp:", 4) == 0)
+        {
+            int parallelism = std::atoi(arg + 4);
+
+            if (parallelism <= 0) {
+                return false;
+            }
+
+            scenario.Parallelism = parallelism;
+            continue;
+        }
+
+        if (i > 0 && std::strcmp(arg, "/nomp") == 0)
+        {
+            scenario.Parallelism = 1;
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/speedup:", 9) == 0)
+        {
+            char* end = nullptr;
+            double percent = std::strtod(arg + 9, &end);
+
+            if (end == arg + 9 || *end != ':' || end[1] == '\0' ||
+                percent < 0. || percent > 100.)
+            {
+                return false;
+            }
+
+            scenario.Speedups.push_back({ ToLowercase(end + 1), percent });
+            continue;
+        }
+
+        argv[kept++] = argv[i];
+    }
+
+    argc = kept;
+
+    return true;
+}
+
+// A top-level CL or link invocation, as recorded in the trace.
+struct Job
+{
+    // A source file compiled by a CL invocation: its front-end and
+    // back-end passes.
+    struct TranslationUnit
+    {
+        std::string Path;
+        std::chrono::nanoseconds Duration;
+        long long StartTimestamp;
+        long long StopTimestamp;
+    };
+
+    unsigned InvocationId;
+    bool IsLink;
+
+    // Lowercase, so that it can be compared with other invocations'.
+    std::string WorkingDirectory;
+
+    // As in Scenario::Parallelism.
+    int Parallelism;
+
+    long long StartTimestamp;
+    long long StopTimestamp;
+    long long TickFrequency;
+    std::chrono::nanoseconds Duration;
+
+    std::vector<TranslationUnit> TranslationUnits;
+};
+
+// Replays the recorded invocations on a simulated machine.
+//
+// The trace doesn't record the dependencies between invocations, so they
+// are inferred from the recorded schedule, in one of two ways:
+//
+// - RECORDED_ORDER: an invocation depends on all the invocations that had
+//   stopped when it started. This also keeps the waits caused by the
+//   recorded machine's cores and the build system's scheduling, so the
+//   simulated wall time is an upper bound, especially with more cores.
+// - WORKING_DIRECTORY: an invocation only depends on the invocations of
+//   the same working directory that had stopped when it started, such as
+//   a link on the CL invocations of its project. Dependencies between
+//   projects are lost, so the simulated wall time is a lower bound.
+//
+// An invocation is started once its dependencies have all stopped in the
+// simulation, after the same gap that separated it from the last of them
+// in the trace (the time the build system took to get to it).
+//
+// Each translation unit occupies a core for the duration of its passes,
+// and each CL invocation compiles up to its parallelism of them at a
+// time. The rest of a CL invocation's time, such as starting up, is
+// spent before its translation units, without occupying a core. Link
+// invocations, and CL invocations without translation units, occupy one
+// core for their whole duration. Cores are handed out to the earliest
+// started invocation that can use one.
+class Simulation
+{
+    struct Event
+    {
+        long long Time;
+        size_t Job;
+        bool IsTaskStop;
+
+        bool operator>(const Event& other) const {
+            return Time > other.Time;
+        }
+    };
+
+    struct JobState
+    {
+        std::vector<long long> TaskDurations;
+        size_t NextTask;
+        size_t RunningTaskCount;
+        size_t Parallelism;
+        long long Overhead;
+        bool IsFinished;
+        long long FinishTime;
+    };
+
+    // Jobs that can only depend on each other.
+    struct Group
+    {
+        // In start order.
+        std::vector<size_t> Jobs;
+
+        std::vector<size_t> StopOrder;
+    };
+
+    // The progress of a group during a run: the stop order prefix of jobs
+    // that have all finished, the time at which the last of each prefix
+    // finished, and the next job to release.
+    struct GroupState
+    {
+        size_t FinishedPrefix;
+        std::vector<long long> PrefixFinishTimes;
+        size_t NextJob;
+    };
+
+public:
+    enum class DependencyModel
+    {
+        RECORDED_ORDER,
+        WORKING_DIRECTORY
+    };
+
+    struct Result
+    {
+        std::chrono::nanoseconds WallTime;
+        std::chrono::nanoseconds BusyTime;
+        unsigned Cores;
+    };
+
+    // Jobs must be sorted by start timestamp.
+    Simulation(const std::vector<Job>& jobs, DependencyModel model):
+        jobs_{jobs},
+        groups_{},
+        groupIndices_(jobs.size()),
+        dependencyCounts_(jobs.size()),
+        gaps_(jobs.size())
+    {
+        std::unordered_map<std::string, size_t> directoryGroups;
+
+        for (size_t i = 0; i < jobs_.size(); ++i)
+        {
+            size_t group = 0;
+
+            if (model == DependencyModel::WORKING_DIRECTORY) {
+                group = directoryGroups.try_emplace(jobs_[i].WorkingDirectory,
+                    directoryGroups.size()).first->second;
+            }
+
+            if (group == groups_.size()) {
+                groups_.emplace_back();
+            }
+
+            groupIndices_[i] = group;
+            groups_[group].Jobs.push_back(i);
+            groups_[group].StopOrder.push_back(i);
+        }
+
+        for (auto& group : groups_)
+        {
+            std::sort(group.StopOrder.begin(), group.StopOrder.end(),
+                [&jobs](size_t lhs, size_t rhs) {
+                    return jobs[lhs].StopTimestamp < jobs[rhs].StopTimestamp;
+                });
+
+            std::vector<long long> stops;
+
+            for (size_t i : group.StopOrder) {
+                stops.push_back(jobs_[i].StopTimestamp);
+            }
+
+            for (size_t i : group.Jobs)
+            {
+                const Job& job = jobs_[i];
+
+                size_t count = std::upper_bound(stops.begin(), stops.end(),
+                    job.StartTimestamp) - stops.begin();
+
+                long long previous = count == 0 ?
+                    jobs_[group.Jobs[0]].StartTimestamp : stops[count - 1];
+
+                dependencyCounts_[i] = count;
+                gaps_[i] = TicksToNanoseconds(job.StartTimestamp - previous,
+                    job.TickFrequency);
+            }
+        }
+    }
+
+    Result Run(const Scenario& scenario, unsigned cores)
+    {
+        cores = std::max(cores, 1u);
+
+        std::vector<JobState> states(jobs_.size());
+
+        for (size_t i = 0; i < jobs_.size(); ++i) {
+            InitializeJob(jobs_[i], scenario, cores, states[i]);
+        }
+
+        std::priority_queue<Event, std::vector<Event>,
+            std::greater<Event>> events;
+
+        // Started jobs that still have tasks to run, in start order.
+        std::set<size_t> activeJobs;
+
+        std::vector<GroupState> groupStates(groups_.size());
+
+        for (size_t i = 0; i < groups_.size(); ++i) {
+            groupStates[i] = { 0,
+                std::vector<long long>(groups_[i].Jobs.size() + 1, 0), 0 };
+        }
+
+        unsigned freeCores = cores;
+        long long now = 0;
+        long long wallTime = 0;
+        long long busyTime = 0;
+
+        auto releaseJobs = [&](size_t groupIndex)
+        {
+            const Group& group = groups_[groupIndex];
+            GroupState& groupState = groupStates[groupIndex];
+
+            while (groupState.NextJob < group.Jobs.size())
+            {
+                size_t job = group.Jobs[groupState.NextJob];
+
+                if (dependencyCounts_[job] > groupState.FinishedPrefix) {
+                    break;
+                }
+
+                long long start = std::max(now,
+                    groupState.PrefixFinishTimes[dependencyCounts_[job]] +
+                        gaps_[job]);
+
+                events.push({ start + states[job].Overhead, job, false });
+
+                ++groupState.NextJob;
+            }
+        };
+
+        auto finishJob = [&](size_t job)
+        {
+            states[job].IsFinished = true;
+            states[job].FinishTime = now;
+            activeJobs.erase(job);
+
+            wallTime = std::max(wallTime, now);
+
+            const Group& group = groups_[groupIndices_[job]];
+            GroupState& groupState = groupStates[groupIndices_[job]];
+
+            while (groupState.FinishedPrefix < group.StopOrder.size() &&
+                states[group.StopOrder[groupState.FinishedPrefix]].IsFinished)
+            {
+                size_t prefix = groupState.FinishedPrefix;
+
+                groupState.PrefixFinishTimes[prefix + 1] = std::max(
+                    groupState.PrefixFinishTimes[prefix],
+                    states[group.StopOrder[prefix]].FinishTime);
+
+                ++groupState.FinishedPrefix;
+            }
+
+            releaseJobs(groupIndices_[job]);
+        };
+
+        for (size_t i = 0; i < groups_.size(); ++i) {
+            releaseJobs(i);
+        }
+
+        while (!events.empty())
+        {
+            Event event = events.top();
+            events.pop();
+
+            now = event.Time;
+
+            JobState& state = states[event.Job];
+
+            if (event.IsTaskStop)
+            {
+                ++freeCores;
+                --state.RunningTaskCount;
+            }
+            else {
+                activeJobs.insert(event.Job);
+            }
+
+            if (state.NextTask == state.TaskDurations.size() &&
+                state.RunningTaskCount == 0)
+            {
+                finishJob(event.Job);
+            }
+
+            // Hand out the free cores.
+            for (auto it = activeJobs.begin();
+                freeCores > 0 && it != activeJobs.end(); ++it)
+            {
+                JobState& active = states[*it];
+
+                while (freeCores > 0 &&
+                    active.NextTask < active.TaskDurations.size() &&
+                    active.RunningTaskCount < active.Parallelism)
+                {
+                    long long duration =
+                        active.TaskDurations[active.NextTask++];
+
+                    ++active.RunningTaskCount;
+                    --freeCores;
+                    busyTime += duration;
+
+                    events.push({ now + duration, *it, true });
+                }
+            }
+        }
+
+        return { std::chrono::nanoseconds{wallTime},
+            std::chrono::nanoseconds{busyTime}, cores };
+    }
+
+    // Whether the path of a translation unit matches a speedup.
+    static bool Matches(const std::string& path,
+        const Scenario::Speedup& speedup)
+    {
+        return ToLowercase(path).find(speedup.Pattern) != std::string::npos;
+    }
+
+    static long long TicksToNanoseconds(long long ticks,
+        long long tickFrequency)
+    {
+        if (tickFrequency <= 0) {
+            return 0;
+        }
+
+        return static_cast<long long>(
+            static_cast<double>(ticks) * 1000000000. / tickFrequency);
+    }
+
+private:
+    void InitializeJob(const Job& job, const Scenario& scenario,
+        unsigned cores, JobState& state)
+    {
+        state.NextTask = 0;
+        state.RunningTaskCount = 0;
+        state.IsFinished = false;
+        state.FinishTime = 0;
+        state.Overhead = 0;
+
+        int parallelism = job.Parallelism;
+
+        if (!job.IsLink && scenario.Parallelism != Scenario::KEEP_PARALLELISM) {
+            parallelism = scenario.Parallelism;
+        }
+
+        state.Parallelism = parallelism == 0 ? cores :
+            std::min(static_cast<unsigned>(parallelism), cores);
+
+        if (job.TranslationUnits.empty())
+        {
+            state.TaskDurations.push_back(job.Duration.count());
+            return;
+        }
+
+        long long firstStart = job.TranslationUnits[0].StartTimestamp;
+        long long lastStop = job.TranslationUnits[0].StopTimestamp;
+
+        for (auto& tu : job.TranslationUnits)
+        {
+            double duration = static_cast<double>(tu.Duration.count());
+
+            for (auto& speedup : scenario.Speedups)
+            {
+                if (Matches(tu.Path, speedup)) {
+                    duration *= 1. - speedup.Percent / 100.;
+                }
+            }
+
+            state.TaskDurations.push_back(static_cast<long long>(duration));
+
+            firstStart = std::min(firstStart, tu.StartTimestamp);
+            lastStop = std::max(lastStop, tu.StopTimestamp);
+        }
+
+        state.Overhead = std::max(0ll, job.Duration.count() -
+            TicksToNanoseconds(lastStop - firstStart, job.TickFrequency));
+    }
+
+    const std::vector<Job>& jobs_;
+
+    std::vector<Group> groups_;
+    std::vector<size_t> groupIndices_;
+
+    // For each job, the number of jobs of its group (in stop order) that
+    // it depends on, and the gap between the last of them and itself.
+    std::vector<size_t> dependencyCounts_;
+    std::vector<long long> gaps_;
+};
+
+class BuildSimulator : public IAnalyzer
+{
+    struct PendingJob
+    {
+        int Parallelism;
+        std::vector<Job::TranslationUnit> TranslationUnits;
+    };
+
+public:
+    BuildSimulator(const Scenario& scenario, ReportWriter& report):
+        scenario_{scenario},
+        report_{report},
+        logicalProcessorCount_{0},
+        arena_{},
+        pendingJobs_{ arena_ },
+        jobs_{}
+    {}
+
+    AnalysisControl OnTraceInfo(const TraceInfo& traceInfo) override
+    {
+        logicalProcessorCount_ = static_cast<unsigned>(
+            traceInfo.LogicalProcessorCount());
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildSimulator::OnStopFrontEndPass);
+            break;
+
+        case EVENT_ID_BACK_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildSimulator::OnStopBackEndPass);
+            break;
+
+        case EVENT_ID_COMPILER:
+        case EVENT_ID_LINKER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildSimulator::OnStopInvocation);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        MatchEventStackInMemberFunction(eventStack, this,
+            &BuildSimulator::OnCommandLine);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    // Passes are attributed to the top-level invocation, which is the one
+    // that gets scheduled by the build system.
+    void OnStopFrontEndPass(InvocationGroup invocations, FrontEndPass fe)
+    {
+        AddPass(invocations[0].EventInstanceId(), fe.InputSourcePath(), fe);
+    }
+
+    void OnStopBackEndPass(InvocationGroup invocations, BackEndPass be)
+    {
+        AddPass(invocations[0].EventInstanceId(), be.InputSourcePath(), be);
+    }
+
+    void OnCommandLine(InvocationGroup invocations, CommandLine commandLine)
+    {
+        if (invocations.Size() != 1 ||
+            invocations.Back().Type() != Invocation::Type::CL)
+        {
+            return;
+        }
+
+        PendingJob& job = GetPendingJob(invocations[0].EventInstanceId());
+
+        job.Parallelism = ParseParallelism(commandLine.Value());
+    }
+
+    void OnStopInvocation(InvocationGroup invocations)
+    {
+        // Invocations that were started by another one run as part of it.
+        if (invocations.Size() != 1) {
+            return;
+        }
+
+        const Invocation& invocation = invocations.Back();
+
+        Job job{};
+
+        job.InvocationId = invocation.InvocationId();
+        job.IsLink = invocation.Type() == Invocation::Type::LINK;
+        job.WorkingDirectory = ToLowercase(ToUtf8(
+            invocation.WorkingDirectory()));
+        job.Parallelism = 1;
+        job.StartTimestamp = invocation.StartTimestamp();
+        job.StopTimestamp = invocation.StopTimestamp();
+        job.TickFrequency = invocation.TickFrequency();
+        job.Duration = invocation.Duration();
+
+        auto it = pendingJobs_.find(invocation.EventInstanceId());
+
+        if (it != pendingJobs_.end())
+        {
+            job.Parallelism = it->second.Parallelism;
+            job.TranslationUnits = std::move(it->second.TranslationUnits);
+
+            pendingJobs_.erase(it);
+        }
+
+        jobs_.push_back(std::move(job));
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        using namespace std::chrono;
+
+        if (jobs_.empty()) {
+            return AnalysisControl::CONTINUE;
+        }
+
+        std::sort(jobs_.begin(), jobs_.end(),
+            [](const Job& lhs, const Job& rhs) {
+                return lhs.StartTimestamp < rhs.StartTimestamp;
+            });
+
+        unsigned recordedCores = logicalProcessorCount_ > 0 ?
+            logicalProcessorCount_ : DEFAULT_CORE_COUNT;
+
+        unsigned whatIfCores = scenario_.Cores > 0 ? scenario_.Cores :
+            recordedCores;
+
+        // The recorded order gives an upper bound on the wall time, and
+        // the working directory order a lower bound.
+        Simulation upper{ jobs_, Simulation::DependencyModel::RECORDED_ORDER };
+        Simulation lower{ jobs_,
+            Simulation::DependencyModel::WORKING_DIRECTORY };
+
+        Simulation::Result asRecordedUpper = upper.Run(Scenario{},
+            recordedCores);
+        Simulation::Result asRecordedLower = lower.Run(Scenario{},
+            recordedCores);
+        Simulation::Result whatIfUpper = upper.Run(scenario_, whatIfCores);
+        Simulation::Result whatIfLower = lower.Run(scenario_, whatIfCores);
+
+        long long firstStart = jobs_.front().StartTimestamp;
+        long long lastStop = firstStart;
+
+        for (auto& job : jobs_) {
+            lastStop = std::max(lastStop, job.StopTimestamp);
+        }
+
+        Simulation::Result recorded{ nanoseconds{
+                Simulation::TicksToNanoseconds(lastStop - firstStart,
+                    jobs_.front().TickFrequency) },
+            asRecordedUpper.BusyTime, recordedCores };
+
+        PrintSummary();
+
+        PrintResult("Recorded", "Trace", recorded);
+        PrintResult("AsRecorded", "RecordedOrder", asRecordedUpper);
+        PrintResult("AsRecorded", "WorkingDirectoryOrder", asRecordedLower);
+        PrintResult("WhatIf", "RecordedOrder", whatIfUpper);
+        PrintResult("WhatIf", "WorkingDirectoryOrder", whatIfLower);
+
+        if (!report_.IsText()) {
+            return AnalysisControl::CONTINUE;
+        }
+
+        // Each bound is compared with the as-recorded run of the same
+        // model, so that what the model leaves out cancels out.
+        double upperChange = Change(asRecordedUpper, whatIfUpper);
+        double lowerChange = Change(asRecordedLower, whatIfLower);
+
+        std::cout << "\nPredicted change: between " << std::showpos <<
+            std::fixed << std::setprecision(1) <<
+            std::min(upperChange, lowerChange) << "% and " <<
+            std::max(upperChange, lowerChange) << std::noshowpos <<
+            "% (what-if compared to as-recorded, in each order)\n";
+
+        std::cout << "\nThe trace doesn't record the dependencies between "
+            "invocations. The recorded order\nkeeps the waits caused by the "
+            "recorded machine and build system, so its wall time\nis an "
+            "upper bound, especially with more cores than were recorded. "
+            "The working\ndirectory order ignores dependencies between "
+            "projects, so its wall time is a\nlower bound.\n";
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    // Used when the trace doesn't record the machine's core count.
+    static const unsigned DEFAULT_CORE_COUNT = 8;
+
+    PendingJob& GetPendingJob(unsigned long long invocationInstanceId)
+    {
+        return pendingJobs_.try_emplace(invocationInstanceId,
+            PendingJob{ 1, {} }).first->second;
+    }
+
+    // The front-end and back-end passes of a source file are combined
+    // into a translation unit. The back-end pass of a file follows its
+    // front-end pass closely, so it is looked for from the most recent
+    // translation unit backwards.
+    void AddPass(unsigned long long invocationInstanceId,
+        const wchar_t* sourcePath, const Activity& pass)
+    {
+        std::string path = ToUtf8(sourcePath);
+
+        std::vector<Job::TranslationUnit>& units =
+            GetPendingJob(invocationInstanceId).TranslationUnits;
+
+        for (size_t i = units.size(); i-- > 0;)
+        {
+            if (units[i].Path == path)
+            {
+                units[i].Duration += pass.Duration();
+                units[i].StartTimestamp = std::min(units[i].StartTimestamp,
+                    pass.StartTimestamp());
+                units[i].StopTimestamp = std::max(units[i].StopTimestamp,
+                    pass.StopTimestamp());
+                return;
+            }
+        }
+
+        units.push_back({ std::move(path), pass.Duration(),
+            pass.StartTimestamp(), pass.StopTimestamp() });
+    }
+
+    // Returns the parallelism of a CL invocation, as in
+    // Scenario::Parallelism, from its /MP option.
+    static int ParseParallelism(const wchar_t* commandLine)
+    {
+        int parallelism = 1;
+
+        for (const wchar_t* p = commandLine; *p; ++p)
+        {
+            bool isOptionStart = p == commandLine || p[-1] == L' ' ||
+                p[-1] == L'\t';
+
+            if (!isOptionStart || (p[0] != L'/' && p[0] != L'-') ||
+                p[1] != L'M' || p[2] != L'P')
+            {
+                continue;
+            }
+
+            const wchar_t* count = p + 3;
+
+            if (*count == L'\0' || *count == L' ' || *count == L'\t') {
+                parallelism = 0;
+            }
+            else if (*count >= L'0' && *count <= L'9') {
+                parallelism = std::max(1, static_cast<int>(
+                    std::wcstol(count, nullptr, 10)));
+            }
+        }
+
+        return parallelism;
+    }
+
+    void PrintSummary()
+    {
+        size_t linkCount = 0;
+        size_t translationUnitCount = 0;
+
+        for (auto& job : jobs_)
+        {
+            linkCount += job.IsLink ? 1 : 0;
+            translationUnitCount += job.TranslationUnits.size();
+        }
+
+        for (auto& speedup : scenario_.Speedups)
+        {
+            size_t matchCount = 0;
+
+            for (auto& job : jobs_)
+            {
+                for (auto& tu : job.TranslationUnits) {
+                    matchCount += Simulation::Matches(tu.Path, speedup) ? 1 : 0;
+                }
+            }
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Speedup")
+                    .Field("Pattern", speedup.Pattern)
+                    .Field("Percent", speedup.Percent)
+                    .Field("TranslationUnitCount", matchCount)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Speeding up " << matchCount <<
+                " translation units matching \"" << speedup.Pattern <<
+                "\" by " << speedup.Percent << "%\n";
+        }
+
+        if (!report_.IsText()) {
+            return;
+        }
+
+        std::cout << "Invocations: " << jobs_.size() << " (CL: " <<
+            jobs_.size() - linkCount << ", link: " << linkCount <<
+            ")\t Translation units: " << translationUnitCount << "\n";
+
+        std::cout << "/MP: ";
+
+        switch (scenario_.Parallelism)
+        {
+        case Scenario::KEEP_PARALLELISM:
+            std::cout << "as recorded";
+            break;
+
+        case 0:
+            std::cout << "on for all CL invocations";
+            break;
+
+        case 1:
+            std::cout << "off for all CL invocations";
+            break;
+
+        default:
+            std::cout << scenario_.Parallelism << " for all CL invocations";
+            break;
+        }
+
+        std::cout << "\n\n";
+    }
+
+    // The relative change in wall time, in percent.
+    static double Change(const Simulation::Result& before,
+        const Simulation::Result& after)
+    {
+        if (before.WallTime.count() == 0) {
+            return 0.;
+        }
+
+        return (static_cast<double>(after.WallTime.count()) /
+            before.WallTime.count() - 1.) * 100.;
+    }
+
+    void PrintResult(const char* name, const char* order,
+        const Simulation::Result& result)
+    {
+        using namespace std::chrono;
+
+        double utilization = result.WallTime.count() == 0 ? 0. :
+            static_cast<double>(result.BusyTime.count()) /
+                (static_cast<double>(result.WallTime.count()) *
+                    result.Cores) * 100.;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Simulation")
+                .Field("Name", name)
+                .Field("Order", order)
+                .Field("WallTimeMs", duration_cast<milliseconds>(
+                    result.WallTime).count())
+                .Field("Cores", result.Cores)
+                .Field("CoreUtilizationPercent", utilization)
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << std::left << std::setw(12) << name << std::setw(23) <<
+            order << std::right <<
+            std::setw(10) << duration_cast<milliseconds>(
+                result.WallTime).count() << " ms\t cores: " <<
+            result.Cores << "\t core utilization: " << std::fixed <<
+            std::setprecision(1) << utilization << "%\n";
+    }
+
+    Scenario scenario_;
+
+    ReportWriter& report_;
+
+    unsigned logicalProcessorCount_;
+
+    MonotonicArena arena_;
+
+    // Top-level invocations that haven't stopped yet.
+    HashMap<unsigned long long, PendingJob> pendingJobs_;
+
+    std::vector<Job> jobs_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    Scenario scenario;
+
+    if (!ParseScenario(argc, argv, scenario)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    BuildSimulator simulator{ scenario, report };
+
+    auto group = MakeStaticAnalyzerGroup(&simulator);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+class CodeGenThreadUtilization : public IAnalyzer
+{
+    struct FunctionInterval
+    {
+        long long StartTimestamp;
+        long long StopTimestamp;
+    };
+
+    // Bookkeeping for a CodeGeneration activity that is still running.
+    struct ActiveCodeGeneration
+    {
+        std::vector<FunctionInterval> Functions;
+        std::unordered_set<unsigned long> ThreadIds;
+
+        // Functions stop in timestamp order, so the function that stopped
+        // last is always the one that keeps the code generation alive.
+        // We also remember when the function before it stopped.
+        long long PreviousStopTimestamp;
+        FunctionInterval LastFunction;
+        std::string LastFunctionName;
+    };
+
+    struct CodeGenerationInfo
+    {
+        bool IsCompiler;
+        unsigned InvocationId;
+        std::chrono::nanoseconds Duration;
+        std::chrono::nanoseconds SerialTime;
+        std::chrono::nanoseconds TailDuration;
+        double AverageConcurrency;
+        size_t PeakConcurrency;
+        size_t ThreadCount;
+        size_t FunctionCount;
+        std::string TailFunctionName;
+
+        bool operator<(const CodeGenerationInfo& other) const {
+            return TailDuration > other.TailDuration;
+        }
+    };
+
+public:
+    CodeGenThreadUtilization(int codeGenerationCountToDump,
+        ReportWriter& report):
+        codeGenerationCountToDump_{codeGenerationCountToDump > 0 ?
+            codeGenerationCountToDump : 10},
+        report_{report},
+        activeCodeGenerations_{},
+        codeGenerations_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FUNCTION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &CodeGenThreadUtilization::OnStopFunction);
+            break;
+
+        case EVENT_ID_CODE_GENERATION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &CodeGenThreadUtilization::OnStopCodeGeneration);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopFunction(Invocation invocation, CodeGeneration cg,
+        Function func)
+    {
+        auto result = activeCodeGenerations_.try_emplace(
+            cg.EventInstanceId(), ActiveCodeGeneration{});
+
+        ActiveCodeGeneration& active = result.first->second;
+
+        if (result.second) {
+            active.PreviousStopTimestamp = cg.StartTimestamp();
+        }
+        else {
+            active.PreviousStopTimestamp = active.LastFunction.StopTimestamp;
+        }
+
+        FunctionInterval interval{ func.StartTimestamp(),
+            func.StopTimestamp() };
+
+        active.Functions.push_back(interval);
+        active.ThreadIds.insert(func.ThreadId());
+        active.LastFunction = interval;
+        active.LastFunctionName = func.Name();
+    }
+
+    void OnStopCodeGeneration(Invocation invocation, CodeGeneration cg)
+    {
+        auto it = activeCodeGenerations_.find(cg.EventInstanceId());
+
+        if (it == activeCodeGenerations_.end()) {
+            return;
+        }
+
+        ActiveCodeGeneration& active = it->second;
+
+        long long tickFrequency = cg.TickFrequency();
+
+        CodeGenerationInfo info{};
+
+        info.IsCompiler = invocation.Type() == Invocation::Type::CL;
+        info.InvocationId = invocation.InvocationId();
+        info.Duration = cg.Duration();
+        info.ThreadCount = active.ThreadIds.size();
+        info.FunctionCount = active.Functions.size();
+
+        // The tail is the time during which the last function to finish
+        // was the only one still being generated.
+        long long tailStart = std::max(active.LastFunction.StartTimestamp,
+            active.PreviousStopTimestamp);
+
+        info.TailDuration = TicksToNanoseconds(
+            active.LastFunction.StopTimestamp - tailStart, tickFrequency);
+        info.TailFunctionName = std::move(active.LastFunctionName);
+
+        ComputeConcurrency(active.Functions, tickFrequency, info);
+
+        codeGenerations_.push_back(std::move(info));
+
+        activeCodeGenerations_.erase(it);
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        using namespace std::chrono;
+
+        size_t countToDump = std::min(codeGenerations_.size(),
+            static_cast<size_t>(codeGenerationCountToDump_));
+
+        std::partial_sort(codeGenerations_.begin(),
+            codeGenerations_.begin() + countToDump, codeGenerations_.end());
+
+        if (!report_.IsText())
+        {
+            for (size_t i = 0; i < countToDump; ++i)
+            {
+                const CodeGenerationInfo& info = codeGenerations_[i];
+
+                report_.BeginRecord("CodeGeneration")
+                    .Field("Tool", info.IsCompiler ? "CL" : "Link")
+                    .Field("InvocationId", info.InvocationId)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        info.Duration).count())
+                    .Field("FunctionCount", info.FunctionCount)
+                    .Field("ThreadCount", info.ThreadCount)
+                    .Field("AverageConcurrency", info.AverageConcurrency)
+                    .Field("PeakConcurrency", info.PeakConcurrency)
+                    .Field("SerialMs", duration_cast<milliseconds>(
+                        info.SerialTime).count())
+                    .Field("TailMs", duration_cast<milliseconds>(
+                        info.TailDuration).count())
+                    .Field("TailFunction", info.TailFunctionName)
+                    .EndRecord();
+            }
+
+            return AnalysisControl::CONTINUE;
+        }
+
+        if (countToDump == 1) {
+            std::cout << "Top code generation tail:";
+        }
+        else {
+            std::cout << "Top " << countToDump <<
+                " code generation tails:";
+        }
+
+        std::cout << "\n\n";
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const CodeGenerationInfo& info = codeGenerations_[i];
+
+            double tailPercentage = info.Duration.count() == 0 ? 0. :
+                static_cast<double>(info.TailDuration.count()) /
+                info.Duration.count() * 100.;
+
+            std::cout << "Invocation:          " <<
+                (info.IsCompiler ? "CL " : "Link ") << info.InvocationId << "\n";
+            std::cout << "Code Generation:     " <<
+                duration_cast<milliseconds>(info.Duration).count() <<
+                " ms\n";
+            std::cout << "Functions / Threads: " << info.FunctionCount <<
+                " / " << info.ThreadCount << "\n";
+            std::cout << "Avg / Peak Threads:  " << std::fixed <<
+                std::setprecision(2) << info.AverageConcurrency <<
+                " / " << info.PeakConcurrency << "\n";
+            std::cout << "Serial Time:         " <<
+                duration_cast<milliseconds>(info.SerialTime).count() <<
+                " ms\n";
+            std::cout << "Tail:                " <<
+                duration_cast<milliseconds>(info.TailDuration).count() <<
+                " ms (" << std::setprecision(0) << tailPercentage <<
+                "%)\n";
+            std::cout << "Tail Function:       " <<
+                info.TailFunctionName << "\n\n";
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    static std::chrono::nanoseconds TicksToNanoseconds(long long ticks,
+        long long tickFrequency)
+    {
+        if (tickFrequency <= 0) {
+            return std::chrono::nanoseconds{0};
+        }
+
+        return std::chrono::nanoseconds{static_cast<long long>(
+            static_cast<double>(ticks) * 1000000000. / tickFrequency)};
+    }
+
+    // Sweeps over the start and stop timestamps of all functions to find
+    // how many of them were being generated at the same time.
+    static void ComputeConcurrency(const std::vector<FunctionInterval>&
+        functions, long long tickFrequency, CodeGenerationInfo& info)
+    {
+        std::vector<std::pair<long long, int>> edges;
+
+        edges.reserve(functions.size() * 2);
+
+        for (auto& f : functions)
+        {
+            edges.emplace_back(f.StartTimestamp, 1);
+            edges.emplace_back(f.StopTimestamp, -1);
+        }
+
+        // Stops sort before starts at the same timestamp so that
+        // back-to-back functions on a thread don't count as overlapping.
+        std::sort(edges.begin(), edges.end());
+
+        long long busyTicks = 0;
+        long long activeTicks = 0;
+        long long serialTicks = 0;
+        long long previousTimestamp = 0;
+        size_t concurrency = 0;
+
+        for (auto& edge : edges)
+        {
+            if (concurrency > 0)
+            {
+                long long elapsed = edge.first - previousTimestamp;
+
+                activeTicks += elapsed;
+                busyTicks += elapsed * static_cast<long long>(concurrency);
+
+                if (concurrency == 1) {
+                    serialTicks += elapsed;
+                }
+            }
+
+            concurrency += edge.second;
+            previousTimestamp = edge.first;
+
+            info.PeakConcurrency = std::max(info.PeakConcurrency,
+                concurrency);
+        }
+
+        info.AverageConcurrency = activeTicks == 0 ? 0. :
+            static_cast<double>(busyTicks) / activeTicks;
+        info.SerialTime = TicksToNanoseconds(serialTicks, tickFrequency);
+    }
+
+    int codeGenerationCountToDump_;
+
+    ReportWriter& report_;
+
+    // A hash table that maps CodeGeneration activities that are still
+    // running to the functions generated within them so far.
+    std::unordered_map<unsigned long long,
+        ActiveCodeGeneration> activeCodeGenerations_;
+
+    std::vector<CodeGenerationInfo> codeGenerations_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int codeGenerationCountToDump = 0;
+
+    if (argc >= 3) {
+        codeGenerationCountToDump = std::atoi(argv[2]);
+    }
+
+    CodeGenThreadUtilization cgtu{ codeGenerationCountToDump, report };
+
+    auto group = MakeStaticAnalyzerGroup(&cgtu);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
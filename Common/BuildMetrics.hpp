@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <CppBuildInsights.hpp>
+#include "ReportWriter.hpp"
+
+// The kinds of entities for which BuildMetricsCollector aggregates time.
+enum BuildMetricCategory
+{
+    // Aggregated parsing time of a header, as in TopHeaders.
+    BUILD_METRIC_HEADER,
+
+    // Aggregated code generation time of a function, as in
+    // LongCodeGenFinder and FunctionBottlenecks.
+    BUILD_METRIC_FUNCTION,
+
+    // Aggregated time of the template instantiation hierarchies rooted
+    // at a specialization, as in RecursiveTemplateInspector.
+    BUILD_METRIC_TEMPLATE,
+
+    // Front-end time of the passes that create a module, header unit or
+    // precompiled header IFC, as in LongModuleFinder,
+    // LongHeaderUnitFinder and LongPrecompiledHeaderFinder.
+    BUILD_METRIC_MODULE_IFC,
+    BUILD_METRIC_HEADER_UNIT_IFC,
+    BUILD_METRIC_PCH_IFC,
+
+    BUILD_METRIC_CATEGORY_COUNT
+};
+
+inline const char* BuildMetricCategoryName(BuildMetricCategory category)
+{
+    switch (category)
+    {
+    case BUILD_METRIC_HEADER:           return "Header";
+    case BUILD_METRIC_FUNCTION:         return "Function";
+    case BUILD_METRIC_TEMPLATE:         return "Template";
+    case BUILD_METRIC_MODULE_IFC:       return "ModuleIfc";
+    case BUILD_METRIC_HEADER_UNIT_IFC:  return "HeaderUnitIfc";
+    case BUILD_METRIC_PCH_IFC:          return "PchIfc";
+    default:                            return "";
+    }
+}
+
+struct BuildMetric
+{
+    std::string Name;
+    std::chrono::nanoseconds Duration;
+    size_t Count;
+};
+
+// Collects, in a single pass, the per-entity metrics reported by the
+// other samples, keyed by entity name. Paths are keyed in lowercase so
+// that the same file is matched regardless of casing.
+class BuildMetricsCollector : public Microsoft::Cpp::BuildInsights::IAnalyzer
+{
+    typedef Microsoft::Cpp::BuildInsights::AnalysisControl AnalysisControl;
+    typedef Microsoft::Cpp::BuildInsights::EventStack EventStack;
+
+public:
+    typedef std::unordered_map<std::string, BuildMetric> MetricMap;
+
+    BuildMetricsCollector():
+        metrics_{},
+        key_{},
+        pendingTemplates_{},
+        ifcFrontEndPasses_{}
+    {}
+
+    const MetricMap& Metrics(BuildMetricCategory category) const {
+        return metrics_[category];
+    }
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        using namespace Microsoft::Cpp::BuildInsights;
+
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildMetricsCollector::OnStopFile);
+            break;
+
+        case EVENT_ID_FUNCTION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildMetricsCollector::OnStopFunction);
+            break;
+
+        case EVENT_ID_TEMPLATE_INSTANTIATION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildMetricsCollector::OnStopTemplateInstantiation);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &BuildMetricsCollector::OnStopFrontEndPass);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        using namespace Microsoft::Cpp::BuildInsights;
+
+        MatchEventStackInMemberFunction(eventStack, this,
+            &BuildMetricsCollector::OnSymbolName);
+
+        MatchEventStackInMemberFunction(eventStack, this,
+            &BuildMetricsCollector::OnModule);
+
+        MatchEventStackInMemberFunction(eventStack, this,
+            &BuildMetricsCollector::OnHeaderUnit);
+
+        MatchEventStackInMemberFunction(eventStack, this,
+            &BuildMetricsCollector::OnPrecompiledHeader);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopFile(Microsoft::Cpp::BuildInsights::Activities::FrontEndFile file)
+    {
+        Add(BUILD_METRIC_HEADER, file.Path(), true, file.Duration());
+    }
+
+    void OnStopFunction(
+        Microsoft::Cpp::BuildInsights::Activities::CodeGeneration cg,
+        Microsoft::Cpp::BuildInsights::Activities::Function func)
+    {
+        Add(BUILD_METRIC_FUNCTION, func.Name(), false, func.Duration());
+    }
+
+    void OnStopTemplateInstantiation(
+        Microsoft::Cpp::BuildInsights::Activities::TemplateInstantiationGroup
+            group)
+    {
+        if (group.Size() != 1) {
+            return;
+        }
+
+        // Template names are only known once the SymbolName event for
+        // the specialization's key is seen.
+        auto& root = group[0];
+
+        pendingTemplates_[root.SpecializationSymbolKey()] += root.Duration();
+    }
+
+    void OnSymbolName(
+        Microsoft::Cpp::BuildInsights::SimpleEvents::SymbolName symbolName)
+    {
+        auto it = pendingTemplates_.find(symbolName.Key());
+
+        if (it == pendingTemplates_.end()) {
+            return;
+        }
+
+        Add(BUILD_METRIC_TEMPLATE, symbolName.Name(), false, it->second);
+
+        pendingTemplates_.erase(it);
+    }
+
+    void OnModule(Microsoft::Cpp::BuildInsights::Activities::FrontEndPass fe,
+        Microsoft::Cpp::BuildInsights::SimpleEvents::Module m)
+    {
+        ifcFrontEndPasses_[fe.EventInstanceId()] = BUILD_METRIC_MODULE_IFC;
+    }
+
+    void OnHeaderUnit(
+        Microsoft::Cpp::BuildInsights::Activities::FrontEndPass fe,
+        Microsoft::Cpp::BuildInsights::SimpleEvents::HeaderUnit hu)
+    {
+        ifcFrontEndPasses_[fe.EventInstanceId()] =
+            BUILD_METRIC_HEADER_UNIT_IFC;
+    }
+
+    void OnPrecompiledHeader(
+        Microsoft::Cpp::BuildInsights::Activities::FrontEndPass fe,
+        Microsoft::Cpp::BuildInsights::SimpleEvents::PrecompiledHeader pch)
+    {
+        ifcFrontEndPasses_[fe.EventInstanceId()] = BUILD_METRIC_PCH_IFC;
+    }
+
+    void OnStopFrontEndPass(
+        Microsoft::Cpp::BuildInsights::Activities::FrontEndPass fe)
+    {
+        auto it = ifcFrontEndPasses_.find(fe.EventInstanceId());
+
+        if (it == ifcFrontEndPasses_.end()) {
+            return;
+        }
+
+        Add(it->second, ToUtf8(fe.InputSourcePath()).c_str(), true,
+            fe.Duration());
+
+        ifcFrontEndPasses_.erase(it);
+    }
+
+private:
+    void Add(BuildMetricCategory category, const char* name, bool isPath,
+        std::chrono::nanoseconds duration)
+    {
+        key_ = name;
+
+        if (isPath)
+        {
+            std::transform(key_.begin(), key_.end(), key_.begin(),
+                [](unsigned char c) { return std::tolower(c); });
+        }
+
+        auto result = metrics_[category].try_emplace(key_, BuildMetric{});
+
+        BuildMetric& metric = result.first->second;
+
+        if (result.second) {
+            metric.Name = name;
+        }
+
+        metric.Duration += duration;
+        ++metric.Count;
+    }
+
+    MetricMap metrics_[BUILD_METRIC_CATEGORY_COUNT];
+
+    std::string key_;
+
+    // Maps the symbol keys of root specializations to their aggregated
+    // instantiation time until their name is known.
+    std::unordered_map<unsigned long long,
+        std::chrono::nanoseconds> pendingTemplates_;
+
+    // Maps front-end passes that create an IFC to the kind of IFC.
+    std::unordered_map<unsigned long long,
+        BuildMetricCategory> ifcFrontEndPasses_;
+};
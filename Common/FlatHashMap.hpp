@@ -0,0 +1,512 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "MonotonicArena.hpp"
+
+// An open-addressing hash table that stores its slots in a single array,
+// using linear probing. Unlike the node-based standard containers,
+// inserting an entry doesn't allocate, and lookups touch contiguous
+// memory. Erasing uses backward shifting, so no tombstones are left
+// behind. FlatHashMap and FlatHashSet are built on top of it.
+//
+// Slots must be default-constructible and movable. Iterators and
+// references are invalidated by any insertion or erasure.
+template <class Key, class Slot, class SlotKey, class Hash, class KeyEqual,
+    class Allocator>
+class FlatHashTable
+{
+    typedef typename std::allocator_traits<Allocator>::template
+        rebind_alloc<Slot> SlotAllocator;
+
+    typedef typename std::allocator_traits<Allocator>::template
+        rebind_alloc<uint8_t> FlagAllocator;
+
+    // The table grows when it is more than this fraction full.
+    static const size_t MAX_LOAD_NUMERATOR = 4;
+    static const size_t MAX_LOAD_DENOMINATOR = 5;
+
+    static const size_t MIN_CAPACITY = 8;
+
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+public:
+    typedef Key key_type;
+    typedef Allocator allocator_type;
+
+    template <bool IsConst>
+    class Iterator
+    {
+        typedef typename std::conditional<IsConst, const FlatHashTable*,
+            FlatHashTable*>::type TablePointer;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename std::conditional<IsConst, const Slot,
+            Slot>::type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        Iterator():
+            table_{nullptr},
+            index_{0}
+        {}
+
+        Iterator(TablePointer table, size_t index):
+            table_{table},
+            index_{index}
+        {
+            SkipEmptySlots();
+        }
+
+        template <bool OtherIsConst, class = typename std::enable_if<
+            OtherIsConst && !IsConst>::type>
+        operator Iterator<OtherIsConst>() const {
+            return Iterator<OtherIsConst>{ table_, index_ };
+        }
+
+        reference operator*() const {
+            return table_->slots_[index_];
+        }
+
+        pointer operator->() const {
+            return &table_->slots_[index_];
+        }
+
+        Iterator& operator++()
+        {
+            ++index_;
+            SkipEmptySlots();
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index_ != other.index_;
+        }
+
+        size_t Index() const {
+            return index_;
+        }
+
+    private:
+        void SkipEmptySlots()
+        {
+            while (index_ < table_->occupied_.size() &&
+                !table_->occupied_[index_])
+            {
+                ++index_;
+            }
+        }
+
+        TablePointer table_;
+        size_t index_;
+    };
+
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> const_iterator;
+
+    FlatHashTable():
+        FlatHashTable(Allocator{})
+    {}
+
+    explicit FlatHashTable(const Allocator& allocator):
+        slots_(SlotAllocator(allocator)),
+        occupied_(FlagAllocator(allocator)),
+        size_{0},
+        hash_{},
+        equal_{}
+    {}
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    iterator begin() {
+        return iterator{ this, 0 };
+    }
+
+    iterator end() {
+        return iterator{ this, occupied_.size() };
+    }
+
+    const_iterator begin() const {
+        return const_iterator{ this, 0 };
+    }
+
+    const_iterator end() const {
+        return const_iterator{ this, occupied_.size() };
+    }
+
+    iterator find(const Key& key)
+    {
+        size_t index = FindIndex(key);
+        return index == NOT_FOUND ? end() : iterator{ this, index };
+    }
+
+    const_iterator find(const Key& key) const
+    {
+        size_t index = FindIndex(key);
+        return index == NOT_FOUND ? end() : const_iterator{ this, index };
+    }
+
+    size_t count(const Key& key) const {
+        return FindIndex(key) == NOT_FOUND ? 0 : 1;
+    }
+
+    size_t erase(const Key& key)
+    {
+        size_t index = FindIndex(key);
+
+        if (index == NOT_FOUND) {
+            return 0;
+        }
+
+        EraseIndex(index);
+        return 1;
+    }
+
+    void erase(const_iterator it) {
+        EraseIndex(it.Index());
+    }
+
+    // Unlike the standard containers, also releases the table's storage.
+    void clear()
+    {
+        slots_ = std::vector<Slot, SlotAllocator>(slots_.get_allocator());
+        occupied_ = std::vector<uint8_t, FlagAllocator>(
+            occupied_.get_allocator());
+
+        size_ = 0;
+    }
+
+    void reserve(size_t count) {
+        Reserve(count);
+    }
+
+protected:
+    // Finds the slot of a key, and claims an empty slot for it if the key
+    // is new. Returns the index of the slot and whether it was claimed.
+    // The table only grows once the key is known to be new.
+    template <class K>
+    std::pair<size_t, bool> FindOrClaim(K&& key)
+    {
+        size_t index = NOT_FOUND;
+
+        if (!slots_.empty())
+        {
+            index = Probe(key);
+
+            if (occupied_[index]) {
+                return { index, false };
+            }
+        }
+
+        if (Reserve(size_ + 1)) {
+            index = Probe(key);
+        }
+
+        SlotKey::Set(slots_[index], std::forward<K>(key));
+        occupied_[index] = 1;
+        ++size_;
+
+        return { index, true };
+    }
+
+    Slot& SlotAt(size_t index) {
+        return slots_[index];
+    }
+
+private:
+    // Scrambles the hash so that keys with poorly distributed hashes,
+    // such as sequential ids with an identity hash, still spread over
+    // the table.
+    size_t HashIndex(const Key& key) const
+    {
+        uint64_t hash = static_cast<uint64_t>(hash_(key)) *
+            0x9E3779B97F4A7C15ull;
+
+        return static_cast<size_t>(hash >> 32 ^ hash) & (slots_.size() - 1);
+    }
+
+    // Returns the slot of a key, or the empty slot that ends its probe
+    // sequence if it isn't in the table. The table must have slots, and
+    // it is never full, so the probe sequence always ends.
+    size_t Probe(const Key& key) const
+    {
+        size_t mask = slots_.size() - 1;
+        size_t index = HashIndex(key);
+
+        while (occupied_[index] &&
+            !equal_(SlotKey::Get(slots_[index]), key))
+        {
+            index = (index + 1) & mask;
+        }
+
+        return index;
+    }
+
+    size_t FindIndex(const Key& key) const
+    {
+        if (size_ == 0) {
+            return NOT_FOUND;
+        }
+
+        size_t index = Probe(key);
+
+        return occupied_[index] ? index : NOT_FOUND;
+    }
+
+    // Moves back the entries that follow the erased one in its probe
+    // sequence, so that lookups never need to skip over holes.
+    void EraseIndex(size_t index)
+    {
+        size_t mask = slots_.size() - 1;
+        size_t hole = index;
+
+        for (size_t next = (hole + 1) & mask; occupied_[next];
+            next = (next + 1) & mask)
+        {
+            size_t home = HashIndex(SlotKey::Get(slots_[next]));
+
+            // The entry can fill the hole only if the hole lies between
+            // its home slot and its current slot, cyclically.
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                slots_[hole] = std::move(slots_[next]);
+                hole = next;
+            }
+        }
+
+        slots_[hole] = Slot{};
+        occupied_[hole] = 0;
+        --size_;
+    }
+
+    // Returns whether the table grew.
+    bool Reserve(size_t count)
+    {
+        size_t capacity = slots_.size();
+
+        if (count * MAX_LOAD_DENOMINATOR <= capacity * MAX_LOAD_NUMERATOR) {
+            return false;
+        }
+
+        size_t newCapacity = capacity == 0 ? MIN_CAPACITY : capacity * 2;
+
+        while (count * MAX_LOAD_DENOMINATOR >
+            newCapacity * MAX_LOAD_NUMERATOR)
+        {
+            newCapacity *= 2;
+        }
+
+        std::vector<Slot, SlotAllocator> slots(newCapacity,
+            slots_.get_allocator());
+        std::vector<uint8_t, FlagAllocator> occupied(newCapacity, 0,
+            occupied_.get_allocator());
+
+        slots.swap(slots_);
+        occupied.swap(occupied_);
+
+        size_t mask = newCapacity - 1;
+
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            if (!occupied[i]) {
+                continue;
+            }
+
+            size_t index = HashIndex(SlotKey::Get(slots[i]));
+
+            while (occupied_[index]) {
+                index = (index + 1) & mask;
+            }
+
+            slots_[index] = std::move(slots[i]);
+            occupied_[index] = 1;
+        }
+
+        return true;
+    }
+
+    std::vector<Slot, SlotAllocator> slots_;
+    std::vector<uint8_t, FlagAllocator> occupied_;
+
+    size_t size_;
+
+    Hash hash_;
+    KeyEqual equal_;
+};
+
+struct FlatHashMapSlotKey
+{
+    template <class Slot>
+    static const typename Slot::first_type& Get(const Slot& slot) {
+        return slot.first;
+    }
+
+    template <class Slot, class K>
+    static void Set(Slot& slot, K&& key) {
+        slot.first = std::forward<K>(key);
+    }
+};
+
+struct FlatHashSetSlotKey
+{
+    template <class Slot>
+    static const Slot& Get(const Slot& slot) {
+        return slot;
+    }
+
+    template <class Slot, class K>
+    static void Set(Slot& slot, K&& key) {
+        slot = std::forward<K>(key);
+    }
+};
+
+// A hash map with the same interface as std::unordered_map for the
+// operations used by the samples. Keys of the entries it iterates over
+// are not const, but must not be modified.
+template <class Key, class Value, class Hash = std::hash<Key>,
+    class KeyEqual = std::equal_to<Key>,
+    class Allocator = std::allocator<std::pair<Key, Value>>>
+class FlatHashMap : public FlatHashTable<Key, std::pair<Key, Value>,
+    FlatHashMapSlotKey, Hash, KeyEqual, Allocator>
+{
+    typedef FlatHashTable<Key, std::pair<Key, Value>, FlatHashMapSlotKey,
+        Hash, KeyEqual, Allocator> Table;
+
+public:
+    typedef Value mapped_type;
+    typedef std::pair<Key, Value> value_type;
+    typedef typename Table::iterator iterator;
+    typedef typename Table::const_iterator const_iterator;
+
+    FlatHashMap() {}
+
+    explicit FlatHashMap(const Allocator& allocator):
+        Table(allocator)
+    {}
+
+    Value& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    template <class K, class... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+    {
+        auto result = this->FindOrClaim(std::forward<K>(key));
+
+        if (result.second) {
+            this->SlotAt(result.first).second =
+                Value(std::forward<Args>(args)...);
+        }
+
+        return { iterator{ this, result.first }, result.second };
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return try_emplace(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return try_emplace(std::move(value.first), std::move(value.second));
+    }
+};
+
+// A hash set with the same interface as std::unordered_set for the
+// operations used by the samples.
+template <class Key, class Hash = std::hash<Key>,
+    class KeyEqual = std::equal_to<Key>,
+    class Allocator = std::allocator<Key>>
+class FlatHashSet : public FlatHashTable<Key, Key, FlatHashSetSlotKey,
+    Hash, KeyEqual, Allocator>
+{
+    typedef FlatHashTable<Key, Key, FlatHashSetSlotKey, Hash, KeyEqual,
+        Allocator> Table;
+
+public:
+    typedef Key value_type;
+    typedef typename Table::const_iterator iterator;
+    typedef typename Table::const_iterator const_iterator;
+
+    FlatHashSet() {}
+
+    explicit FlatHashSet(const Allocator& allocator):
+        Table(allocator)
+    {}
+
+    // Keys of a set can't be modified through its iterators.
+    const_iterator begin() const {
+        return Table::begin();
+    }
+
+    const_iterator end() const {
+        return Table::end();
+    }
+
+    const_iterator find(const Key& key) const {
+        return Table::find(key);
+    }
+
+    template <class K>
+    std::pair<const_iterator, bool> insert(K&& key)
+    {
+        auto result = this->FindOrClaim(std::forward<K>(key));
+
+        return { const_iterator{ this, result.first }, result.second };
+    }
+};
+
+// The hash tables used by the samples for their per-analysis state. They
+// take their memory from an arena owned by the analyzer. Defining
+// BUILD_INSIGHTS_USE_STD_HASH_TABLES switches them back to the node-based
+// standard containers, to compare the memory use and speed of both.
+#ifdef BUILD_INSIGHTS_USE_STD_HASH_TABLES
+
+template <class Key, class Value, class Hash = std::hash<Key>>
+using HashMap = std::unordered_map<Key, Value, Hash, std::equal_to<Key>,
+    ArenaAllocator<std::pair<const Key, Value>>>;
+
+template <class Key, class Hash = std::hash<Key>>
+using HashSet = std::unordered_set<Key, Hash, std::equal_to<Key>,
+    ArenaAllocator<Key>>;
+
+#else
+
+template <class Key, class Value, class Hash = std::hash<Key>>
+using HashMap = FlatHashMap<Key, Value, Hash, std::equal_to<Key>,
+    ArenaAllocator<std::pair<Key, Value>>>;
+
+template <class Key, class Hash = std::hash<Key>>
+using HashSet = FlatHashSet<Key, Hash, std::equal_to<Key>,
+    ArenaAllocator<Key>>;
+
+#endif
@@ -0,0 +1,766 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "NamePool.hpp"
+#include "ReportWriter.hpp"
+#include "Sampling.hpp"
+
+// Reduces a function name to the name of the template it was
+// instantiated from, by dropping template arguments nested deeper than
+// a given depth. With a depth of 0, foo<int> and foo<double> both become
+// foo<>. With a depth of 1, std::vector<std::pair<int,int>> becomes
+// std::vector<std::pair<>>.
+//
+// Decorated names are scanned as they are, without undecorating them,
+// which is slow. Only their qualified name is kept, so that overloads are
+// grouped together as well. The result is then a decorated fragment,
+// such as ?push_back@?$vector@@std@@ for std::vector<>::push_back, which
+// is only meant to be compared. Decorated names that use encodings the
+// scanner doesn't know are kept whole.
+//
+// The result is written to a buffer that is reused from one call to the
+// next, so normalizing doesn't allocate once the buffer has grown to fit
+// the longest name.
+class NameNormalizer
+{
+public:
+    NameNormalizer(unsigned templateDepth):
+        templateDepth_{templateDepth},
+        buffer_{},
+        p_{nullptr},
+        depth_{0}
+    {}
+
+    // The returned string is overwritten by the next call.
+    const std::string& Normalize(const char* name)
+    {
+        buffer_.clear();
+
+        if (name[0] == '?' && NormalizeDecorated(name)) {
+            return buffer_;
+        }
+
+        return NormalizeText(name);
+    }
+
+    // Normalizes an undecorated name. The returned string is overwritten
+    // by the next call.
+    const std::string& NormalizeText(const char* name)
+    {
+        buffer_.clear();
+
+        unsigned depth = 0;
+
+        for (const char* p = name; *p; ++p)
+        {
+            // The angle brackets of operator<, operator<<, operator->
+            // and similar are not template argument lists.
+            if (*p == 'o' && std::strncmp(p, "operator", 8) == 0 &&
+                (p == name || !IsIdentifierChar(p[-1])))
+            {
+                const char* end = p + 8 + OperatorTokenLength(p + 8);
+
+                if (depth <= templateDepth_) {
+                    buffer_.append(p, end);
+                }
+
+                p = end - 1;
+                continue;
+            }
+
+            if (*p == '<')
+            {
+                ++depth;
+
+                if (depth <= templateDepth_ + 1) {
+                    buffer_.push_back('<');
+                }
+
+                continue;
+            }
+
+            if (*p == '>' && depth > 0)
+            {
+                if (depth <= templateDepth_ + 1) {
+                    buffer_.push_back('>');
+                }
+
+                --depth;
+                continue;
+            }
+
+            if (depth <= templateDepth_) {
+                buffer_.push_back(*p);
+            }
+        }
+
+        return buffer_;
+    }
+
+private:
+    // Scans the qualified name at the start of a decorated name, which
+    // lists the unqualified name first and its scopes next, each ending
+    // with @, and the whole name ending with another @. Template
+    // arguments are copied to the buffer up to the template depth.
+    // Returns false if the name uses an encoding that isn't handled.
+    bool NormalizeDecorated(const char* name)
+    {
+        p_ = name;
+        depth_ = 0;
+
+        if (!Consume('?')) {
+            return false;
+        }
+
+        bool isValid = false;
+
+        if (p_[0] == '?' && p_[1] == '$') {
+            isValid = ScanTemplateName();
+        }
+        else if (p_[0] == '?') {
+            isValid = ScanOperatorName();
+        }
+        else {
+            isValid = ScanSimpleName();
+        }
+
+        return isValid && ScanScopes();
+    }
+
+    bool Consume(char c)
+    {
+        if (*p_ != c) {
+            return false;
+        }
+
+        Copy(1);
+        return true;
+    }
+
+    void Copy(size_t length)
+    {
+        if (depth_ <= templateDepth_) {
+            buffer_.append(p_, length);
+        }
+
+        p_ += length;
+    }
+
+    // Name fragments up to the @ that ends the qualified name.
+    bool ScanScopes()
+    {
+        while (*p_ != '@')
+        {
+            if (!ScanNameFragment()) {
+                return false;
+            }
+        }
+
+        Copy(1);
+        return true;
+    }
+
+    bool ScanNameFragment()
+    {
+        if (*p_ >= '0' && *p_ <= '9')
+        {
+            // A reference to an earlier name.
+            Copy(1);
+            return true;
+        }
+
+        if (p_[0] == '?' && p_[1] == '$') {
+            return ScanTemplateName();
+        }
+
+        // An anonymous namespace.
+        if (p_[0] == '?' && p_[1] == 'A')
+        {
+            Copy(1);
+            return ScanSimpleName();
+        }
+
+        return *p_ != '?' && ScanSimpleName();
+    }
+
+    bool ScanSimpleName()
+    {
+        const char* start = p_;
+
+        while (*p_ != '@' && *p_ != '\0') {
+            ++p_;
+        }
+
+        if (*p_ == '\0' || p_ == start) {
+            return false;
+        }
+
+        size_t length = p_ - start + 1;
+
+        p_ = start;
+        Copy(length);
+
+        return true;
+    }
+
+    // Operators, constructors and destructors have a code instead of a
+    // name, such as ?0 for a constructor or ?_0 for operator/=.
+    bool ScanOperatorName()
+    {
+        if (!Consume('?')) {
+            return false;
+        }
+
+        if (*p_ == '_') {
+            Copy(p_[1] == '_' ? 2 : 1);
+        }
+
+        if (!IsIdentifierChar(*p_)) {
+            return false;
+        }
+
+        Copy(1);
+        return true;
+    }
+
+    bool ScanTemplateName()
+    {
+        Copy(2);
+
+        bool isValid = *p_ == '?' ? ScanOperatorName() : ScanSimpleName();
+
+        if (!isValid) {
+            return false;
+        }
+
+        ++depth_;
+
+        while (*p_ != '@')
+        {
+            if (!ScanTemplateArgument())
+            {
+                --depth_;
+                return false;
+            }
+        }
+
+        --depth_;
+
+        Copy(1);
+        return true;
+    }
+
+    bool ScanTemplateArgument()
+    {
+        if (*p_ != '$') {
+            return ScanType();
+        }
+
+        switch (p_[1])
+        {
+        // Integers.
+        case '0':
+        case 'D':
+        case 'Q':
+        case 'R':
+            Copy(2);
+            return ScanNumber(nullptr);
+
+        // An empty non-type parameter pack.
+        case 'S':
+            Copy(2);
+            return true;
+
+        case '$':
+            // Empty parameter packs.
+            if (p_[2] == 'V' || p_[2] == 'Z')
+            {
+                Copy(3);
+                return true;
+            }
+
+            if (p_[2] == '$' && p_[3] == 'V')
+            {
+                Copy(4);
+                return true;
+            }
+
+            return ScanType();
+
+        default:
+            return false;
+        }
+    }
+
+    // A number is a digit for 1 to 10, or hexadecimal digits written
+    // with the letters A to P and ended by @, optionally preceded by ?
+    // for negative numbers.
+    bool ScanNumber(unsigned long long* value)
+    {
+        Consume('?');
+
+        if (*p_ >= '0' && *p_ <= '9')
+        {
+            if (value) {
+                *value = *p_ - '0' + 1;
+            }
+
+            Copy(1);
+            return true;
+        }
+
+        unsigned long long result = 0;
+
+        while (*p_ >= 'A' && *p_ <= 'P')
+        {
+            result = result * 16 + (*p_ - 'A');
+            Copy(1);
+        }
+
+        if (value) {
+            *value = result;
+        }
+
+        return Consume('@');
+    }
+
+    bool ScanType()
+    {
+        char c = *p_;
+
+        // References to earlier types.
+        if (c >= '0' && c <= '9')
+        {
+            Copy(1);
+            return true;
+        }
+
+        switch (c)
+        {
+        // Fundamental types.
+        case 'C': case 'D': case 'E': case 'F': case 'G': case 'H':
+        case 'I': case 'J': case 'K': case 'M': case 'N': case 'O':
+        case 'X': case 'Z':
+            Copy(1);
+            return true;
+
+        // More fundamental types, such as _J for long long.
+        case '_':
+            if (p_[1] < 'A' || p_[1] > 'Z') {
+                return false;
+            }
+
+            Copy(2);
+            return true;
+
+        // Unions, structs and classes.
+        case 'T':
+        case 'U':
+        case 'V':
+            Copy(1);
+            return ScanScopes();
+
+        // Enums, with their underlying type.
+        case 'W':
+            Copy(1);
+
+            if (*p_ < '0' || *p_ > '9') {
+                return false;
+            }
+
+            Copy(1);
+            return ScanScopes();
+
+        // Pointers and references.
+        case 'A':
+        case 'B':
+        case 'P':
+        case 'Q':
+        case 'R':
+        case 'S':
+            Copy(1);
+            return ScanPointee();
+
+        // Arrays: the number of dimensions, their sizes, and the type of
+        // the elements.
+        case 'Y':
+        {
+            Copy(1);
+
+            unsigned long long dimensionCount = 0;
+
+            if (!ScanNumber(&dimensionCount)) {
+                return false;
+            }
+
+            for (unsigned long long i = 0; i < dimensionCount; ++i)
+            {
+                if (!ScanNumber(nullptr)) {
+                    return false;
+                }
+            }
+
+            return ScanType();
+        }
+
+        case '$':
+            if (p_[1] != '$') {
+                return false;
+            }
+
+            switch (p_[2])
+            {
+            // Rvalue references.
+            case 'Q':
+            case 'R':
+                Copy(3);
+                return ScanPointee();
+
+            // Function types, as in std::function<void(int)>.
+            case 'A':
+                if (p_[3] != '6') {
+                    return false;
+                }
+
+                Copy(4);
+                return ScanFunctionType();
+
+            // Qualified types.
+            case 'C':
+                Copy(3);
+
+                if (*p_ < 'A' || *p_ > 'D') {
+                    return false;
+                }
+
+                Copy(1);
+                return ScanType();
+
+            // std::nullptr_t.
+            case 'T':
+                Copy(3);
+                return true;
+
+            default:
+                return false;
+            }
+
+        default:
+            return false;
+        }
+    }
+
+    // The pointer modifiers, such as E for 64-bit pointers, the
+    // qualifiers of the pointee and the pointee.
+    bool ScanPointee()
+    {
+        while (*p_ == 'E' || *p_ == 'F' || *p_ == 'I') {
+            Copy(1);
+        }
+
+        if (*p_ == '6')
+        {
+            Copy(1);
+            return ScanFunctionType();
+        }
+
+        if (*p_ < 'A' || *p_ > 'D') {
+            return false;
+        }
+
+        Copy(1);
+        return ScanType();
+    }
+
+    // The calling convention, the return type, the parameter types and
+    // the exception specification.
+    bool ScanFunctionType()
+    {
+        if (*p_ < 'A' || *p_ > 'Z') {
+            return false;
+        }
+
+        Copy(1);
+
+        // Returned classes are qualified.
+        if (*p_ == '?')
+        {
+            Copy(1);
+
+            if (*p_ < 'A' || *p_ > 'D') {
+                return false;
+            }
+
+            Copy(1);
+        }
+
+        if (!ScanType()) {
+            return false;
+        }
+
+        if (*p_ == 'X') {
+            Copy(1);
+        }
+        else
+        {
+            while (*p_ != '@' && *p_ != 'Z')
+            {
+                if (!ScanType()) {
+                    return false;
+                }
+            }
+
+            Consume('@');
+        }
+
+        return Consume('Z');
+    }
+
+    // Length of the operator token at the given position, if it contains
+    // an angle bracket. Longer tokens are matched first.
+    static size_t OperatorTokenLength(const char* p)
+    {
+        static const char* const TOKENS[] = {
+            "<<=", ">>=", "<=>", "<<", ">>", "<=", ">=", "->", "<", ">"
+        };
+
+        for (const char* token : TOKENS)
+        {
+            size_t length = std::strlen(token);
+
+            if (std::strncmp(p, token, length) == 0) {
+                return length;
+            }
+        }
+
+        return 0;
+    }
+
+    static bool IsIdentifierChar(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_';
+    }
+
+    unsigned templateDepth_;
+
+    std::string buffer_;
+
+    // The position and template depth of the decorated name being
+    // scanned.
+    const char* p_;
+    unsigned depth_;
+};
+
+// Aggregates function code generation times by normalized name, so that
+// templates whose instantiations are each fast, but that are
+// instantiated many times, can be identified.
+class FunctionGroups
+{
+public:
+    struct Group
+    {
+        uint32_t NameId;
+
+        // The name of the first function of the group, in
+        // representatives_, from which the group's name is reported.
+        uint32_t RepresentativeId;
+
+        unsigned long long Count;
+        std::chrono::nanoseconds TotalDuration;
+        std::chrono::nanoseconds MaxDuration;
+        SampledTotal SampledDuration;
+
+        bool operator<(const Group& other) const {
+            return TotalDuration > other.TotalDuration;
+        }
+    };
+
+    FunctionGroups(unsigned templateDepth):
+        normalizer_{templateDepth},
+        names_{},
+        representatives_{},
+        groups_{},
+        invocationDurations_{}
+    {}
+
+    // The invocation id is only needed when the functions of some
+    // invocations aren't added, to estimate the totals of the build. It
+    // is the id of the top-level invocation, the one that is sampled, and
+    // its durations are added to the estimates once StopInvocation is
+    // called for it.
+    void Add(const char* name, std::chrono::nanoseconds duration,
+        unsigned long long invocationId = 0)
+    {
+        const std::string& normalized = normalizer_.Normalize(name);
+
+        uint32_t id = names_.Intern(normalized.data(), normalized.size());
+
+        // Ids are assigned sequentially, so they double as indices.
+        if (id == groups_.size()) {
+            groups_.push_back({ id, representatives_.Intern(name), 0,
+                std::chrono::nanoseconds{0}, std::chrono::nanoseconds{0},
+                SampledTotal{} });
+        }
+
+        Group& group = groups_[id];
+
+        ++group.Count;
+        group.TotalDuration += duration;
+        group.MaxDuration = std::max(group.MaxDuration, duration);
+
+        if (invocationId == 0) {
+            group.SampledDuration.Add(duration);
+        }
+        else {
+            invocationDurations_.Add(invocationId, id, duration);
+        }
+    }
+
+    void StopInvocation(unsigned long long invocationId)
+    {
+        invocationDurations_.Stop(invocationId,
+            [this](uint32_t id, std::chrono::nanoseconds duration) {
+                groups_[id].SampledDuration.Add(duration);
+            });
+    }
+
+    // Stops the invocations that didn't stop before the end of the trace.
+    void StopAllInvocations()
+    {
+        invocationDurations_.StopAll(
+            [this](uint32_t id, std::chrono::nanoseconds duration) {
+                groups_[id].SampledDuration.Add(duration);
+            });
+    }
+
+    size_t Count() const {
+        return groups_.size();
+    }
+
+    // Prints the groups with the largest total duration. When only a
+    // fraction of the invocations was added, totals and counts are
+    // estimated for the whole build, with a 95% confidence interval.
+    void Print(ReportWriter& report, size_t countToDump,
+        const NameOptions& nameOptions, double samplingRate = 1.) const
+    {
+        using namespace std::chrono;
+
+        std::vector<Group> sorted{ groups_ };
+
+        countToDump = std::min(countToDump, sorted.size());
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end());
+
+        bool isSampled = samplingRate < 1.;
+
+        NameNormalizer normalizer{ normalizer_ };
+
+        if (report.IsText())
+        {
+            std::cout << "\nTop " << countToDump <<
+                " function groups by total code generation time";
+
+            if (isSampled) {
+                std::cout << " (estimated from " << samplingRate * 100. <<
+                    "% of invocations)";
+            }
+
+            std::cout << ":\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const Group& group = sorted[i];
+
+            long long totalMs = duration_cast<milliseconds>(
+                group.SampledDuration.Estimate(samplingRate)).count();
+
+            long long marginMs = duration_cast<milliseconds>(
+                group.SampledDuration.Margin(samplingRate)).count();
+
+            unsigned long long count = static_cast<unsigned long long>(
+                static_cast<double>(group.Count) / samplingRate + 0.5);
+
+            long long meanMs = duration_cast<milliseconds>(
+                group.TotalDuration / group.Count).count();
+
+            long long maxMs = duration_cast<milliseconds>(
+                group.MaxDuration).count();
+
+            std::string name = FormatName(GroupName(
+                representatives_.Name(group.RepresentativeId),
+                normalizer).c_str(), nameOptions);
+
+            if (!report.IsText())
+            {
+                report.BeginRecord("FunctionGroup")
+                    .Field("Count", count)
+                    .Field("TotalDurationMs", totalMs)
+                    .Field("MeanDurationMs", meanMs)
+                    .Field("MaxDurationMs", maxMs)
+                    .Field("Name", name);
+
+                if (isSampled) {
+                    report.Field("MarginMs", marginMs);
+                }
+
+                report.EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Duration: " << totalMs;
+
+            if (isSampled) {
+                std::cout << " +/- " << marginMs;
+            }
+
+            std::cout << "\t Count: " << count;
+            std::cout << "\t Mean: " << meanMs;
+            std::cout << "\t Max: " << maxMs;
+            std::cout << "\t Group Name: " << name << "\n";
+        }
+    }
+
+private:
+    // The name of a group is that of its representative, undecorated and
+    // then normalized. Undecorating is slow, so it is only done for the
+    // groups that are reported.
+    static std::string GroupName(const char* representative,
+        NameNormalizer& normalizer)
+    {
+#ifdef _WIN32
+        char undecorated[4096];
+
+        if (representative[0] == '?' && UnDecorateSymbolName(representative,
+            undecorated, sizeof(undecorated), UNDNAME_NAME_ONLY) != 0)
+        {
+            representative = undecorated;
+        }
+#endif
+
+        return normalizer.NormalizeText(representative);
+    }
+
+    NameNormalizer normalizer_;
+
+    // The normalized names that identify the groups.
+    NamePool names_;
+
+    NamePool representatives_;
+
+    // Indexed by name id.
+    std::vector<Group> groups_;
+
+    // The durations of each group by each running top-level invocation,
+    // when only some invocations are added.
+    InvocationSums<uint32_t> invocationDurations_;
+};
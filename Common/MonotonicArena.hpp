@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+
+// A bump allocator for the transient state of an analysis. Allocations
+// are carved out of large blocks and are never returned to the heap
+// individually: all of the memory is released at once when the arena is
+// destroyed. This suits analyzers, which mostly grow their tables until
+// the end of the analysis.
+//
+// Deallocated memory is kept on a free list for its size, and reused by
+// later allocations of the same size. This recycles the nodes of
+// node-based containers that erase entries, and the arrays that hash
+// tables leave behind when they grow, since tables of the same type grow
+// through the same sequence of sizes. Sizes are rounded up to a multiple
+// of the size of a pointer, so that freed memory can hold the link of
+// its free list.
+class MonotonicArena
+{
+    struct Block
+    {
+        Block* Previous;
+    };
+
+    struct FreeEntry
+    {
+        FreeEntry* Next;
+    };
+
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+    // Sizes up to this one have their free list in an array, since most
+    // allocations are small.
+    static const size_t MAX_SMALL_SIZE = 256;
+
+    MonotonicArena(size_t blockSize = DEFAULT_BLOCK_SIZE):
+        blockSize_{blockSize},
+        lastBlock_{nullptr},
+        current_{0},
+        end_{0},
+        allocatedSize_{0},
+        heldSize_{0},
+        smallFreeLists_{},
+        freeLists_{}
+    {}
+
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    ~MonotonicArena()
+    {
+        while (lastBlock_)
+        {
+            Block* previous = lastBlock_->Previous;
+            ::operator delete(lastBlock_);
+            lastBlock_ = previous;
+        }
+    }
+
+    void* Allocate(size_t size, size_t alignment)
+    {
+        size = RecycledSize(size);
+
+        allocatedSize_ += size;
+
+        FreeEntry** head = FindFreeList(size);
+
+        if (head && *head && Align(reinterpret_cast<uintptr_t>(*head),
+            alignment) == reinterpret_cast<uintptr_t>(*head))
+        {
+            FreeEntry* entry = *head;
+            *head = entry->Next;
+
+            return entry;
+        }
+
+        // Large allocations get a block of their own, so that they don't
+        // waste the rest of the current block.
+        if (size + alignment > blockSize_ / 4)
+        {
+            uintptr_t start = AddBlock(size + alignment);
+            return reinterpret_cast<void*>(Align(start, alignment));
+        }
+
+        uintptr_t aligned = Align(current_, alignment);
+
+        if (current_ == 0 || aligned + size > end_)
+        {
+            current_ = AddBlock(blockSize_);
+            end_ = current_ + blockSize_;
+
+            aligned = Align(current_, alignment);
+        }
+
+        current_ = aligned + size;
+
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void Deallocate(void* p, size_t size)
+    {
+        size = RecycledSize(size);
+
+        FreeEntry*& head = size <= MAX_SMALL_SIZE ?
+            smallFreeLists_[size / sizeof(FreeEntry)] : freeLists_[size];
+
+        FreeEntry* entry = static_cast<FreeEntry*>(p);
+        entry->Next = head;
+        head = entry;
+    }
+
+    // Total size of the allocations made from this arena, including
+    // those served from recycled memory. This is a running total, not
+    // the memory in use.
+    size_t AllocatedSize() const {
+        return allocatedSize_;
+    }
+
+    // Total size of the blocks held by this arena. Blocks are only
+    // released when the arena is destroyed, so this is also the most
+    // memory it has held.
+    size_t HeldSize() const {
+        return heldSize_;
+    }
+
+private:
+    static uintptr_t Align(uintptr_t address, size_t alignment) {
+        return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    }
+
+    static size_t RecycledSize(size_t size)
+    {
+        if (size < sizeof(FreeEntry)) {
+            return sizeof(FreeEntry);
+        }
+
+        return (size + sizeof(FreeEntry) - 1) & ~(sizeof(FreeEntry) - 1);
+    }
+
+    FreeEntry** FindFreeList(size_t size)
+    {
+        if (size <= MAX_SMALL_SIZE) {
+            return &smallFreeLists_[size / sizeof(FreeEntry)];
+        }
+
+        auto it = freeLists_.find(size);
+
+        return it == freeLists_.end() ? nullptr : &it->second;
+    }
+
+    uintptr_t AddBlock(size_t size)
+    {
+        Block* block = static_cast<Block*>(
+            ::operator new(sizeof(Block) + size));
+
+        block->Previous = lastBlock_;
+        lastBlock_ = block;
+
+        heldSize_ += sizeof(Block) + size;
+
+        return reinterpret_cast<uintptr_t>(block + 1);
+    }
+
+    size_t blockSize_;
+
+    Block* lastBlock_;
+
+    uintptr_t current_;
+    uintptr_t end_;
+
+    size_t allocatedSize_;
+    size_t heldSize_;
+
+    // Indexed by size divided by the size of a pointer.
+    FreeEntry* smallFreeLists_[MAX_SMALL_SIZE / sizeof(FreeEntry) + 1];
+
+    std::unordered_map<size_t, FreeEntry*> freeLists_;
+};
+
+// A standard allocator that takes its memory from a MonotonicArena. An
+// allocator that isn't bound to an arena uses the global heap, so that
+// containers using it can still be default-constructed.
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() noexcept:
+        arena_{nullptr}
+    {}
+
+    ArenaAllocator(MonotonicArena& arena) noexcept:
+        arena_{&arena}
+    {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept:
+        arena_{other.Arena()}
+    {}
+
+    T* allocate(size_t count)
+    {
+        if (count > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc{};
+        }
+
+        if (arena_ == nullptr) {
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        }
+
+        return static_cast<T*>(arena_->Allocate(count * sizeof(T),
+            alignof(T)));
+    }
+
+    void deallocate(T* p, size_t count) noexcept
+    {
+        if (arena_ == nullptr) {
+            ::operator delete(p);
+        }
+        else {
+            arena_->Deallocate(p, count * sizeof(T));
+        }
+    }
+
+    MonotonicArena* Arena() const noexcept {
+        return arena_;
+    }
+
+private:
+    MonotonicArena* arena_;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+    return lhs.Arena() == rhs.Arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+    return lhs.Arena() != rhs.Arena();
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <DbgHelp.h>
+#pragma comment(lib, "Dbghelp.lib")
+#endif
+
+// Stores each distinct name once, in a single buffer, and identifies it
+// by a 32-bit id. Analyzers keep ids on their hot path instead of
+// copying names, which for template-heavy functions can be several KB
+// long, and only turn the ids back into strings for the entries they
+// report.
+//
+// Pointers returned by Name() are invalidated by Intern() and Compact().
+class NamePool
+{
+public:
+    NamePool():
+        data_{},
+        offsets_{ 0 },
+        hashes_{},
+        slots_{}
+    {}
+
+    size_t Count() const {
+        return hashes_.size();
+    }
+
+    // Total size of the stored names, including their terminators.
+    size_t DataSize() const {
+        return data_.size();
+    }
+
+    const char* Name(uint32_t id) const {
+        return data_.data() + offsets_[id];
+    }
+
+    size_t Length(uint32_t id) const {
+        return offsets_[id + 1] - offsets_[id] - 1;
+    }
+
+    uint32_t Intern(const char* name) {
+        return Intern(name, std::strlen(name));
+    }
+
+    uint32_t Intern(const char* name, size_t length)
+    {
+        uint64_t hash = Hash(name, length);
+
+        if ((Count() + 1) * 4 > slots_.size() * 3) {
+            Grow();
+        }
+
+        size_t mask = slots_.size() - 1;
+
+        for (size_t index = static_cast<size_t>(hash) & mask;;
+            index = (index + 1) & mask)
+        {
+            uint32_t slot = slots_[index];
+
+            if (slot == 0)
+            {
+                uint32_t id = static_cast<uint32_t>(Count());
+
+                data_.insert(data_.end(), name, name + length);
+                data_.push_back('\0');
+
+                offsets_.push_back(data_.size());
+                hashes_.push_back(hash);
+
+                slots_[index] = id + 1;
+
+                return id;
+            }
+
+            uint32_t id = slot - 1;
+
+            if (hashes_[id] == hash && Length(id) == length &&
+                std::memcmp(Name(id), name, length) == 0)
+            {
+                return id;
+            }
+        }
+    }
+
+    // Drops the names that are no longer referenced. forEachId is called
+    // with a function that must be applied to every id still in use, and
+    // that updates the id in place.
+    template <class ForEachId>
+    void Compact(ForEachId forEachId)
+    {
+        NamePool compacted;
+
+        forEachId([&](uint32_t& id) {
+            id = compacted.Intern(Name(id), Length(id));
+        });
+
+        *this = std::move(compacted);
+    }
+
+private:
+    // 64-bit FNV-1a.
+    static uint64_t Hash(const char* name, size_t length)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= 0x100000001B3ull;
+        }
+
+        return hash;
+    }
+
+    void Grow()
+    {
+        std::vector<uint32_t> slots(slots_.empty() ? 64 : slots_.size() * 2, 0);
+
+        size_t mask = slots.size() - 1;
+
+        for (uint32_t id = 0; id < Count(); ++id)
+        {
+            size_t index = static_cast<size_t>(hashes_[id]) & mask;
+
+            while (slots[index] != 0) {
+                index = (index + 1) & mask;
+            }
+
+            slots[index] = id + 1;
+        }
+
+        slots_.swap(slots);
+    }
+
+    std::vector<char> data_;
+
+    // Offset of each name in data_, followed by the size of data_.
+    std::vector<size_t> offsets_;
+
+    std::vector<uint64_t> hashes_;
+
+    // Open-addressing table of ids + 1, where 0 marks an empty slot.
+    std::vector<uint32_t> slots_;
+};
+
+// How names are turned into strings when they are reported.
+struct NameOptions
+{
+    // Undecorate C++ symbol names, on Windows.
+    bool Undecorate = false;
+
+    // Shorten names longer than this many characters, if not 0.
+    size_t MaxLength = 0;
+
+    // Group functions by name, keeping template arguments up to this
+    // depth, if not negative. See NameNormalizer.
+    int GroupDepth = -1;
+};
+
+// Extracts the /undecorate, /namelength:<count> and /group[:<depth>]
+// options from the command line, in the same way as ParseReportOptions.
+// Returns false if an option has an invalid value.
+inline bool ParseNameOptions(int& argc, char* argv[], NameOptions& options)
+{
+    int kept = 0;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+
+        if (i > 0 && std::strcmp(arg, "/undecorate") == 0)
+        {
+            options.Undecorate = true;
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/namelength:", 12) == 0)
+        {
+            int maxLength = std::atoi(arg + 12);
+
+            if (maxLength <= 3) {
+                return false;
+            }
+
+            options.MaxLength = static_cast<size_t>(maxLength);
+            continue;
+        }
+
+        if (i > 0 && std::strcmp(arg, "/group") == 0)
+        {
+            options.GroupDepth = 0;
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/group:", 7) == 0)
+        {
+            char* end = nullptr;
+            long depth = std::strtol(arg + 7, &end, 10);
+
+            if (end == arg + 7 || *end != '\0' || depth < 0) {
+                return false;
+            }
+
+            options.GroupDepth = static_cast<int>(depth);
+            continue;
+        }
+
+        argv[kept++] = argv[i];
+    }
+
+    argc = kept;
+
+    return true;
+}
+
+// Materializes a name for reporting, undecorating and shortening it as
+// requested. Long names are shortened in the middle, since both the
+// beginning and the end of a C++ name tend to be informative.
+inline std::string FormatName(const char* name, const NameOptions& options)
+{
+    std::string formatted;
+
+#ifdef _WIN32
+    if (options.Undecorate && name[0] == '?')
+    {
+        char buffer[4096];
+
+        if (UnDecorateSymbolName(name, buffer, sizeof(buffer),
+            UNDNAME_COMPLETE) != 0)
+        {
+            formatted = buffer;
+        }
+    }
+#endif
+
+    if (formatted.empty()) {
+        formatted = name;
+    }
+
+    if (options.MaxLength != 0 && formatted.size() > options.MaxLength)
+    {
+        size_t kept = options.MaxLength - 3;
+        size_t head = (kept + 1) / 2;
+        size_t tail = kept - head;
+
+        formatted = formatted.substr(0, head) + "..." +
+            formatted.substr(formatted.size() - tail);
+    }
+
+    return formatted;
+}
@@ -0,0 +1,678 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Output formats supported by the samples. TEXT is the human-readable
+// output each sample prints by default. The other formats are meant to
+// be ingested by tools, and are produced by ReportWriter.
+enum class ReportFormat
+{
+    TEXT,
+    JSON_LINES,
+    CSV,
+    BINARY
+};
+
+struct ReportOptions
+{
+    ReportFormat Format = ReportFormat::TEXT;
+    std::string OutputPath;
+};
+
+// Extracts the /format:<text|jsonl|csv|binary> and /out:<path> options
+// from the command line. Recognized options are removed from argv so
+// that the samples' positional arguments keep their usual position.
+// Returns false if an option has an invalid value, if /out is given
+// for the text format, which is always printed to the standard output,
+// or if /out is missing for CSV, which writes one file per record type.
+inline bool ParseReportOptions(int& argc, char* argv[],
+    ReportOptions& options)
+{
+    int kept = 0;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+
+        if (i > 0 && std::strncmp(arg, "/format:", 8) == 0)
+        {
+            const char* value = arg + 8;
+
+            if (std::strcmp(value, "text") == 0) {
+                options.Format = ReportFormat::TEXT;
+            }
+            else if (std::strcmp(value, "jsonl") == 0) {
+                options.Format = ReportFormat::JSON_LINES;
+            }
+            else if (std::strcmp(value, "csv") == 0) {
+                options.Format = ReportFormat::CSV;
+            }
+            else if (std::strcmp(value, "binary") == 0) {
+                options.Format = ReportFormat::BINARY;
+            }
+            else {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/out:", 5) == 0)
+        {
+            options.OutputPath = arg + 5;
+            continue;
+        }
+
+        argv[kept++] = argv[i];
+    }
+
+    argc = kept;
+
+    if (options.Format == ReportFormat::TEXT) {
+        return options.OutputPath.empty();
+    }
+
+    return options.Format != ReportFormat::CSV || !options.OutputPath.empty();
+}
+
+// Appends a UTF-16 string, as provided by the SDK for paths and command
+// lines, to a UTF-8 string. Unpaired surrogates are replaced by U+FFFD.
+inline void AppendUtf8(std::string& out, const wchar_t* str)
+{
+    if (str == nullptr) {
+        return;
+    }
+
+    for (const wchar_t* p = str; *p; ++p)
+    {
+        uint32_t c = static_cast<uint32_t>(*p);
+
+        if (sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDFFF)
+        {
+            uint32_t next = static_cast<uint32_t>(p[1]);
+
+            if (c <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (next - 0xDC00);
+                ++p;
+            }
+            else {
+                c = 0xFFFD;
+            }
+        }
+
+        if (c < 0x80) {
+            out.push_back(static_cast<char>(c));
+        }
+        else if (c < 0x800)
+        {
+            out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000)
+        {
+            out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+        else
+        {
+            out.push_back(static_cast<char>(0xF0 | (c >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+    }
+}
+
+inline std::string ToUtf8(const wchar_t* str)
+{
+    std::string out;
+
+    AppendUtf8(out, str);
+
+    return out;
+}
+
+// Writes records made of named fields in one of the structured report
+// formats. Output is accumulated in a large buffer and written with a
+// single call once it fills up, instead of being flushed line by line.
+//
+// A record is written by calling BeginRecord, then Field once per value,
+// then EndRecord. Records of the same type must always have the same
+// fields in the same order, and field names must outlive the writer
+// (string literals are fine). Real values that aren't finite, such as
+// a percentage of a total of zero, are written as null in JSON Lines and
+// as an empty field in CSV.
+//
+// - JSON Lines: one JSON object per line, with a "type" member holding
+//   the record type.
+// - CSV: each record type is written to its own file, which starts with
+//   a header line, so that each file is a table. The files are named
+//   after the output path, with the record type inserted before the
+//   extension (report.csv gives report.Function.csv), so an output path
+//   is required. The first column always holds the record type.
+// - Binary: a "BIRW" signature and a version byte, followed by schema
+//   and record entries. A schema entry (0x01) defines a record type the
+//   first time it is seen: its id, name, and field names and kinds. A
+//   record entry (0x02) holds the record type id and the field values.
+//   Integers are zigzag LEB128 varints, doubles are 8 little-endian
+//   bytes, and strings are a varint byte count followed by UTF-8 bytes.
+class ReportWriter
+{
+    enum class FieldKind : unsigned char
+    {
+        INTEGER = 1,
+        REAL = 2,
+        STRING = 3
+    };
+
+    struct RecordSchema
+    {
+        unsigned Id;
+        bool IsWritten;
+        std::vector<const char*> FieldNames;
+        std::vector<FieldKind> FieldKinds;
+
+        // The file and buffer of the record type, in CSV.
+        FILE* File;
+        std::string Buffer;
+    };
+
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    ReportWriter(const ReportOptions& options):
+        format_{options.Format},
+        outputPath_{options.OutputPath},
+        hasFailed_{false},
+        file_{nullptr},
+        ownsFile_{false},
+        buffer_{},
+        record_{},
+        utf8_{},
+        recordType_{nullptr},
+        schema_{nullptr},
+        schemas_{}
+    {
+        // CSV files are opened as record types are seen.
+        if (format_ == ReportFormat::TEXT || format_ == ReportFormat::CSV) {
+            return;
+        }
+
+        if (options.OutputPath.empty())
+        {
+            file_ = stdout;
+
+#ifdef _WIN32
+            if (format_ == ReportFormat::BINARY) {
+                _setmode(_fileno(stdout), _O_BINARY);
+            }
+#endif
+        }
+        else
+        {
+            file_ = std::fopen(options.OutputPath.c_str(),
+                format_ == ReportFormat::BINARY ? "wb" : "w");
+            ownsFile_ = file_ != nullptr;
+        }
+
+        buffer_.reserve(BUFFER_SIZE);
+
+        if (format_ == ReportFormat::BINARY) {
+            buffer_.append("BIRW\x01", 5);
+        }
+    }
+
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    ~ReportWriter()
+    {
+        Flush();
+
+        if (ownsFile_) {
+            std::fclose(file_);
+        }
+
+        for (auto& entry : schemas_)
+        {
+            if (entry.second.File) {
+                std::fclose(entry.second.File);
+            }
+        }
+    }
+
+    // Samples print their usual human-readable output when this is true.
+    bool IsText() const {
+        return format_ == ReportFormat::TEXT;
+    }
+
+    // False if the output file could not be opened, or, in CSV, if the
+    // file of a record type could not be opened.
+    bool IsValid() const
+    {
+        if (hasFailed_) {
+            return false;
+        }
+
+        return IsText() || format_ == ReportFormat::CSV || file_ != nullptr;
+    }
+
+    ReportWriter& BeginRecord(const char* type)
+    {
+        record_.clear();
+
+        // Consecutive records are usually of the same type, whose name is
+        // then the same literal. Other names are looked up by value, as
+        // identical literals aren't guaranteed to share an address.
+        if (schema_ == nullptr || type != recordType_)
+        {
+            auto result = schemas_.try_emplace(type, RecordSchema{});
+
+            schema_ = &result.first->second;
+
+            if (result.second) {
+                schema_->Id = static_cast<unsigned>(schemas_.size());
+            }
+        }
+
+        recordType_ = type;
+
+        switch (format_)
+        {
+        case ReportFormat::JSON_LINES:
+            record_ += "{\"type\":";
+            AppendJsonString(type, std::strlen(type));
+            break;
+
+        case ReportFormat::CSV:
+            AppendCsvString(type, std::strlen(type));
+            break;
+
+        case ReportFormat::BINARY:
+            record_.push_back(2);
+            AppendVarint(schema_->Id);
+            break;
+
+        default:
+            break;
+        }
+
+        return *this;
+    }
+
+    ReportWriter& Field(const char* name, long long value)
+    {
+        BeginField(name, FieldKind::INTEGER);
+
+        if (format_ == ReportFormat::BINARY)
+        {
+            AppendVarint((static_cast<uint64_t>(value) << 1) ^
+                static_cast<uint64_t>(value >> 63));
+        }
+        else {
+            record_ += std::to_string(value);
+        }
+
+        return *this;
+    }
+
+    ReportWriter& Field(const char* name, unsigned long long value) {
+        return Field(name, static_cast<long long>(value));
+    }
+
+    ReportWriter& Field(const char* name, unsigned long value) {
+        return Field(name, static_cast<long long>(value));
+    }
+
+    ReportWriter& Field(const char* name, long value) {
+        return Field(name, static_cast<long long>(value));
+    }
+
+    ReportWriter& Field(const char* name, unsigned value) {
+        return Field(name, static_cast<long long>(value));
+    }
+
+    ReportWriter& Field(const char* name, int value) {
+        return Field(name, static_cast<long long>(value));
+    }
+
+    ReportWriter& Field(const char* name, bool value) {
+        return Field(name, static_cast<long long>(value ? 1 : 0));
+    }
+
+    ReportWriter& Field(const char* name, double value)
+    {
+        BeginField(name, FieldKind::REAL);
+
+        if (format_ == ReportFormat::BINARY)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+
+            for (int i = 0; i < 8; ++i) {
+                record_.push_back(static_cast<char>(bits >> (i * 8)));
+            }
+        }
+        else if (!std::isfinite(value))
+        {
+            if (format_ == ReportFormat::JSON_LINES) {
+                record_ += "null";
+            }
+        }
+        else
+        {
+            char text[32];
+            int length = std::snprintf(text, sizeof(text), "%.17g", value);
+            record_.append(text, length);
+        }
+
+        return *this;
+    }
+
+    ReportWriter& Field(const char* name, const char* value) {
+        return StringField(name, value ? value : "",
+            value ? std::strlen(value) : 0);
+    }
+
+    ReportWriter& Field(const char* name, const std::string& value) {
+        return StringField(name, value.data(), value.size());
+    }
+
+    ReportWriter& Field(const char* name, const wchar_t* value)
+    {
+        utf8_.clear();
+        AppendUtf8(utf8_, value);
+
+        return StringField(name, utf8_.data(), utf8_.size());
+    }
+
+    ReportWriter& Field(const char* name, const std::wstring& value) {
+        return Field(name, value.c_str());
+    }
+
+    void EndRecord()
+    {
+        bool isNewSchema = !schema_->IsWritten;
+
+        schema_->IsWritten = true;
+
+        switch (format_)
+        {
+        case ReportFormat::JSON_LINES:
+            buffer_ += record_;
+            buffer_ += "}\n";
+            break;
+
+        case ReportFormat::CSV:
+            if (isNewSchema) {
+                OpenCsvFile();
+            }
+
+            schema_->Buffer += record_;
+            schema_->Buffer += '\n';
+
+            if (schema_->Buffer.size() >= BUFFER_SIZE) {
+                FlushCsvFile(*schema_);
+            }
+            break;
+
+        case ReportFormat::BINARY:
+            if (isNewSchema) {
+                WriteBinarySchema();
+            }
+
+            buffer_ += record_;
+            break;
+
+        default:
+            break;
+        }
+
+        if (buffer_.size() >= BUFFER_SIZE) {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        for (auto& entry : schemas_) {
+            FlushCsvFile(entry.second);
+        }
+
+        if (file_ && !buffer_.empty()) {
+            std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+        }
+
+        buffer_.clear();
+
+        if (file_) {
+            std::fflush(file_);
+        }
+    }
+
+private:
+    void BeginField(const char* name, FieldKind kind)
+    {
+        // The schema is recorded as fields are seen the first time a
+        // record type is written.
+        if (!schema_->IsWritten)
+        {
+            schema_->FieldNames.push_back(name);
+            schema_->FieldKinds.push_back(kind);
+        }
+
+        switch (format_)
+        {
+        case ReportFormat::JSON_LINES:
+            record_ += ',';
+            AppendJsonString(name, std::strlen(name));
+            record_ += ':';
+            break;
+
+        case ReportFormat::CSV:
+            record_ += ',';
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    ReportWriter& StringField(const char* name, const char* value,
+        size_t length)
+    {
+        BeginField(name, FieldKind::STRING);
+
+        switch (format_)
+        {
+        case ReportFormat::JSON_LINES:
+            AppendJsonString(value, length);
+            break;
+
+        case ReportFormat::CSV:
+            AppendCsvString(value, length);
+            break;
+
+        case ReportFormat::BINARY:
+            AppendVarint(length);
+            record_.append(value, length);
+            break;
+
+        default:
+            break;
+        }
+
+        return *this;
+    }
+
+    void AppendJsonString(const char* str, size_t length)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        record_ += '"';
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(str[i]);
+
+            switch (c)
+            {
+            case '"':  record_ += "\\\""; break;
+            case '\\': record_ += "\\\\"; break;
+            case '\n': record_ += "\\n"; break;
+            case '\r': record_ += "\\r"; break;
+            case '\t': record_ += "\\t"; break;
+
+            default:
+                if (c < 0x20)
+                {
+                    record_ += "\\u00";
+                    record_ += hex[c >> 4];
+                    record_ += hex[c & 0xF];
+                }
+                else {
+                    record_ += static_cast<char>(c);
+                }
+                break;
+            }
+        }
+
+        record_ += '"';
+    }
+
+    void AppendCsvString(const char* str, size_t length)
+    {
+        bool needsQuotes = false;
+
+        for (size_t i = 0; i < length && !needsQuotes; ++i)
+        {
+            char c = str[i];
+            needsQuotes = c == ',' || c == '"' || c == '\n' || c == '\r';
+        }
+
+        if (!needsQuotes)
+        {
+            record_.append(str, length);
+            return;
+        }
+
+        record_ += '"';
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (str[i] == '"') {
+                record_ += '"';
+            }
+
+            record_ += str[i];
+        }
+
+        record_ += '"';
+    }
+
+    void AppendVarint(uint64_t value, std::string& out)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<char>(value));
+    }
+
+    void AppendVarint(uint64_t value) {
+        AppendVarint(value, record_);
+    }
+
+    void OpenCsvFile()
+    {
+        size_t separator = outputPath_.find_last_of("\\/");
+        size_t extension = outputPath_.rfind('.');
+
+        if (extension == std::string::npos ||
+            (separator != std::string::npos && extension < separator))
+        {
+            extension = outputPath_.size();
+        }
+
+        std::string path = outputPath_.substr(0, extension) + "." +
+            recordType_ + ".csv";
+
+        schema_->File = std::fopen(path.c_str(), "w");
+        hasFailed_ = hasFailed_ || schema_->File == nullptr;
+
+        schema_->Buffer.reserve(BUFFER_SIZE);
+        schema_->Buffer += "type";
+
+        for (const char* name : schema_->FieldNames)
+        {
+            schema_->Buffer += ',';
+            schema_->Buffer += name;
+        }
+
+        schema_->Buffer += '\n';
+    }
+
+    void FlushCsvFile(RecordSchema& schema)
+    {
+        if (schema.File && !schema.Buffer.empty())
+        {
+            std::fwrite(schema.Buffer.data(), 1, schema.Buffer.size(),
+                schema.File);
+            std::fflush(schema.File);
+        }
+
+        schema.Buffer.clear();
+    }
+
+    void WriteBinarySchema()
+    {
+        size_t typeLength = std::strlen(recordType_);
+
+        buffer_.push_back(1);
+        AppendVarint(schema_->Id, buffer_);
+        AppendVarint(typeLength, buffer_);
+        buffer_.append(recordType_, typeLength);
+        AppendVarint(schema_->FieldNames.size(), buffer_);
+
+        for (size_t i = 0; i < schema_->FieldNames.size(); ++i)
+        {
+            size_t nameLength = std::strlen(schema_->FieldNames[i]);
+
+            AppendVarint(nameLength, buffer_);
+            buffer_.append(schema_->FieldNames[i], nameLength);
+            buffer_.push_back(static_cast<char>(schema_->FieldKinds[i]));
+        }
+    }
+
+    ReportFormat format_;
+    std::string outputPath_;
+    bool hasFailed_;
+
+    FILE* file_;
+    bool ownsFile_;
+
+    std::string buffer_;
+    std::string record_;
+    std::string utf8_;
+
+    const char* recordType_;
+    RecordSchema* schema_;
+
+    std::unordered_map<std::string, RecordSchema> schemas_;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <CppBuildInsights.hpp>
+
+// Analyzing a subset of the invocations of a build gives an approximate
+// answer faster, and in less memory, than analyzing all of them. Which
+// invocations are part of the sample is decided by a hash of their
+// event instance id, so that the same invocations are sampled by every
+// pass and every run, and so that the sample at a higher rate contains
+// the sample at a lower one: results converge to the exact ones as the
+// rate increases, and are exact at 100%.
+//
+// Events still need to be decoded, so the time saved is that spent in
+// the analyzers.
+
+struct SamplingOptions
+{
+    // The fraction of invocations to analyze, in (0, 1].
+    double Rate = 1.;
+};
+
+// Extracts the /sample:<percent> option from the command line, in the
+// same way as ParseReportOptions. Returns false if the percentage isn't
+// in (0, 100].
+inline bool ParseSamplingOptions(int& argc, char* argv[],
+    SamplingOptions& options)
+{
+    int kept = 0;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+
+        if (i > 0 && std::strncmp(arg, "/sample:", 8) == 0)
+        {
+            char* end = nullptr;
+            double percent = std::strtod(arg + 8, &end);
+
+            if (end == arg + 8 || *end != '\0' || !(percent > 0.) ||
+                percent > 100.)
+            {
+                return false;
+            }
+
+            options.Rate = percent / 100.;
+            continue;
+        }
+
+        argv[kept++] = argv[i];
+    }
+
+    argc = kept;
+
+    return true;
+}
+
+class InvocationSampler
+{
+public:
+    InvocationSampler(const SamplingOptions& options):
+        rate_{options.Rate},
+        threshold_{options.Rate >= 1. ? UINT64_MAX :
+            static_cast<uint64_t>(options.Rate * TWO_TO_THE_64)}
+    {}
+
+    double Rate() const {
+        return rate_;
+    }
+
+    bool IsSampling() const {
+        return rate_ < 1.;
+    }
+
+    // Whether an event belongs to a sampled invocation. The root of the
+    // event stack is the invocation, so an invocation started by another
+    // one, such as a linker started by CL, is sampled along with it.
+    bool Includes(const Microsoft::Cpp::BuildInsights::EventStack& eventStack)
+        const
+    {
+        return Includes(eventStack[0].EventInstanceId());
+    }
+
+    bool Includes(unsigned long long invocationInstanceId) const
+    {
+        if (threshold_ == UINT64_MAX) {
+            return true;
+        }
+
+        return Mix(invocationInstanceId) < threshold_;
+    }
+
+private:
+    static constexpr double TWO_TO_THE_64 = 18446744073709551616.;
+
+    // The finalizer of SplitMix64. Event instance ids are sequential, so
+    // they need to be mixed before being compared to the threshold.
+    static uint64_t Mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+
+        return x;
+    }
+
+    double rate_;
+    uint64_t threshold_;
+};
+
+// A total over all invocations, estimated from the sampled ones. Each
+// invocation is in the sample independently, with probability p, so
+// the sum of the sampled values divided by p is an unbiased estimate of
+// the total (the Horvitz-Thompson estimator), and its variance is
+// estimated by the sum of (1 - p) / p^2 times the square of the value of
+// each sampled invocation.
+//
+// The value of an invocation is only known once it stops, so values are
+// accumulated by InvocationSums while it runs. When every invocation is
+// analyzed there is no sampling error, and values can be added as they
+// happen instead.
+class SampledTotal
+{
+public:
+    SampledTotal():
+        sum_{0.},
+        sumOfSquares_{0.}
+    {}
+
+    // Restores a total from the sums returned by Sum() and
+    // SumOfSquares(), for example after it was written to disk.
+    SampledTotal(double sum, double sumOfSquares):
+        sum_{sum},
+        sumOfSquares_{sumOfSquares}
+    {}
+
+    // Adds the value of a sampled invocation.
+    void Add(std::chrono::nanoseconds value)
+    {
+        double nanoseconds = static_cast<double>(value.count());
+
+        sum_ += nanoseconds;
+        sumOfSquares_ += nanoseconds * nanoseconds;
+    }
+
+    // The sum of the sampled values.
+    std::chrono::nanoseconds Sampled() const {
+        return std::chrono::nanoseconds{ static_cast<long long>(sum_) };
+    }
+
+    double Sum() const {
+        return sum_;
+    }
+
+    double SumOfSquares() const {
+        return sumOfSquares_;
+    }
+
+    std::chrono::nanoseconds Estimate(double rate) const {
+        return std::chrono::nanoseconds{
+            static_cast<long long>(sum_ / rate) };
+    }
+
+    // The half-width of the 95% confidence interval of the estimate.
+    std::chrono::nanoseconds Margin(double rate) const
+    {
+        double variance = (1. - rate) / (rate * rate) * SumOfSquares();
+
+        return std::chrono::nanoseconds{
+            static_cast<long long>(Z_95 * std::sqrt(variance)) };
+    }
+
+private:
+    static constexpr double Z_95 = 1.96;
+
+    double sum_;
+    double sumOfSquares_;
+};
+
+// The values that running invocations added to each of a set of sampled
+// totals, identified by key. Events of concurrent invocations interleave
+// in a trace, so their values are summed here by invocation, and only
+// added to the totals once the invocation stops.
+//
+// Invocations must be identified by the root of their event stack, the
+// one that InvocationSampler samples, and stopped when it stops, so that
+// the invocations it started are not counted as independent samples.
+template <class Key, class Hash = std::hash<Key>>
+class InvocationSums
+{
+public:
+    InvocationSums():
+        running_{},
+        estimatedSize_{0}
+    {}
+
+    void Add(unsigned long long invocationInstanceId, const Key& key,
+        std::chrono::nanoseconds value)
+    {
+        auto result = running_[invocationInstanceId].try_emplace(key,
+            std::chrono::nanoseconds{0});
+
+        result.first->second += value;
+
+        if (result.second) {
+            estimatedSize_ += EntrySize(key);
+        }
+    }
+
+    // Calls fold(const Key&, std::chrono::nanoseconds) with the sum of
+    // each key that the invocation added values to.
+    template <class Fold>
+    void Stop(unsigned long long invocationInstanceId, Fold fold)
+    {
+        auto it = running_.find(invocationInstanceId);
+
+        if (it == running_.end()) {
+            return;
+        }
+
+        for (auto& entry : it->second)
+        {
+            fold(entry.first, entry.second);
+            estimatedSize_ -= EntrySize(entry.first);
+        }
+
+        running_.erase(it);
+    }
+
+    // Stops the invocations that are still running, such as those cut
+    // off by the end of the trace.
+    template <class Fold>
+    void StopAll(Fold fold)
+    {
+        for (auto& invocation : running_)
+        {
+            for (auto& entry : invocation.second) {
+                fold(entry.first, entry.second);
+            }
+        }
+
+        running_.clear();
+        estimatedSize_ = 0;
+    }
+
+    // A rough estimate of the memory used by the sums of the running
+    // invocations, for analyzers that keep within a memory budget.
+    size_t EstimatedSize() const {
+        return estimatedSize_;
+    }
+
+private:
+    // A node holds the entry, a link to the next node and the cached
+    // hash, and the table about one bucket pointer per node.
+    static size_t EntrySize(const Key& key)
+    {
+        return sizeof(std::pair<const Key, std::chrono::nanoseconds>) +
+            3 * sizeof(void*) + HeapSize(key);
+    }
+
+    template <class K>
+    static size_t HeapSize(const K&) {
+        return 0;
+    }
+
+    // Short strings are stored inline by the common implementations.
+    static size_t HeapSize(const std::string& key) {
+        return key.size() < 16 ? 0 : key.capacity() + 1;
+    }
+
+    std::unordered_map<unsigned long long,
+        std::unordered_map<Key, std::chrono::nanoseconds, Hash>> running_;
+
+    size_t estimatedSize_;
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+struct MemoryBudgetOptions
+{
+    // The memory that an analyzer can use for its tables before spilling
+    // them to disk, or 0 for no limit.
+    size_t BudgetBytes = 0;
+
+    std::string SpillDirectory = ".";
+};
+
+// Extracts the /memorybudget:<megabytes> and /spilldir:<directory>
+// options from the command line, in the same way as ParseReportOptions.
+// Returns false if an option has an invalid value.
+inline bool ParseMemoryBudgetOptions(int& argc, char* argv[],
+    MemoryBudgetOptions& options)
+{
+    int kept = 0;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+
+        if (i > 0 && std::strncmp(arg, "/memorybudget:", 14) == 0)
+        {
+            char* end = nullptr;
+            unsigned long long megabytes = std::strtoull(arg + 14, &end, 10);
+
+            if (end == arg + 14 || *end != '\0' || megabytes == 0) {
+                return false;
+            }
+
+            options.BudgetBytes = static_cast<size_t>(megabytes) * 1024 * 1024;
+            continue;
+        }
+
+        if (i > 0 && std::strncmp(arg, "/spilldir:", 10) == 0)
+        {
+            if (arg[10] == '\0') {
+                return false;
+            }
+
+            options.SpillDirectory = arg + 10;
+            continue;
+        }
+
+        argv[kept++] = argv[i];
+    }
+
+    argc = kept;
+
+    return true;
+}
+
+// Partial aggregates written to disk as runs sorted by key, so that an
+// analyzer can empty its tables whenever they exceed a memory budget,
+// and merged back when the analysis ends (external aggregation). The
+// merge only holds one entry per run in memory.
+//
+// Each entry has a key, a string that isn't part of the key (such as the
+// original spelling of a path that is compared case-insensitively) and
+// a trivially copyable value.
+//
+// Run files are closed once written, and only MAX_FAN_IN of them are
+// open at a time while merging: when there are more, groups of runs are
+// first merged into larger ones. This keeps the number of open files
+// below the limit of the C runtime however many runs are written.
+//
+// Run files are named after the given prefix and the process id, and
+// are deleted when the runs are destroyed.
+template <class Value>
+class SpilledRuns
+{
+    static_assert(std::is_trivially_copyable<Value>::value,
+        "Spilled values are written to disk as they are in memory.");
+
+public:
+    struct Entry
+    {
+        std::string Key;
+        std::string Text;
+        Value Data;
+    };
+
+    static const size_t MAX_FAN_IN = 64;
+
+    SpilledRuns(const std::string& directory, const char* name):
+        pathPrefix_{},
+        nextRunId_{0},
+        paths_{}
+    {
+#ifdef _WIN32
+        int processId = _getpid();
+#else
+        int processId = static_cast<int>(getpid());
+#endif
+
+        pathPrefix_ = directory + "/" + name + "." +
+            std::to_string(processId) + ".run";
+    }
+
+    SpilledRuns(const SpilledRuns&) = delete;
+    SpilledRuns& operator=(const SpilledRuns&) = delete;
+
+    ~SpilledRuns()
+    {
+        for (auto& path : paths_) {
+            std::remove(path.c_str());
+        }
+    }
+
+    size_t RunCount() const {
+        return paths_.size();
+    }
+
+    // Writes a run. Entries must be sorted by key, and keys must be
+    // distinct.
+    bool WriteRun(const std::vector<Entry>& entries)
+    {
+        std::string path = NewRunPath();
+
+        FILE* file = std::fopen(path.c_str(), "wb");
+
+        if (file == nullptr) {
+            return false;
+        }
+
+        bool isWritten = true;
+
+        for (auto& entry : entries)
+        {
+            if (!WriteEntry(file, entry))
+            {
+                isWritten = false;
+                break;
+            }
+        }
+
+        if (std::fclose(file) != 0 || !isWritten)
+        {
+            std::remove(path.c_str());
+            return false;
+        }
+
+        paths_.push_back(std::move(path));
+
+        return true;
+    }
+
+    // Merges the runs, in key order. The entries of all runs that have
+    // the same key are combined into one by combine(Entry& into, const
+    // Entry& from), and visit(const Entry&) is called for each combined
+    // entry. Returns false if a run can't be read back, or if an
+    // intermediate run can't be written.
+    template <class Combine, class Visit>
+    bool Merge(Combine combine, Visit visit)
+    {
+        while (paths_.size() > MAX_FAN_IN)
+        {
+            std::string path = NewRunPath();
+
+            FILE* file = std::fopen(path.c_str(), "wb");
+
+            if (file == nullptr) {
+                return false;
+            }
+
+            bool isWritten = true;
+
+            bool isMerged = MergeRuns(MAX_FAN_IN, combine,
+                [file, &isWritten](const Entry& entry) {
+                    isWritten = isWritten && WriteEntry(file, entry);
+                });
+
+            if (std::fclose(file) != 0 || !isMerged || !isWritten)
+            {
+                std::remove(path.c_str());
+                return false;
+            }
+
+            for (size_t i = 0; i < MAX_FAN_IN; ++i) {
+                std::remove(paths_[i].c_str());
+            }
+
+            paths_.erase(paths_.begin(), paths_.begin() + MAX_FAN_IN);
+            paths_.push_back(std::move(path));
+        }
+
+        return MergeRuns(paths_.size(), combine, visit);
+    }
+
+private:
+    std::string NewRunPath() {
+        return pathPrefix_ + std::to_string(nextRunId_++);
+    }
+
+    // Merges the first runCount runs.
+    template <class Combine, class Visit>
+    bool MergeRuns(size_t runCount, Combine& combine, Visit visit)
+    {
+        std::vector<FILE*> files;
+
+        for (size_t i = 0; i < runCount; ++i)
+        {
+            FILE* file = std::fopen(paths_[i].c_str(), "rb");
+
+            if (file == nullptr)
+            {
+                CloseFiles(files);
+                return false;
+            }
+
+            files.push_back(file);
+        }
+
+        std::vector<Entry> heads(files.size());
+
+        auto isAfter = [&heads](size_t lhs, size_t rhs) {
+            return heads[lhs].Key > heads[rhs].Key;
+        };
+
+        std::priority_queue<size_t, std::vector<size_t>,
+            decltype(isAfter)> queue{ isAfter };
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (ReadEntry(files[i], heads[i])) {
+                queue.push(i);
+            }
+        }
+
+        Entry current;
+        bool hasCurrent = false;
+
+        while (!queue.empty())
+        {
+            size_t run = queue.top();
+            queue.pop();
+
+            if (hasCurrent && heads[run].Key == current.Key) {
+                combine(current, heads[run]);
+            }
+            else
+            {
+                if (hasCurrent) {
+                    visit(static_cast<const Entry&>(current));
+                }
+
+                current = std::move(heads[run]);
+                hasCurrent = true;
+            }
+
+            if (ReadEntry(files[run], heads[run])) {
+                queue.push(run);
+            }
+            else if (!std::feof(files[run]))
+            {
+                CloseFiles(files);
+                return false;
+            }
+        }
+
+        if (hasCurrent) {
+            visit(static_cast<const Entry&>(current));
+        }
+
+        CloseFiles(files);
+
+        return true;
+    }
+
+    static void CloseFiles(const std::vector<FILE*>& files)
+    {
+        for (FILE* file : files) {
+            std::fclose(file);
+        }
+    }
+
+    static bool WriteEntry(FILE* file, const Entry& entry)
+    {
+        return WriteString(file, entry.Key) &&
+            WriteString(file, entry.Text) &&
+            std::fwrite(&entry.Data, sizeof(Value), 1, file) == 1;
+    }
+
+    static bool WriteString(FILE* file, const std::string& str)
+    {
+        uint32_t length = static_cast<uint32_t>(str.size());
+
+        return std::fwrite(&length, sizeof(length), 1, file) == 1 &&
+            std::fwrite(str.data(), 1, str.size(), file) == str.size();
+    }
+
+    static bool ReadString(FILE* file, std::string& str)
+    {
+        uint32_t length = 0;
+
+        if (std::fread(&length, sizeof(length), 1, file) != 1) {
+            return false;
+        }
+
+        str.resize(length);
+
+        return std::fread(&str[0], 1, length, file) == length;
+    }
+
+    static bool ReadEntry(FILE* file, Entry& entry)
+    {
+        return ReadString(file, entry.Key) && ReadString(file, entry.Text) &&
+            std::fread(&entry.Data, sizeof(Value), 1, file) == 1;
+    }
+
+    std::string pathPrefix_;
+    size_t nextRunId_;
+
+    std::vector<std::string> paths_;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// A bounded, lock-free queue between exactly one producer thread and one
+// consumer thread. Elements are stored in a ring whose capacity is a
+// power of two, so that positions can grow without bound and be masked
+// into indices.
+//
+// The producer only writes the tail and the consumer only writes the
+// head, each on its own cache line. Each side also keeps a copy of the
+// other side's position, and only reloads it when the ring looks full
+// (or empty) from that copy, so that in the steady state the two threads
+// rarely touch each other's cache lines.
+//
+// Requires C++17, for the over-aligned allocation of the ring.
+template <class T>
+class SpscRing
+{
+public:
+    SpscRing(size_t capacity):
+        slots_(RoundUpToPowerOfTwo(capacity)),
+        mask_{slots_.size() - 1},
+        head_{0},
+        cachedTail_{0},
+        tail_{0},
+        cachedHead_{0},
+        isClosed_{false}
+    {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t Capacity() const {
+        return slots_.size();
+    }
+
+    // Called by the producer. Returns false if the ring is full.
+    bool TryPush(const T& value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - cachedHead_ == slots_.size())
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+
+            if (tail - cachedHead_ == slots_.size()) {
+                return false;
+            }
+        }
+
+        slots_[tail & mask_] = value;
+
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Called by the producer. Waits for the consumer while the ring is
+    // full.
+    void Push(const T& value)
+    {
+        while (!TryPush(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Called by the producer once it has pushed its last element.
+    void Close() {
+        isClosed_.store(true, std::memory_order_release);
+    }
+
+    // Called by the consumer. Returns false if the ring is empty.
+    bool TryPop(T& value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == cachedTail_)
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+
+            if (head == cachedTail_) {
+                return false;
+            }
+        }
+
+        value = slots_[head & mask_];
+
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Called by the consumer. Waits for the producer while the ring is
+    // empty, and returns false once it is empty and closed.
+    bool Pop(T& value)
+    {
+        while (!TryPop(value))
+        {
+            if (isClosed_.load(std::memory_order_acquire))
+            {
+                // Elements pushed before closing are visible once the
+                // close is.
+                return TryPop(value);
+            }
+
+            std::this_thread::yield();
+        }
+
+        return true;
+    }
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    static size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+
+        while (result < value) {
+            result *= 2;
+        }
+
+        return result;
+    }
+
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // Written by the consumer.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_;
+    size_t cachedTail_;
+
+    // Written by the producer.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_;
+    size_t cachedHead_;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> isClosed_;
+};
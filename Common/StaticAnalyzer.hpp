@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <CppBuildInsights.hpp>
+
+// Requires C++17.
+//
+// An analyzer base that dispatches events to a fixed list of member
+// functions, declared once by the analyzer:
+//
+//     class MyAnalyzer : public StaticAnalyzer<MyAnalyzer>
+//     {
+//     public:
+//         using StopActivityHandlers = Handlers<
+//             &MyAnalyzer::OnStopFunction,
+//             &MyAnalyzer::OnStopInvocation>;
+//
+//         void OnStopFunction(Invocation invocation, Function func);
+//         void OnStopInvocation(Invocation invocation);
+//     };
+//
+// Calling MatchEventStackInMemberFunction for every handler on every
+// event walks the event stack once per handler, even though most
+// handlers can't match: a handler only matches events of the type of
+// its last parameter. The samples avoid this by hand, with a switch on
+// the event id. StaticAnalyzer does the same automatically: it builds,
+// at compile time, a table that maps each event id to the handlers whose
+// last parameter can match it, and only tries those handlers. Handlers
+// are called directly, without going through virtual functions.
+//
+// StartActivityHandlers, StopActivityHandlers and SimpleEventHandlers
+// can be declared independently. Other IAnalyzer functions can still be
+// overridden by the analyzer as usual.
+
+template <auto... Functions>
+struct Handlers
+{};
+
+// Whether an event with the given id can match a handler parameter of
+// type T. Types that aren't listed, like Activity, can match any event,
+// so their handlers are always tried.
+template <class T>
+struct EventIdTraits
+{
+    static constexpr bool Matches(unsigned) {
+        return true;
+    }
+};
+
+#define BUILD_INSIGHTS_EVENT_ID_TRAITS(Namespace, Type, ...)               \
+    template <>                                                          \
+    struct EventIdTraits<                                                \
+        Microsoft::Cpp::BuildInsights::Namespace::Type>                  \
+    {                                                                    \
+        static constexpr bool Matches(unsigned eventId)                  \
+        {                                                                \
+            using namespace Microsoft::Cpp::BuildInsights;               \
+            for (unsigned id : { __VA_ARGS__ }) {                        \
+                if (eventId == id) return true;                          \
+            }                                                            \
+            return false;                                                \
+        }                                                                \
+    };
+
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Invocation,
+    EVENT_ID_COMPILER, EVENT_ID_LINKER)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, InvocationGroup,
+    EVENT_ID_COMPILER, EVENT_ID_LINKER)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Compiler, EVENT_ID_COMPILER)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Linker, EVENT_ID_LINKER)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, FrontEndPass,
+    EVENT_ID_FRONT_END_PASS)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, BackEndPass, EVENT_ID_BACK_END_PASS)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, CodeGeneration,
+    EVENT_ID_CODE_GENERATION)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Thread, EVENT_ID_THREAD)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, C2DLL, EVENT_ID_C2_DLL)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, LTCG, EVENT_ID_LTCG)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Pass1, EVENT_ID_PASS1)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Pass2, EVENT_ID_PASS2)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, Function, EVENT_ID_FUNCTION)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, FrontEndFile,
+    EVENT_ID_FRONT_END_FILE)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, FrontEndFileGroup,
+    EVENT_ID_FRONT_END_FILE)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, TemplateInstantiation,
+    EVENT_ID_TEMPLATE_INSTANTIATION)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(Activities, TemplateInstantiationGroup,
+    EVENT_ID_TEMPLATE_INSTANTIATION)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, CommandLine, EVENT_ID_COMMAND_LINE)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, SymbolName, EVENT_ID_SYMBOL_NAME)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, ForceInlinee,
+    EVENT_ID_FORCE_INLINEE)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, FileInput, EVENT_ID_FILE_INPUT)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, FileOutput, EVENT_ID_FILE_OUTPUT)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, Module, EVENT_ID_MODULE)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, HeaderUnit, EVENT_ID_HEADER_UNIT)
+BUILD_INSIGHTS_EVENT_ID_TRAITS(SimpleEvents, PrecompiledHeader,
+    EVENT_ID_PRECOMPILED_HEADER)
+
+#undef BUILD_INSIGHTS_EVENT_ID_TRAITS
+
+// The class of a handler, and the type of its last parameter.
+template <class F>
+struct HandlerTraits;
+
+template <class C, class R, class... Args>
+struct HandlerTraits<R (C::*)(Args...)>
+{
+    typedef C Class;
+
+    static_assert(sizeof...(Args) > 0,
+        "A handler needs at least one parameter.");
+
+    typedef std::decay_t<std::tuple_element_t<sizeof...(Args) - 1,
+        std::tuple<Args...>>> LastParameter;
+};
+
+template <class Derived>
+class StaticAnalyzer : public Microsoft::Cpp::BuildInsights::IAnalyzer
+{
+    typedef Microsoft::Cpp::BuildInsights::AnalysisControl AnalysisControl;
+    typedef Microsoft::Cpp::BuildInsights::EventStack EventStack;
+
+public:
+    // Analyzers declare their own lists to replace these.
+    using StartActivityHandlers = Handlers<>;
+    using StopActivityHandlers = Handlers<>;
+    using SimpleEventHandlers = Handlers<>;
+
+    AnalysisControl OnStartActivity(const EventStack& eventStack) override
+    {
+        Dispatch(typename Derived::StartActivityHandlers{}, eventStack);
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        Dispatch(typename Derived::StopActivityHandlers{}, eventStack);
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        Dispatch(typename Derived::SimpleEventHandlers{}, eventStack);
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    // Event ids are small integers. Events with a larger id are only
+    // dispatched to handlers that can match any event.
+    static constexpr unsigned EVENT_ID_TABLE_SIZE = 256;
+
+    // For each event id, a bit mask of the handlers that can match it.
+    struct DispatchTable
+    {
+        uint64_t Masks[EVENT_ID_TABLE_SIZE];
+        uint64_t AnyEventMask;
+    };
+
+    template <auto... Functions>
+    static constexpr DispatchTable MakeDispatchTable()
+    {
+        static_assert(sizeof...(Functions) <= 64,
+            "At most 64 handlers are supported per kind of event.");
+
+        DispatchTable table{};
+
+        table.AnyEventMask = ~uint64_t{0};
+
+        for (unsigned id = 0; id < EVENT_ID_TABLE_SIZE; ++id)
+        {
+            bool matches[] = { EventIdTraits<typename HandlerTraits<
+                decltype(Functions)>::LastParameter>::Matches(id)... };
+
+            for (unsigned handler = 0; handler < sizeof...(Functions);
+                ++handler)
+            {
+                if (matches[handler]) {
+                    table.Masks[id] |= uint64_t{1} << handler;
+                }
+                else {
+                    table.AnyEventMask &= ~(uint64_t{1} << handler);
+                }
+            }
+        }
+
+        return table;
+    }
+
+    template <auto... Functions>
+    void Dispatch(Handlers<Functions...>, const EventStack& eventStack)
+    {
+        if constexpr (sizeof...(Functions) > 0)
+        {
+            static constexpr DispatchTable TABLE =
+                MakeDispatchTable<Functions...>();
+
+            unsigned eventId = eventStack.Back().EventId();
+
+            uint64_t mask = eventId < EVENT_ID_TABLE_SIZE ?
+                TABLE.Masks[eventId] : TABLE.AnyEventMask;
+
+            if (mask == 0) {
+                return;
+            }
+
+            TryHandlers<0, Functions...>(mask, eventStack);
+        }
+    }
+
+    template <unsigned Index, auto Function, auto... Rest>
+    void TryHandlers(uint64_t mask, const EventStack& eventStack)
+    {
+        if (mask & (uint64_t{1} << Index))
+        {
+            // Handlers can be inherited by the analyzer from a base class.
+            typedef typename HandlerTraits<decltype(Function)>::Class Class;
+
+            Microsoft::Cpp::BuildInsights::MatchEventStackInMemberFunction(
+                eventStack, static_cast<Class*>(static_cast<Derived*>(this)),
+                Function);
+        }
+
+        if constexpr (sizeof...(Rest) > 0) {
+            TryHandlers<Index + 1, Rest...>(mask, eventStack);
+        }
+    }
+};
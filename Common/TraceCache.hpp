@@ -0,0 +1,740 @@
+#pragma once
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "ReportWriter.hpp"
+
+// A trace cache holds the activities of a trace in a columnar layout
+// that can be memory-mapped and read directly by later analyses, without
+// decoding the trace again. One row is written per activity, in the
+// order in which activities stop.
+//
+// Only what is needed for queries over activities is cached: their
+// timing, nesting, and one name per activity. Simple events, such as
+// SymbolName or CommandLine, and the other properties of activities are
+// not. Analyzers written against the SDK can't run from a cache, because
+// the EventStack and event types they receive are only created by the
+// SDK while it decodes a trace. Analyses that run from a cache read its
+// columns through TraceCacheReader instead.
+//
+// File layout, all integers little-endian:
+//
+// - TraceCacheHeader
+// - Event kinds: EventKindCount pairs of 32-bit event id and name id
+// - One array per column, each starting on an 8-byte boundary. The
+//   byte offset of each array is stored in the header.
+// - String offsets: StringCount + 1 64-bit offsets into the string data
+// - String data: NUL-terminated UTF-8 strings. String id 0 is the empty
+//   string and is used for activities that have no name.
+//
+// The header records the size and last write time of the trace, so that
+// a cache is only used for the trace it was built from.
+
+enum TraceCacheColumn
+{
+    TRACE_CACHE_COLUMN_EVENT_ID,            // uint16_t
+    TRACE_CACHE_COLUMN_THREAD_ID,           // uint32_t
+    TRACE_CACHE_COLUMN_NAME_ID,             // uint32_t
+    TRACE_CACHE_COLUMN_INSTANCE_ID,         // uint64_t
+    TRACE_CACHE_COLUMN_PARENT_INSTANCE_ID,  // uint64_t, 0 for roots
+    TRACE_CACHE_COLUMN_START_TIMESTAMP,     // int64_t, in ticks
+    TRACE_CACHE_COLUMN_STOP_TIMESTAMP,      // int64_t, in ticks
+    TRACE_CACHE_COLUMN_STRING_OFFSETS,
+    TRACE_CACHE_COLUMN_STRING_DATA,
+
+    TRACE_CACHE_COLUMN_COUNT
+};
+
+struct TraceCacheHeader
+{
+    char Signature[8];
+    uint32_t Version;
+    uint32_t EventKindCount;
+    uint64_t TraceSize;
+    uint64_t TraceLastWriteTime;
+    int64_t TickFrequency;
+    uint64_t EventCount;
+    uint64_t StringCount;
+    uint64_t ColumnOffsets[TRACE_CACHE_COLUMN_COUNT];
+    uint64_t FileSize;
+};
+
+static const char TRACE_CACHE_SIGNATURE[8] = { 'B', 'I', 'C', 'A', 'C', 'H', 'E', '1' };
+static const uint32_t TRACE_CACHE_VERSION = 1;
+
+// Gets the size and last write time of a trace file, used to tell
+// whether a cache is up to date.
+inline bool GetTraceFileStamp(const char* tracePath, uint64_t& size,
+    uint64_t& lastWriteTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(tracePath, GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+        data.nFileSizeLow;
+
+    lastWriteTime = (static_cast<uint64_t>(
+        data.ftLastWriteTime.dwHighDateTime) << 32) |
+        data.ftLastWriteTime.dwLowDateTime;
+
+    return true;
+}
+
+// An analyzer that writes a trace cache. Columns are streamed to
+// temporary files during the analysis and assembled into the cache file
+// when the analysis ends, so memory usage only depends on the number of
+// distinct strings in the trace.
+class TraceCacheWriter : public Microsoft::Cpp::BuildInsights::IAnalyzer
+{
+    typedef Microsoft::Cpp::BuildInsights::AnalysisControl AnalysisControl;
+    typedef Microsoft::Cpp::BuildInsights::EventStack EventStack;
+
+    // The columns that have one value per row.
+    static const int ROW_COLUMN_COUNT = TRACE_CACHE_COLUMN_STRING_OFFSETS;
+
+public:
+    TraceCacheWriter(const std::string& cachePath, const char* tracePath):
+        cachePath_{cachePath},
+        tracePath_{tracePath},
+        columnFiles_{},
+        stringOffsets_{},
+        stringDataSize_{0},
+        stringIds_{},
+        utf8_{},
+        eventKinds_{},
+        pendingNameId_{0},
+        header_{},
+        isValid_{true},
+        isComplete_{false}
+    {
+        for (int i = 0; i < TRACE_CACHE_COLUMN_COUNT; ++i) {
+            columnFiles_[i] = nullptr;
+        }
+
+        for (int i = 0; i < ROW_COLUMN_COUNT; ++i) {
+            OpenColumnFile(i);
+        }
+
+        OpenColumnFile(TRACE_CACHE_COLUMN_STRING_DATA);
+
+        // String id 0 is the empty string.
+        InternString("", 0);
+    }
+
+    TraceCacheWriter(const TraceCacheWriter&) = delete;
+    TraceCacheWriter& operator=(const TraceCacheWriter&) = delete;
+
+    ~TraceCacheWriter() {
+        CloseColumnFiles();
+    }
+
+    // True once the cache has been written successfully.
+    bool IsComplete() const {
+        return isComplete_;
+    }
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        using namespace Microsoft::Cpp::BuildInsights;
+
+        if (!isValid_) {
+            return AnalysisControl::CONTINUE;
+        }
+
+        auto& e = eventStack.Back();
+
+        pendingNameId_ = 0;
+
+        switch (e.EventId())
+        {
+        case EVENT_ID_FUNCTION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceCacheWriter::OnFunction);
+            break;
+
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceCacheWriter::OnFrontEndFile);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceCacheWriter::OnFrontEndPass);
+            break;
+
+        case EVENT_ID_BACK_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceCacheWriter::OnBackEndPass);
+            break;
+
+        case EVENT_ID_COMPILER:
+        case EVENT_ID_LINKER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceCacheWriter::OnInvocation);
+            break;
+
+        default:
+            break;
+        }
+
+        if (eventKinds_.find(e.EventId()) == eventKinds_.end())
+        {
+            const char* eventName = e.EventName();
+
+            eventKinds_[e.EventId()] = InternString(eventName,
+                std::strlen(eventName));
+        }
+
+        if (header_.EventCount == 0) {
+            header_.TickFrequency = e.TickFrequency();
+        }
+
+        uint16_t eventId = static_cast<uint16_t>(e.EventId());
+        uint32_t threadId = static_cast<uint32_t>(e.ThreadId());
+        uint64_t instanceId = e.EventInstanceId();
+        uint64_t parentInstanceId = eventStack.Size() > 1 ?
+            eventStack[eventStack.Size() - 2].EventInstanceId() : 0;
+        int64_t startTimestamp = e.StartTimestamp();
+        int64_t stopTimestamp = e.StopTimestamp();
+
+        WriteColumn(TRACE_CACHE_COLUMN_EVENT_ID, &eventId, sizeof(eventId));
+        WriteColumn(TRACE_CACHE_COLUMN_THREAD_ID, &threadId, sizeof(threadId));
+        WriteColumn(TRACE_CACHE_COLUMN_NAME_ID, &pendingNameId_,
+            sizeof(pendingNameId_));
+        WriteColumn(TRACE_CACHE_COLUMN_INSTANCE_ID, &instanceId,
+            sizeof(instanceId));
+        WriteColumn(TRACE_CACHE_COLUMN_PARENT_INSTANCE_ID, &parentInstanceId,
+            sizeof(parentInstanceId));
+        WriteColumn(TRACE_CACHE_COLUMN_START_TIMESTAMP, &startTimestamp,
+            sizeof(startTimestamp));
+        WriteColumn(TRACE_CACHE_COLUMN_STOP_TIMESTAMP, &stopTimestamp,
+            sizeof(stopTimestamp));
+
+        ++header_.EventCount;
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnFunction(Microsoft::Cpp::BuildInsights::Activities::Function f)
+    {
+        const char* name = f.Name();
+        pendingNameId_ = InternString(name, std::strlen(name));
+    }
+
+    void OnFrontEndFile(
+        Microsoft::Cpp::BuildInsights::Activities::FrontEndFile file)
+    {
+        const char* path = file.Path();
+        pendingNameId_ = InternString(path, std::strlen(path));
+    }
+
+    void OnFrontEndPass(
+        Microsoft::Cpp::BuildInsights::Activities::FrontEndPass fe)
+    {
+        pendingNameId_ = InternWideString(fe.InputSourcePath());
+    }
+
+    void OnBackEndPass(
+        Microsoft::Cpp::BuildInsights::Activities::BackEndPass be)
+    {
+        pendingNameId_ = InternWideString(be.InputSourcePath());
+    }
+
+    void OnInvocation(
+        Microsoft::Cpp::BuildInsights::Activities::Invocation invocation)
+    {
+        pendingNameId_ = InternWideString(invocation.WorkingDirectory());
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        if (isValid_) {
+            isComplete_ = Assemble();
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    std::string ColumnFilePath(int column) const {
+        return cachePath_ + ".column" + std::to_string(column);
+    }
+
+    void OpenColumnFile(int column)
+    {
+        columnFiles_[column] = std::fopen(ColumnFilePath(column).c_str(),
+            "w+b");
+
+        if (columnFiles_[column] == nullptr) {
+            isValid_ = false;
+        }
+    }
+
+    void CloseColumnFiles()
+    {
+        for (int i = 0; i < TRACE_CACHE_COLUMN_COUNT; ++i)
+        {
+            if (columnFiles_[i] == nullptr) {
+                continue;
+            }
+
+            std::fclose(columnFiles_[i]);
+            columnFiles_[i] = nullptr;
+
+            DeleteFileA(ColumnFilePath(i).c_str());
+        }
+    }
+
+    void WriteColumn(int column, const void* data, size_t size)
+    {
+        if (std::fwrite(data, 1, size, columnFiles_[column]) != size) {
+            isValid_ = false;
+        }
+    }
+
+    uint32_t InternString(const char* str, size_t length)
+    {
+        auto result = stringIds_.try_emplace(std::string{ str, length },
+            static_cast<uint32_t>(stringOffsets_.size()));
+
+        if (!result.second) {
+            return result.first->second;
+        }
+
+        stringOffsets_.push_back(stringDataSize_);
+
+        WriteColumn(TRACE_CACHE_COLUMN_STRING_DATA, str, length);
+        WriteColumn(TRACE_CACHE_COLUMN_STRING_DATA, "", 1);
+
+        stringDataSize_ += length + 1;
+
+        return result.first->second;
+    }
+
+    uint32_t InternWideString(const wchar_t* str)
+    {
+        utf8_.clear();
+        AppendUtf8(utf8_, str);
+
+        return InternString(utf8_.data(), utf8_.size());
+    }
+
+    bool CopyColumn(int column, FILE* out, uint64_t& offset)
+    {
+        static const char padding[8] = {};
+
+        size_t paddingSize = static_cast<size_t>((8 - offset % 8) % 8);
+
+        if (std::fwrite(padding, 1, paddingSize, out) != paddingSize) {
+            return false;
+        }
+
+        offset += paddingSize;
+        header_.ColumnOffsets[column] = offset;
+
+        FILE* in = columnFiles_[column];
+
+        std::fflush(in);
+        std::rewind(in);
+
+        std::vector<char> buffer(1 << 20);
+
+        size_t size;
+
+        while ((size = std::fread(buffer.data(), 1, buffer.size(), in)) > 0)
+        {
+            if (std::fwrite(buffer.data(), 1, size, out) != size) {
+                return false;
+            }
+
+            offset += size;
+        }
+
+        return std::ferror(in) == 0;
+    }
+
+    bool Assemble()
+    {
+        std::memcpy(header_.Signature, TRACE_CACHE_SIGNATURE,
+            sizeof(header_.Signature));
+
+        header_.Version = TRACE_CACHE_VERSION;
+        header_.EventKindCount = static_cast<uint32_t>(eventKinds_.size());
+        header_.StringCount = stringOffsets_.size();
+
+        if (!GetTraceFileStamp(tracePath_, header_.TraceSize,
+            header_.TraceLastWriteTime))
+        {
+            return false;
+        }
+
+        // The offset past the last string closes the offsets array.
+        stringOffsets_.push_back(stringDataSize_);
+
+        std::string tempPath = cachePath_ + ".tmp";
+
+        FILE* out = std::fopen(tempPath.c_str(), "wb");
+
+        if (out == nullptr) {
+            return false;
+        }
+
+        // The header is written again once the column offsets are known.
+        bool success = std::fwrite(&header_, sizeof(header_), 1, out) == 1;
+
+        uint64_t offset = sizeof(header_);
+
+        for (auto& p : eventKinds_)
+        {
+            uint32_t kind[2] = { p.first, p.second };
+
+            success = success && std::fwrite(kind, sizeof(kind), 1, out) == 1;
+            offset += sizeof(kind);
+        }
+
+        for (int i = 0; success && i < ROW_COLUMN_COUNT; ++i) {
+            success = CopyColumn(i, out, offset);
+        }
+
+        if (success)
+        {
+            size_t paddingSize = static_cast<size_t>((8 - offset % 8) % 8);
+
+            static const char padding[8] = {};
+
+            success = std::fwrite(padding, 1, paddingSize, out) ==
+                paddingSize;
+
+            offset += paddingSize;
+
+            header_.ColumnOffsets[TRACE_CACHE_COLUMN_STRING_OFFSETS] = offset;
+
+            size_t count = stringOffsets_.size();
+
+            success = success && std::fwrite(stringOffsets_.data(),
+                sizeof(uint64_t), count, out) == count;
+
+            offset += count * sizeof(uint64_t);
+        }
+
+        success = success && CopyColumn(TRACE_CACHE_COLUMN_STRING_DATA,
+            out, offset);
+
+        header_.FileSize = offset;
+
+        success = success && std::fseek(out, 0, SEEK_SET) == 0 &&
+            std::fwrite(&header_, sizeof(header_), 1, out) == 1;
+
+        success = std::fclose(out) == 0 && success;
+
+        CloseColumnFiles();
+
+        if (!success || !MoveFileExA(tempPath.c_str(), cachePath_.c_str(),
+            MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileA(tempPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    std::string cachePath_;
+    const char* tracePath_;
+
+    FILE* columnFiles_[TRACE_CACHE_COLUMN_COUNT];
+
+    std::vector<uint64_t> stringOffsets_;
+    uint64_t stringDataSize_;
+    std::unordered_map<std::string, uint32_t> stringIds_;
+    std::string utf8_;
+
+    // Maps event ids to the id of their name in the string table.
+    std::unordered_map<uint32_t, uint32_t> eventKinds_;
+
+    uint32_t pendingNameId_;
+
+    TraceCacheHeader header_;
+
+    bool isValid_;
+    bool isComplete_;
+};
+
+// Maps a trace cache in memory and gives access to its columns.
+class TraceCacheReader
+{
+public:
+    TraceCacheReader():
+        file_{INVALID_HANDLE_VALUE},
+        mapping_{nullptr},
+        view_{nullptr},
+        header_{nullptr},
+        eventNames_{}
+    {}
+
+    TraceCacheReader(const TraceCacheReader&) = delete;
+    TraceCacheReader& operator=(const TraceCacheReader&) = delete;
+
+    ~TraceCacheReader() {
+        Close();
+    }
+
+    // Maps the cache at cachePath. Fails if the file is not a valid cache
+    // or if it was built from a different version of the trace.
+    bool Open(const std::string& cachePath, const char* tracePath)
+    {
+        Close();
+
+        uint64_t traceSize = 0;
+        uint64_t traceLastWriteTime = 0;
+
+        if (!GetTraceFileStamp(tracePath, traceSize, traceLastWriteTime)) {
+            return false;
+        }
+
+        file_ = CreateFileA(cachePath.c_str(), GENERIC_READ,
+            FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+
+        if (!GetFileSizeEx(file_, &fileSize) ||
+            static_cast<uint64_t>(fileSize.QuadPart) <
+                sizeof(TraceCacheHeader))
+        {
+            Close();
+            return false;
+        }
+
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0,
+            nullptr);
+
+        if (mapping_ == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+
+        if (view_ == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        header_ = static_cast<const TraceCacheHeader*>(view_);
+
+        if (std::memcmp(header_->Signature, TRACE_CACHE_SIGNATURE,
+                sizeof(TRACE_CACHE_SIGNATURE)) != 0 ||
+            header_->Version != TRACE_CACHE_VERSION ||
+            header_->FileSize != static_cast<uint64_t>(fileSize.QuadPart) ||
+            header_->TraceSize != traceSize ||
+            header_->TraceLastWriteTime != traceLastWriteTime ||
+            !HasValidLayout(header_->FileSize))
+        {
+            Close();
+            return false;
+        }
+
+        auto kinds = reinterpret_cast<const uint32_t*>(header_ + 1);
+
+        for (uint32_t i = 0; i < header_->EventKindCount; ++i) {
+            eventNames_[kinds[i * 2]] = String(kinds[i * 2 + 1]);
+        }
+
+        return true;
+    }
+
+    void Close()
+    {
+        if (view_) {
+            UnmapViewOfFile(view_);
+        }
+
+        if (mapping_) {
+            CloseHandle(mapping_);
+        }
+
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = nullptr;
+        view_ = nullptr;
+        header_ = nullptr;
+        eventNames_.clear();
+    }
+
+    size_t EventCount() const {
+        return static_cast<size_t>(header_->EventCount);
+    }
+
+    long long TickFrequency() const {
+        return header_->TickFrequency;
+    }
+
+    const uint16_t* EventIds() const {
+        return Column<uint16_t>(TRACE_CACHE_COLUMN_EVENT_ID);
+    }
+
+    const uint32_t* ThreadIds() const {
+        return Column<uint32_t>(TRACE_CACHE_COLUMN_THREAD_ID);
+    }
+
+    const uint32_t* NameIds() const {
+        return Column<uint32_t>(TRACE_CACHE_COLUMN_NAME_ID);
+    }
+
+    const uint64_t* InstanceIds() const {
+        return Column<uint64_t>(TRACE_CACHE_COLUMN_INSTANCE_ID);
+    }
+
+    const uint64_t* ParentInstanceIds() const {
+        return Column<uint64_t>(TRACE_CACHE_COLUMN_PARENT_INSTANCE_ID);
+    }
+
+    const int64_t* StartTimestamps() const {
+        return Column<int64_t>(TRACE_CACHE_COLUMN_START_TIMESTAMP);
+    }
+
+    const int64_t* StopTimestamps() const {
+        return Column<int64_t>(TRACE_CACHE_COLUMN_STOP_TIMESTAMP);
+    }
+
+    size_t StringCount() const {
+        return static_cast<size_t>(header_->StringCount);
+    }
+
+    // Ids past the end of the string table, which a corrupt cache could
+    // contain, give the empty string.
+    const char* String(uint32_t id) const
+    {
+        if (id >= header_->StringCount) {
+            return "";
+        }
+
+        auto offsets = Column<uint64_t>(TRACE_CACHE_COLUMN_STRING_OFFSETS);
+        auto data = Column<char>(TRACE_CACHE_COLUMN_STRING_DATA);
+
+        return data + offsets[id];
+    }
+
+    const char* EventName(uint16_t eventId) const
+    {
+        auto it = eventNames_.find(eventId);
+
+        return it == eventNames_.end() ? "" : it->second;
+    }
+
+private:
+    // Checks that the arrays described by the header lie within the file,
+    // and that the strings lie within the string data and are terminated,
+    // so that a truncated or corrupt cache isn't read out of bounds.
+    bool HasValidLayout(uint64_t fileSize) const
+    {
+        static const uint64_t ROW_SIZES[] = {
+            sizeof(uint16_t), sizeof(uint32_t), sizeof(uint32_t),
+            sizeof(uint64_t), sizeof(uint64_t), sizeof(int64_t),
+            sizeof(int64_t)
+        };
+
+        const uint64_t* offsets = header_->ColumnOffsets;
+
+        if (!FitsInFile(sizeof(TraceCacheHeader), header_->EventKindCount,
+            2 * sizeof(uint32_t), fileSize))
+        {
+            return false;
+        }
+
+        for (int i = 0; i < TRACE_CACHE_COLUMN_STRING_OFFSETS; ++i)
+        {
+            if (offsets[i] % 8 != 0 || !FitsInFile(offsets[i],
+                header_->EventCount, ROW_SIZES[i], fileSize))
+            {
+                return false;
+            }
+        }
+
+        uint64_t stringOffsetsOffset =
+            offsets[TRACE_CACHE_COLUMN_STRING_OFFSETS];
+        uint64_t dataOffset = offsets[TRACE_CACHE_COLUMN_STRING_DATA];
+
+        if (header_->StringCount == 0 || stringOffsetsOffset % 8 != 0 ||
+            !FitsInFile(stringOffsetsOffset, header_->StringCount + 1,
+                sizeof(uint64_t), fileSize) ||
+            dataOffset > fileSize)
+        {
+            return false;
+        }
+
+        auto stringOffsets = Column<uint64_t>(
+            TRACE_CACHE_COLUMN_STRING_OFFSETS);
+        auto data = Column<char>(TRACE_CACHE_COLUMN_STRING_DATA);
+
+        uint64_t dataSize = fileSize - dataOffset;
+
+        if (stringOffsets[0] != 0 ||
+            stringOffsets[header_->StringCount] != dataSize)
+        {
+            return false;
+        }
+
+        for (uint64_t i = 0; i < header_->StringCount; ++i)
+        {
+            if (stringOffsets[i] >= stringOffsets[i + 1] ||
+                data[stringOffsets[i + 1] - 1] != '\0')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Whether an array of count elements of the given size, at the given
+    // offset, lies within the file, without overflowing.
+    static bool FitsInFile(uint64_t offset, uint64_t count,
+        uint64_t elementSize, uint64_t fileSize)
+    {
+        return offset <= fileSize &&
+            count <= (fileSize - offset) / elementSize;
+    }
+
+    template <typename T>
+    const T* Column(TraceCacheColumn column) const
+    {
+        return reinterpret_cast<const T*>(
+            static_cast<const char*>(view_) + header_->ColumnOffsets[column]);
+    }
+
+    HANDLE file_;
+    HANDLE mapping_;
+    const void* view_;
+    const TraceCacheHeader* header_;
+
+    std::unordered_map<uint32_t, const char*> eventNames_;
+};
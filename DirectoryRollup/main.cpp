@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cwctype>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+// The times that are rolled up by directory. Front-end and back-end
+// time are attributed to the directory of the source file being
+// compiled. Code generation time is the part of the back-end time spent
+// generating code. Link time is attributed to the working directory of
+// the linker, which is usually the directory of the project.
+enum RollupMetric
+{
+    METRIC_FRONT_END,
+    METRIC_BACK_END,
+    METRIC_CODE_GENERATION,
+    METRIC_LINK,
+
+    METRIC_COUNT
+};
+
+class DirectoryRollup : public IAnalyzer
+{
+    // A directory of the path trie. Times and counts include those of
+    // all subdirectories.
+    struct Node
+    {
+        std::wstring Name;
+        size_t Parent;
+        std::vector<size_t> Children;
+        std::chrono::nanoseconds Times[METRIC_COUNT];
+        unsigned long long TranslationUnitCount;
+
+        std::chrono::nanoseconds CompileTime() const {
+            return Times[METRIC_FRONT_END] + Times[METRIC_BACK_END];
+        }
+
+        std::chrono::nanoseconds Total() const {
+            return CompileTime() + Times[METRIC_LINK];
+        }
+    };
+
+public:
+    DirectoryRollup(int countPerLevel, int maxDepth, ReportWriter& report):
+        countPerLevel_{countPerLevel > 0 ?
+            static_cast<size_t>(countPerLevel) : 5},
+        maxDepth_{maxDepth > 0 ? static_cast<size_t>(maxDepth) : 4},
+        report_{report},
+        nodes_(1),
+        directoryNodes_{}
+    {
+        nodes_[ROOT].Parent = NO_PARENT;
+    }
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &DirectoryRollup::OnStopFrontEndPass);
+            break;
+
+        case EVENT_ID_BACK_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &DirectoryRollup::OnStopBackEndPass);
+            break;
+
+        case EVENT_ID_CODE_GENERATION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &DirectoryRollup::OnStopCodeGeneration);
+            break;
+
+        case EVENT_ID_LINKER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &DirectoryRollup::OnStopLinker);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe)
+    {
+        size_t node = FindSourceDirectory(cl, PassPath(fe));
+
+        AddTime(node, METRIC_FRONT_END, fe.Duration());
+
+        for (size_t i = node; i != NO_PARENT; i = nodes_[i].Parent) {
+            ++nodes_[i].TranslationUnitCount;
+        }
+    }
+
+    void OnStopBackEndPass(Compiler cl, BackEndPass be)
+    {
+        AddTime(FindSourceDirectory(cl, PassPath(be)),
+            METRIC_BACK_END, be.Duration());
+    }
+
+    void OnStopCodeGeneration(Compiler cl, BackEndPass be,
+        CodeGeneration cg)
+    {
+        AddTime(FindSourceDirectory(cl, PassPath(be)),
+            METRIC_CODE_GENERATION, cg.Duration());
+    }
+
+    void OnStopLinker(Linker link)
+    {
+        AddTime(FindDirectory(link.WorkingDirectory()), METRIC_LINK,
+            link.Duration());
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        if (report_.IsText())
+        {
+            std::cout << "Build time by directory, showing the top " <<
+                countPerLevel_ << " subdirectories of each directory, " <<
+                maxDepth_ << " levels deep:\n\n";
+        }
+
+        PrintNode(ROOT, std::wstring{}, 0);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    static const size_t ROOT = 0;
+    static const size_t NO_PARENT = static_cast<size_t>(-1);
+
+    // Passes without an input source path are attributed to the
+    // directory of their output object.
+    template <class Pass>
+    static const wchar_t* PassPath(const Pass& pass)
+    {
+        return pass.InputSourcePath() ? pass.InputSourcePath() :
+            pass.OutputObjectPath();
+    }
+
+    static bool IsAbsolute(const wchar_t* path)
+    {
+        return path[0] == L'\\' || path[0] == L'/' ||
+            (path[0] != L'\0' && path[1] == L':');
+    }
+
+    size_t FindSourceDirectory(const Invocation& invocation,
+        const wchar_t* sourcePath)
+    {
+        if (sourcePath == nullptr) {
+            return FindDirectory(invocation.WorkingDirectory());
+        }
+
+        std::wstring path;
+
+        if (!IsAbsolute(sourcePath))
+        {
+            path = invocation.WorkingDirectory();
+            path += L'\\';
+        }
+
+        path += sourcePath;
+
+        size_t fileNameStart = path.find_last_of(L"\\/");
+
+        path.resize(fileNameStart == std::wstring::npos ? 0 : fileNameStart);
+
+        return FindDirectory(std::move(path));
+    }
+
+    // Returns the trie node of a directory, creating it and its parents
+    // if needed. Paths are compared case-insensitively, and the node of
+    // each distinct path is cached so that the trie is only walked once
+    // per directory.
+    size_t FindDirectory(std::wstring path)
+    {
+        std::transform(path.begin(), path.end(), path.begin(),
+            [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+
+        auto it = directoryNodes_.find(path);
+
+        if (it != directoryNodes_.end()) {
+            return it->second;
+        }
+
+        std::vector<std::wstring> components;
+        size_t start = 0;
+
+        while (start < path.size())
+        {
+            size_t end = path.find_first_of(L"\\/", start);
+
+            if (end == std::wstring::npos) {
+                end = path.size();
+            }
+
+            std::wstring component = path.substr(start, end - start);
+
+            start = end + 1;
+
+            if (component.empty() || component == L".") {
+                continue;
+            }
+
+            if (component == L"..")
+            {
+                if (!components.empty()) {
+                    components.pop_back();
+                }
+
+                continue;
+            }
+
+            components.push_back(std::move(component));
+        }
+
+        size_t node = ROOT;
+
+        for (auto& component : components) {
+            node = FindChild(node, std::move(component));
+        }
+
+        directoryNodes_.emplace(std::move(path), node);
+
+        return node;
+    }
+
+    size_t FindChild(size_t parent, std::wstring&& name)
+    {
+        for (size_t child : nodes_[parent].Children)
+        {
+            if (nodes_[child].Name == name) {
+                return child;
+            }
+        }
+
+        size_t child = nodes_.size();
+
+        nodes_.push_back(Node{});
+        nodes_[child].Name = std::move(name);
+        nodes_[child].Parent = parent;
+
+        nodes_[parent].Children.push_back(child);
+
+        return child;
+    }
+
+    void AddTime(size_t node, RollupMetric metric,
+        std::chrono::nanoseconds duration)
+    {
+        for (size_t i = node; i != NO_PARENT; i = nodes_[i].Parent) {
+            nodes_[i].Times[metric] += duration;
+        }
+    }
+
+    void PrintNode(size_t index, std::wstring path, size_t depth)
+    {
+        // Directories whose time is all in a single subdirectory are
+        // merged with it, so that the common prefix of all paths (for
+        // example, the root of the repository) isn't printed level by
+        // level.
+        while (nodes_[index].Children.size() == 1 &&
+            nodes_[nodes_[index].Children[0]].Total() ==
+                nodes_[index].Total())
+        {
+            index = nodes_[index].Children[0];
+
+            if (!path.empty()) {
+                path += L'\\';
+            }
+
+            path += nodes_[index].Name;
+        }
+
+        const Node& node = nodes_[index];
+
+        if (node.Total().count() == 0) {
+            return;
+        }
+
+        PrintDirectory(node, path, depth);
+
+        if (depth + 1 >= maxDepth_) {
+            return;
+        }
+
+        std::vector<size_t> children = node.Children;
+
+        size_t countToDump = std::min(children.size(), countPerLevel_);
+
+        std::partial_sort(children.begin(), children.begin() + countToDump,
+            children.end(), [this](size_t lhs, size_t rhs) {
+                return nodes_[lhs].Total() > nodes_[rhs].Total();
+            });
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            std::wstring childPath = path;
+
+            if (!childPath.empty()) {
+                childPath += L'\\';
+            }
+
+            childPath += nodes_[children[i]].Name;
+
+            PrintNode(children[i], std::move(childPath), depth + 1);
+        }
+    }
+
+    void PrintDirectory(const Node& node, const std::wstring& path,
+        size_t depth)
+    {
+        using namespace std::chrono;
+
+        nanoseconds buildTotal = nodes_[ROOT].Total();
+
+        double percent = buildTotal.count() == 0 ? 0. :
+            static_cast<double>(node.Total().count()) /
+                buildTotal.count() * 100.;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Directory")
+                .Field("Depth", depth)
+                .Field("Path", path)
+                .Field("TotalMs", duration_cast<milliseconds>(
+                    node.Total()).count())
+                .Field("Percent", percent)
+                .Field("CompileMs", duration_cast<milliseconds>(
+                    node.CompileTime()).count())
+                .Field("FrontEndMs", duration_cast<milliseconds>(
+                    node.Times[METRIC_FRONT_END]).count())
+                .Field("BackEndMs", duration_cast<milliseconds>(
+                    node.Times[METRIC_BACK_END]).count())
+                .Field("CodeGenerationMs", duration_cast<milliseconds>(
+                    node.Times[METRIC_CODE_GENERATION]).count())
+                .Field("LinkMs", duration_cast<milliseconds>(
+                    node.Times[METRIC_LINK]).count())
+                .Field("TranslationUnitCount", node.TranslationUnitCount)
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << std::string(2 * depth, ' ') <<
+            ToUtf8(path.empty() ? L"(all)" : path.c_str()) << "\n";
+
+        std::cout << std::string(2 * depth + 4, ' ') <<
+            duration_cast<milliseconds>(node.Total()).count() << " ms (" <<
+            std::fixed << std::setprecision(1) << percent << "%)" <<
+            "\t compile: " <<
+            duration_cast<milliseconds>(node.CompileTime()).count() <<
+            " ms (front-end: " << duration_cast<milliseconds>(
+                node.Times[METRIC_FRONT_END]).count() <<
+            " ms, codegen: " << duration_cast<milliseconds>(
+                node.Times[METRIC_CODE_GENERATION]).count() <<
+            " ms)\t link: " << duration_cast<milliseconds>(
+                node.Times[METRIC_LINK]).count() <<
+            " ms\t translation units: " << node.TranslationUnitCount << "\n";
+    }
+
+    size_t countPerLevel_;
+    size_t maxDepth_;
+
+    ReportWriter& report_;
+
+    // The path trie. The first node is the root, whose times are those
+    // of the whole build.
+    std::vector<Node> nodes_;
+
+    // Maps lowercase directory paths to their node.
+    std::unordered_map<std::wstring, size_t> directoryNodes_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int countPerLevel = 0;
+
+    if (argc >= 3) {
+        countPerLevel = std::atoi(argv[2]);
+    }
+
+    int maxDepth = 0;
+
+    if (argc >= 4) {
+        maxDepth = std::atoi(argv[3]);
+    }
+
+    DirectoryRollup rollup{ countPerLevel, maxDepth, report };
+
+    auto group = MakeStaticAnalyzerGroup(&rollup);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+#include "../Common/StaticAnalyzer.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+using namespace SimpleEvents;
+
+// The handlers that are dispatched to by both analyzers being compared.
+// They are typical of the samples, and do just enough work to not be
+// optimized away.
+class Workload
+{
+public:
+    Workload():
+        handledEventCount_{0},
+        checksum_{0}
+    {}
+
+    void OnStopInvocation(Invocation invocation) {
+        Accumulate(invocation.Duration());
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe) {
+        Accumulate(fe.Duration());
+    }
+
+    void OnStopBackEndPass(Compiler cl, BackEndPass be) {
+        Accumulate(be.Duration());
+    }
+
+    void OnStopFrontEndFile(FrontEndFileGroup files) {
+        Accumulate(files.Back().Duration());
+    }
+
+    void OnStopTemplateInstantiation(TemplateInstantiationGroup group) {
+        Accumulate(group.Back().Duration());
+    }
+
+    void OnStopFunction(Invocation invocation, CodeGeneration cg,
+        Function func)
+    {
+        Accumulate(func.Duration());
+    }
+
+    void OnForceInlinee(Function func, ForceInlinee inlinee) {
+        Accumulate(std::chrono::nanoseconds{inlinee.Size()});
+    }
+
+    void OnSymbolName(SymbolName symbol) {
+        Accumulate(std::chrono::nanoseconds{
+            static_cast<long long>(symbol.Key() & 0xFFFF)});
+    }
+
+    void OnCommandLine(Invocation invocation, CommandLine commandLine) {
+        Accumulate(std::chrono::nanoseconds{1});
+    }
+
+    unsigned long long HandledEventCount() const {
+        return handledEventCount_;
+    }
+
+    unsigned long long Checksum() const {
+        return checksum_;
+    }
+
+private:
+    void Accumulate(std::chrono::nanoseconds value)
+    {
+        ++handledEventCount_;
+        checksum_ = checksum_ * 31 +
+            static_cast<unsigned long long>(value.count());
+    }
+
+    unsigned long long handledEventCount_;
+    unsigned long long checksum_;
+};
+
+// Measures the cost of decoding the trace and of calling into an
+// analyzer, by doing nothing but counting events.
+class EmptyAnalyzer : public IAnalyzer
+{
+public:
+    EmptyAnalyzer():
+        eventCount_{0}
+    {}
+
+    AnalysisControl OnStartActivity(const EventStack&) override
+    {
+        ++eventCount_;
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnStopActivity(const EventStack&) override
+    {
+        ++eventCount_;
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack&) override
+    {
+        ++eventCount_;
+        return AnalysisControl::CONTINUE;
+    }
+
+    unsigned long long EventCount() const {
+        return eventCount_;
+    }
+
+private:
+    unsigned long long eventCount_;
+};
+
+// Dispatches every event to every handler, which is what analyzers do
+// when they don't switch on the event id themselves.
+class VirtualDispatchAnalyzer : public IAnalyzer, public Workload
+{
+public:
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        Workload* workload = this;
+
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopInvocation);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopFrontEndPass);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopBackEndPass);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopFrontEndFile);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopTemplateInstantiation);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnStopFunction);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        Workload* workload = this;
+
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnForceInlinee);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnSymbolName);
+        MatchEventStackInMemberFunction(eventStack, workload,
+            &Workload::OnCommandLine);
+
+        return AnalysisControl::CONTINUE;
+    }
+};
+
+// The same handlers, dispatched through a table built at compile time.
+class StaticDispatchAnalyzer :
+    public StaticAnalyzer<StaticDispatchAnalyzer>, public Workload
+{
+public:
+    using StopActivityHandlers = Handlers<
+        &Workload::OnStopInvocation,
+        &Workload::OnStopFrontEndPass,
+        &Workload::OnStopBackEndPass,
+        &Workload::OnStopFrontEndFile,
+        &Workload::OnStopTemplateInstantiation,
+        &Workload::OnStopFunction>;
+
+    using SimpleEventHandlers = Handlers<
+        &Workload::OnForceInlinee,
+        &Workload::OnSymbolName,
+        &Workload::OnCommandLine>;
+};
+
+class DispatchBenchmark
+{
+public:
+    DispatchBenchmark(const char* tracePath, int repetitionCount,
+        ReportWriter& report):
+        tracePath_{tracePath},
+        repetitionCount_{repetitionCount > 0 ? repetitionCount : 3},
+        report_{report}
+    {}
+
+    int Run()
+    {
+        using namespace std::chrono;
+
+        EmptyAnalyzer empty;
+        nanoseconds emptyTime{0};
+
+        if (!Measure(empty, emptyTime)) {
+            return -1;
+        }
+
+        // Each repetition analyzes the trace again, so the event count
+        // is a multiple of that of a single analysis.
+        unsigned long long eventCount = empty.EventCount() / repetitionCount_;
+
+        VirtualDispatchAnalyzer virtualDispatch;
+        nanoseconds virtualTime{0};
+
+        if (!Measure(virtualDispatch, virtualTime)) {
+            return -1;
+        }
+
+        StaticDispatchAnalyzer staticDispatch;
+        nanoseconds staticTime{0};
+
+        if (!Measure(staticDispatch, staticTime)) {
+            return -1;
+        }
+
+        bool checksumsMatch =
+            virtualDispatch.Checksum() == staticDispatch.Checksum() &&
+            virtualDispatch.HandledEventCount() ==
+                staticDispatch.HandledEventCount();
+
+        if (report_.IsText())
+        {
+            std::cout << "Events per analysis: " << eventCount <<
+                "\t Handled: " << virtualDispatch.HandledEventCount() /
+                    repetitionCount_ <<
+                "\t Best of " << repetitionCount_ << " runs\n\n";
+        }
+
+        PrintVariant("Empty", emptyTime, emptyTime, eventCount);
+        PrintVariant("VirtualDispatch", virtualTime, emptyTime, eventCount);
+        PrintVariant("StaticDispatch", staticTime, emptyTime, eventCount);
+
+        if (report_.IsText() && !checksumsMatch) {
+            std::cout << "\nWARNING: the analyzers handled different events.\n";
+        }
+
+        return checksumsMatch ? 0 : -1;
+    }
+
+private:
+    // Keeps the fastest of several analyses, which is the least
+    // affected by the rest of the system.
+    template <class Analyzer>
+    bool Measure(Analyzer& analyzer, std::chrono::nanoseconds& best)
+    {
+        using namespace std::chrono;
+
+        best = nanoseconds::max();
+
+        for (int i = 0; i < repetitionCount_; ++i)
+        {
+            auto group = MakeStaticAnalyzerGroup(&analyzer);
+
+            auto start = steady_clock::now();
+
+            int result = Analyze(tracePath_, 1, group);
+
+            auto elapsed = duration_cast<nanoseconds>(
+                steady_clock::now() - start);
+
+            if (result != 0) {
+                return false;
+            }
+
+            best = std::min(best, elapsed);
+        }
+
+        return true;
+    }
+
+    void PrintVariant(const char* name, std::chrono::nanoseconds time,
+        std::chrono::nanoseconds emptyTime, unsigned long long eventCount)
+    {
+        using namespace std::chrono;
+
+        double nanosecondsPerEvent = eventCount == 0 ? 0. :
+            static_cast<double>(time.count()) / eventCount;
+
+        double dispatchNanosecondsPerEvent = eventCount == 0 ? 0. :
+            static_cast<double>((time - emptyTime).count()) / eventCount;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Variant")
+                .Field("Name", name)
+                .Field("DurationMs", duration_cast<milliseconds>(
+                    time).count())
+                .Field("NsPerEvent", nanosecondsPerEvent)
+                .Field("DispatchNsPerEvent", dispatchNanosecondsPerEvent)
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << std::left << std::setw(18) << name << std::right <<
+            std::setw(10) << duration_cast<milliseconds>(time).count() <<
+            " ms\t" << std::fixed << std::setprecision(1) <<
+            nanosecondsPerEvent << " ns/event\t(" <<
+            dispatchNanosecondsPerEvent << " ns/event above Empty)\n";
+    }
+
+    const char* tracePath_;
+    int repetitionCount_;
+
+    ReportWriter& report_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int repetitionCount = 0;
+
+    if (argc >= 3) {
+        repetitionCount = std::atoi(argv[2]);
+    }
+
+    // argv[1] should contain the path to a trace file
+    DispatchBenchmark benchmark{ argv[1], repetitionCount, report };
+
+    return benchmark.Run();
+}
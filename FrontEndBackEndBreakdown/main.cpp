@@ -0,0 +1,596 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cwctype>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+// The categories into which the time of a translation unit is split.
+// Each category points to a different kind of fix: parsing time is
+// reduced with precompiled headers or modules, template instantiation
+// time by reworking templates, and code generation time by changing
+// the generated functions or the optimization settings. The time of an
+// invocation during which none of its passes run (startup, command line
+// processing, waiting on I/O, cleanup) is attributed to its translation
+// units as other time.
+enum CostCategory
+{
+    COST_PARSING,
+    COST_TEMPLATE_INSTANTIATION,
+    COST_CODE_GENERATION,
+    COST_BACK_END_OTHER,
+    COST_OTHER,
+
+    COST_CATEGORY_COUNT
+};
+
+const char* CostCategoryName(CostCategory category)
+{
+    switch (category)
+    {
+    case COST_PARSING:                  return "Parsing";
+    case COST_TEMPLATE_INSTANTIATION:   return "TemplateInstantiation";
+    case COST_CODE_GENERATION:          return "CodeGeneration";
+    case COST_BACK_END_OTHER:           return "BackEndOther";
+    case COST_OTHER:                    return "Other";
+    default:                            return "";
+    }
+}
+
+const char* CostCategoryFix(CostCategory category)
+{
+    switch (category)
+    {
+    case COST_PARSING:                  return "PCH / modules";
+    case COST_TEMPLATE_INSTANTIATION:   return "template usage";
+    case COST_CODE_GENERATION:          return "code generation";
+    case COST_BACK_END_OTHER:           return "back-end settings";
+    case COST_OTHER:                    return "invocation overhead";
+    default:                            return "";
+    }
+}
+
+class FrontEndBackEndBreakdown : public IAnalyzer
+{
+    struct TranslationUnitInfo
+    {
+        unsigned InvocationId;
+        std::string Path;
+        std::chrono::nanoseconds Costs[COST_CATEGORY_COUNT];
+
+        std::chrono::nanoseconds Total() const
+        {
+            std::chrono::nanoseconds total{0};
+
+            for (auto& cost : Costs) {
+                total += cost;
+            }
+
+            return total;
+        }
+
+        CostCategory Dominant() const
+        {
+            return static_cast<CostCategory>(std::max_element(Costs,
+                Costs + COST_CATEGORY_COUNT) - Costs);
+        }
+    };
+
+    // Bookkeeping for a compiler invocation that is still running.
+    struct ActiveInvocation
+    {
+        // The start and stop timestamps of the invocation's passes.
+        std::vector<std::pair<long long, long long>> PassIntervals;
+
+        // Maps lowercase source paths to their index in
+        // translationUnits_.
+        std::unordered_map<std::wstring, size_t> TranslationUnits;
+    };
+
+    struct InvocationInfo
+    {
+        unsigned InvocationId;
+        std::string WorkingDirectory;
+        std::chrono::nanoseconds Duration;
+        std::chrono::nanoseconds OtherTime;
+
+        bool operator<(const InvocationInfo& other) const {
+            return OtherTime > other.OtherTime;
+        }
+    };
+
+public:
+    FrontEndBackEndBreakdown(int countToDump, ReportWriter& report):
+        countToDump_{countToDump > 0 ? static_cast<size_t>(countToDump) : 10},
+        report_{report},
+        activeInvocations_{},
+        templateTime_{},
+        codeGenerationTime_{},
+        translationUnits_{},
+        invocations_{},
+        totalCosts_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_TEMPLATE_INSTANTIATION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &FrontEndBackEndBreakdown::OnStopTemplateInstantiation);
+            break;
+
+        case EVENT_ID_CODE_GENERATION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &FrontEndBackEndBreakdown::OnStopCodeGeneration);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &FrontEndBackEndBreakdown::OnStopFrontEndPass);
+            break;
+
+        case EVENT_ID_BACK_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &FrontEndBackEndBreakdown::OnStopBackEndPass);
+            break;
+
+        case EVENT_ID_COMPILER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &FrontEndBackEndBreakdown::OnStopCompiler);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopTemplateInstantiation(FrontEndPass fe,
+        TemplateInstantiationGroup group)
+    {
+        // Only count the roots of template instantiation hierarchies,
+        // since the time of nested instantiations is already included
+        // in their parent's.
+        if (group.Size() != 1) {
+            return;
+        }
+
+        templateTime_[fe.EventInstanceId()] += group[0].Duration();
+    }
+
+    void OnStopCodeGeneration(BackEndPass be, CodeGeneration cg)
+    {
+        codeGenerationTime_[be.EventInstanceId()] += cg.Duration();
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe)
+    {
+        std::chrono::nanoseconds templateTime{0};
+
+        auto it = templateTime_.find(fe.EventInstanceId());
+
+        if (it != templateTime_.end())
+        {
+            templateTime = std::min(it->second, fe.Duration());
+            templateTime_.erase(it);
+        }
+
+        const wchar_t* path = fe.InputSourcePath() ? fe.InputSourcePath() :
+            fe.OutputObjectPath();
+
+        if (path == nullptr) {
+            return;
+        }
+
+        TranslationUnitInfo& tu = GetTranslationUnit(cl, path, fe);
+
+        tu.Costs[COST_PARSING] += fe.Duration() - templateTime;
+        tu.Costs[COST_TEMPLATE_INSTANTIATION] += templateTime;
+    }
+
+    void OnStopBackEndPass(Compiler cl, BackEndPass be)
+    {
+        std::chrono::nanoseconds codeGenerationTime{0};
+
+        auto it = codeGenerationTime_.find(be.EventInstanceId());
+
+        if (it != codeGenerationTime_.end())
+        {
+            codeGenerationTime = std::min(it->second, be.Duration());
+            codeGenerationTime_.erase(it);
+        }
+
+        const wchar_t* path = be.InputSourcePath() ? be.InputSourcePath() :
+            be.OutputObjectPath();
+
+        if (path == nullptr) {
+            return;
+        }
+
+        TranslationUnitInfo& tu = GetTranslationUnit(cl, path, be);
+
+        tu.Costs[COST_CODE_GENERATION] += codeGenerationTime;
+        tu.Costs[COST_BACK_END_OTHER] += be.Duration() - codeGenerationTime;
+    }
+
+    void OnStopCompiler(Compiler cl)
+    {
+        using namespace std::chrono;
+
+        auto it = activeInvocations_.find(cl.EventInstanceId());
+
+        if (it == activeInvocations_.end())
+        {
+            totalCosts_[COST_OTHER] += cl.Duration();
+
+            invocations_.push_back({ cl.InvocationId(),
+                ToUtf8(cl.WorkingDirectory()), cl.Duration(), cl.Duration() });
+            return;
+        }
+
+        ActiveInvocation& invocation = it->second;
+
+        // Under /MP, passes of different translation units overlap, so
+        // the time outside of passes is that not covered by any of them.
+        nanoseconds otherTime = std::max(cl.Duration() - TicksToNanoseconds(
+            CoveredTicks(invocation.PassIntervals), cl.TickFrequency()),
+            nanoseconds{0});
+
+        // It is split among the translation units in proportion to the
+        // time of their passes.
+        nanoseconds passTime{0};
+
+        for (auto& entry : invocation.TranslationUnits) {
+            passTime += translationUnits_[entry.second].Total();
+        }
+
+        if (passTime.count() == 0) {
+            totalCosts_[COST_OTHER] += otherTime;
+        }
+        else
+        {
+            for (auto& entry : invocation.TranslationUnits)
+            {
+                TranslationUnitInfo& tu = translationUnits_[entry.second];
+
+                tu.Costs[COST_OTHER] = nanoseconds{static_cast<long long>(
+                    static_cast<double>(otherTime.count()) *
+                    tu.Total().count() / passTime.count())};
+            }
+        }
+
+        activeInvocations_.erase(it);
+
+        invocations_.push_back({ cl.InvocationId(),
+            ToUtf8(cl.WorkingDirectory()), cl.Duration(), otherTime });
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        PrintTotals();
+
+        PrintTranslationUnits(nullptr, COST_CATEGORY_COUNT);
+
+        for (int i = 0; i < COST_CATEGORY_COUNT; ++i)
+        {
+            auto category = static_cast<CostCategory>(i);
+
+            PrintTranslationUnits(CostCategoryName(category), category);
+        }
+
+        PrintInvocations();
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    TranslationUnitInfo& GetTranslationUnit(const Compiler& cl,
+        const wchar_t* path, const Activity& pass)
+    {
+        ActiveInvocation& invocation = activeInvocations_[cl.EventInstanceId()];
+
+        invocation.PassIntervals.emplace_back(pass.StartTimestamp(),
+            pass.StopTimestamp());
+
+        std::wstring key = path;
+
+        std::transform(key.begin(), key.end(), key.begin(),
+            [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+
+        auto result = invocation.TranslationUnits.try_emplace(
+            std::move(key), translationUnits_.size());
+
+        if (result.second)
+        {
+            translationUnits_.push_back(TranslationUnitInfo{});
+
+            TranslationUnitInfo& tu = translationUnits_.back();
+
+            tu.InvocationId = cl.InvocationId();
+            tu.Path = ToUtf8(path);
+        }
+
+        return translationUnits_[result.first->second];
+    }
+
+    // Returns the length of the union of a set of intervals.
+    static long long CoveredTicks(
+        std::vector<std::pair<long long, long long>>& intervals)
+    {
+        std::sort(intervals.begin(), intervals.end());
+
+        long long covered = 0;
+        long long coveredUntil = 0;
+        bool isFirst = true;
+
+        for (auto& interval : intervals)
+        {
+            long long start = isFirst ? interval.first :
+                std::max(interval.first, coveredUntil);
+
+            if (interval.second > start) {
+                covered += interval.second - start;
+            }
+
+            coveredUntil = isFirst ? interval.second :
+                std::max(coveredUntil, interval.second);
+            isFirst = false;
+        }
+
+        return covered;
+    }
+
+    static std::chrono::nanoseconds TicksToNanoseconds(long long ticks,
+        long long tickFrequency)
+    {
+        if (tickFrequency <= 0) {
+            return std::chrono::nanoseconds{0};
+        }
+
+        return std::chrono::nanoseconds{static_cast<long long>(
+            static_cast<double>(ticks) * 1000000000. / tickFrequency)};
+    }
+
+    void PrintTotals()
+    {
+        using namespace std::chrono;
+
+        for (auto& tu : translationUnits_)
+        {
+            for (int i = 0; i < COST_CATEGORY_COUNT; ++i) {
+                totalCosts_[i] += tu.Costs[i];
+            }
+        }
+
+        nanoseconds total{0};
+
+        for (auto& cost : totalCosts_) {
+            total += cost;
+        }
+
+        if (!report_.IsText())
+        {
+            auto& record = report_.BeginRecord("Totals")
+                .Field("TranslationUnitCount", translationUnits_.size())
+                .Field("InvocationCount", invocations_.size());
+
+            for (int i = 0; i < COST_CATEGORY_COUNT; ++i)
+            {
+                record.Field(CostCategoryName(static_cast<CostCategory>(i)),
+                    duration_cast<milliseconds>(totalCosts_[i]).count());
+            }
+
+            record.EndRecord();
+
+            return;
+        }
+
+        std::cout << "Compiler time across " << translationUnits_.size() <<
+            " translation units and " << invocations_.size() <<
+            " invocations:\n\n";
+
+        for (int i = 0; i < COST_CATEGORY_COUNT; ++i)
+        {
+            nanoseconds cost = totalCosts_[i];
+
+            std::cout << std::left << std::setw(24) <<
+                CostCategoryName(static_cast<CostCategory>(i)) <<
+                std::right << std::setw(10) <<
+                duration_cast<milliseconds>(cost).count() << " ms  (" <<
+                std::fixed << std::setprecision(1) << Percentage(cost, total) <<
+                "%)\n";
+        }
+
+        std::cout << "\n";
+    }
+
+    // Prints the most expensive translation units, either by total time
+    // or by the time spent in a single category.
+    void PrintTranslationUnits(const char* title, CostCategory category)
+    {
+        using namespace std::chrono;
+
+        std::vector<const TranslationUnitInfo*> sorted;
+
+        sorted.reserve(translationUnits_.size());
+
+        for (auto& tu : translationUnits_) {
+            sorted.push_back(&tu);
+        }
+
+        auto cost = [category](const TranslationUnitInfo* tu) {
+            return category == COST_CATEGORY_COUNT ? tu->Total() :
+                tu->Costs[category];
+        };
+
+        size_t countToDump = std::min(sorted.size(), countToDump_);
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end(), [&](const TranslationUnitInfo* lhs,
+                const TranslationUnitInfo* rhs) {
+                return cost(lhs) > cost(rhs);
+            });
+
+        if (report_.IsText())
+        {
+            std::cout << "Top " << countToDump << " translation units by " <<
+                (title ? title : "total time") << ":\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const TranslationUnitInfo& tu = *sorted[i];
+
+            if (cost(&tu).count() == 0) {
+                break;
+            }
+
+            nanoseconds total = tu.Total();
+            CostCategory dominant = tu.Dominant();
+
+            if (!report_.IsText())
+            {
+                auto& record = report_.BeginRecord("TranslationUnit")
+                    .Field("RankedBy", title ? title : "Total")
+                    .Field("InvocationId", tu.InvocationId)
+                    .Field("TotalMs", duration_cast<milliseconds>(
+                        total).count());
+
+                for (int c = 0; c < COST_CATEGORY_COUNT; ++c)
+                {
+                    record.Field(CostCategoryName(static_cast<CostCategory>(c)),
+                        duration_cast<milliseconds>(tu.Costs[c]).count());
+                }
+
+                record.Field("Dominant", CostCategoryName(dominant))
+                    .Field("Path", tu.Path)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << duration_cast<milliseconds>(total).count() <<
+                " ms\t(parse " << std::fixed << std::setprecision(0) <<
+                Percentage(tu.Costs[COST_PARSING], total) << "%, templates " <<
+                Percentage(tu.Costs[COST_TEMPLATE_INSTANTIATION], total) <<
+                "%, codegen " <<
+                Percentage(tu.Costs[COST_CODE_GENERATION], total) <<
+                "%, other back-end " <<
+                Percentage(tu.Costs[COST_BACK_END_OTHER], total) <<
+                "%, other " << Percentage(tu.Costs[COST_OTHER], total) <<
+                "%; fix: " << CostCategoryFix(dominant) << ")\t CL " <<
+                tu.InvocationId << "\t " << tu.Path << "\n";
+        }
+
+        if (report_.IsText()) {
+            std::cout << "\n";
+        }
+    }
+
+    void PrintInvocations()
+    {
+        using namespace std::chrono;
+
+        size_t countToDump = std::min(invocations_.size(), countToDump_);
+
+        std::partial_sort(invocations_.begin(),
+            invocations_.begin() + countToDump, invocations_.end());
+
+        if (report_.IsText())
+        {
+            std::cout << "Top " << countToDump <<
+                " invocations by time outside of compiler passes:\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const InvocationInfo& info = invocations_[i];
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Invocation")
+                    .Field("InvocationId", info.InvocationId)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        info.Duration).count())
+                    .Field("OtherMs", duration_cast<milliseconds>(
+                        info.OtherTime).count())
+                    .Field("WorkingDirectory", info.WorkingDirectory)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << duration_cast<milliseconds>(info.OtherTime).count() <<
+                " ms of " << duration_cast<milliseconds>(info.Duration).count() <<
+                " ms\t CL " << info.InvocationId << "\t " <<
+                info.WorkingDirectory << "\n";
+        }
+    }
+
+    static double Percentage(std::chrono::nanoseconds part,
+        std::chrono::nanoseconds whole)
+    {
+        return whole.count() == 0 ? 0. :
+            static_cast<double>(part.count()) / whole.count() * 100.;
+    }
+
+    size_t countToDump_;
+
+    ReportWriter& report_;
+
+    std::unordered_map<unsigned long long, ActiveInvocation> activeInvocations_;
+
+    // Maps front-end passes that are still running to the aggregated
+    // duration of their root template instantiations.
+    std::unordered_map<unsigned long long,
+        std::chrono::nanoseconds> templateTime_;
+
+    // Maps back-end passes that are still running to the aggregated
+    // duration of their code generation activities.
+    std::unordered_map<unsigned long long,
+        std::chrono::nanoseconds> codeGenerationTime_;
+
+    std::vector<TranslationUnitInfo> translationUnits_;
+    std::vector<InvocationInfo> invocations_;
+
+    // Build-wide time of each category.
+    std::chrono::nanoseconds totalCosts_[COST_CATEGORY_COUNT];
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int countToDump = 0;
+
+    if (argc >= 3) {
+        countToDump = std::atoi(argv[2]);
+    }
+
+    FrontEndBackEndBreakdown breakdown{ countToDump, report };
+
+    auto group = MakeStaticAnalyzerGroup(&breakdown);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
@@ -2,9 +2,13 @@
 #include <iomanip>
 #include <iostream>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/FunctionGroups.hpp"
+#include "../Common/NamePool.hpp"
+#include "../Common/ReportWriter.hpp"
+#include "../Common/Sampling.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
@@ -14,7 +18,7 @@ class FunctionBottlenecks : public IAnalyzer
 {
     struct IdentifiedFunction
     {
-        std::string Name;
+        uint32_t NameId;
         std::chrono::milliseconds Duration;
         double Percent;
         unsigned ForceInlineeSize;
@@ -25,11 +29,19 @@ class FunctionBottlenecks : public IAnalyzer
     };
 
 public:
-    FunctionBottlenecks():
+    FunctionBottlenecks(const NameOptions& nameOptions,
+        const SamplingOptions& samplingOptions, ReportWriter& report):
+        report_{report},
+        nameOptions_{nameOptions},
+        sampler_{samplingOptions},
         pass_{0},
-        cachedInvocationDurations_{},
-        identifiedFunctions_{},
-        forceInlineSizeCache_{}
+        namePool_{},
+        functionGroups_{ static_cast<unsigned>(
+            std::max(nameOptions.GroupDepth, 0)) },
+        arena_{},
+        cachedInvocationDurations_{ arena_ },
+        identifiedFunctions_{ arena_ },
+        forceInlineSizeCache_{ arena_ }
     {}
 
     AnalysisControl OnBeginAnalysisPass() override
@@ -41,6 +53,11 @@ public:
     AnalysisControl OnStopActivity(const EventStack& eventStack)
         override
     {
+        // The same invocations are sampled by both passes.
+        if (!sampler_.Includes(eventStack)) {
+            return AnalysisControl::CONTINUE;
+        }
+
         switch (pass_)
         {
         case 1:
@@ -51,6 +68,15 @@ public:
         case 2:
             MatchEventStackInMemberFunction(eventStack, this,
                 &FunctionBottlenecks::OnStopFunction);
+
+            // Sampled durations are summed by top-level invocation.
+            if (eventStack.Size() == 1 &&
+                (eventStack.Back().EventId() == EVENT_ID_COMPILER ||
+                    eventStack.Back().EventId() == EVENT_ID_LINKER))
+            {
+                functionGroups_.StopInvocation(
+                    eventStack.Back().EventInstanceId());
+            }
             break;
 
         default:
@@ -62,7 +88,7 @@ public:
 
     AnalysisControl OnSimpleEvent(const EventStack& eventStack)
     {
-        if (pass_ > 1) {
+        if (pass_ != 2 || !sampler_.Includes(eventStack)) {
             return AnalysisControl::CONTINUE;
         }
 
@@ -85,24 +111,40 @@ public:
             duration_cast<milliseconds>(invocation.Duration());
     }
 
-    void OnStopFunction(Invocation invocation, Function func)
+    void OnStopFunction(InvocationGroup invocations, Function func)
     {
         using namespace std::chrono;
 
+        // Force-inlinees are reported while their function is being
+        // generated, so their sizes are only kept until it stops. The
+        // cache then only holds the functions that are being generated
+        // at the same time, instead of all the functions of the build.
+        unsigned forceInlineSize = 0;
+
+        auto itForceInlineSize = forceInlineSizeCache_.find(
+            func.EventInstanceId());
+
+        if (itForceInlineSize != forceInlineSizeCache_.end())
+        {
+            forceInlineSize = itForceInlineSize->second;
+            forceInlineSizeCache_.erase(itForceInlineSize);
+        }
+
+        // Groups include the functions of short invocations, since many
+        // small instantiations can add up across the build.
+        if (nameOptions_.GroupDepth >= 0) {
+            functionGroups_.Add(func.Name(), duration_cast<nanoseconds>(
+                func.Duration()), sampler_.IsSampling() ?
+                    invocations[0].EventInstanceId() : 0);
+        }
+
         auto itInvocation = cachedInvocationDurations_.find(
-            invocation.EventInstanceId());
+            invocations.Back().EventInstanceId());
 
         if (itInvocation == cachedInvocationDurations_.end()) {
             return;
         }
 
-        auto itForceInlineSize = forceInlineSizeCache_.find(
-            func.EventInstanceId());
-
-        unsigned forceInlineSize =
-            itForceInlineSize == forceInlineSizeCache_.end() ?
-                0 : itForceInlineSize->second;
-
         milliseconds functionMilliseconds = 
             duration_cast<milliseconds>(func.Duration());
 
@@ -117,8 +159,8 @@ public:
         if (percent > 0.05 && func.Duration() >= seconds(1))
         {
             identifiedFunctions_[func.EventInstanceId()]= 
-                { func.Name(), functionMilliseconds, percent, 
-                  forceInlineSize };
+                { namePool_.Intern(func.Name()), functionMilliseconds,
+                  percent, forceInlineSize };
         }
     }
 
@@ -138,8 +180,27 @@ public:
 
         std::sort(sortedFunctions.begin(), sortedFunctions.end());
 
+        if (report_.IsText() && sampler_.IsSampling())
+        {
+            std::cout << "Bottlenecks in " << sampler_.Rate() * 100. <<
+                "% of invocations:\n\n";
+        }
+
         for (auto& func : sortedFunctions)
         {
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Function")
+                    .Field("DurationMs", func.Duration.count())
+                    .Field("Percent", func.Percent * 100)
+                    .Field("ForceInlineeSize", func.ForceInlineeSize)
+                    .Field("Name", FormatName(namePool_.Name(func.NameId),
+                        nameOptions_))
+                    .EndRecord();
+
+                continue;
+            }
+
             bool forceInlineHeavy = func.ForceInlineeSize >= 10000;
 
             std::string forceInlineIndicator = forceInlineHeavy ?
@@ -156,32 +217,70 @@ public:
             std::cout << " ms ";
             std::cout << std::setw(9) << std::left << 
                 percentString;
-            std::cout << " " << func.Name << std::endl;
+            std::cout << " " <<
+                FormatName(namePool_.Name(func.NameId), nameOptions_) << "\n";
+        }
+
+        if (nameOptions_.GroupDepth >= 0)
+        {
+            functionGroups_.StopAllInvocations();
+            functionGroups_.Print(report_, GROUP_COUNT_TO_DUMP, nameOptions_,
+                sampler_.Rate());
         }
 
         return AnalysisControl::CONTINUE;
     }
 
 private:
+    static constexpr size_t GROUP_COUNT_TO_DUMP = 100;
+
+    ReportWriter& report_;
+
+    NameOptions nameOptions_;
+
+    InvocationSampler sampler_;
+
     unsigned pass_;
 
-    std::unordered_map<unsigned long long,
+    NamePool namePool_;
+
+    FunctionGroups functionGroups_;
+
+    MonotonicArena arena_;
+
+    HashMap<unsigned long long,
         std::chrono::milliseconds> cachedInvocationDurations_;
 
-    std::unordered_map<unsigned long long, 
+    HashMap<unsigned long long, 
         IdentifiedFunction> identifiedFunctions_;
 
-    std::unordered_map<unsigned long long, 
+    HashMap<unsigned long long, 
         unsigned> forceInlineSizeCache_;
 };
 
 int main(int argc, char* argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    NameOptions nameOptions;
+
+    if (!ParseNameOptions(argc, argv, nameOptions)) return -1;
+
+    SamplingOptions samplingOptions;
+
+    if (!ParseSamplingOptions(argc, argv, samplingOptions)) return -1;
+
     if (argc <= 1) return -1;
 
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
     std::cout.imbue(std::locale(""));
 
-    FunctionBottlenecks fb;
+    FunctionBottlenecks fb{ nameOptions, samplingOptions, report };
 
     auto group = MakeStaticAnalyzerGroup(&fb);
 
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+
+// Counts the memory allocated through the allocators that refer to it.
+class MemoryCounter
+{
+public:
+    MemoryCounter():
+        currentSize_{0},
+        peakSize_{0}
+    {}
+
+    void Add(size_t size)
+    {
+        currentSize_ += size;
+        peakSize_ = std::max(peakSize_, currentSize_);
+    }
+
+    void Remove(size_t size) {
+        currentSize_ -= size;
+    }
+
+    size_t PeakSize() const {
+        return peakSize_;
+    }
+
+private:
+    size_t currentSize_;
+    size_t peakSize_;
+};
+
+template <class T>
+class CountingAllocator
+{
+public:
+    typedef T value_type;
+
+    CountingAllocator(MemoryCounter& counter) noexcept:
+        counter_{&counter}
+    {}
+
+    template <class U>
+    CountingAllocator(const CountingAllocator<U>& other) noexcept:
+        counter_{other.Counter()}
+    {}
+
+    T* allocate(size_t count)
+    {
+        counter_->Add(count * sizeof(T));
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t count) noexcept
+    {
+        counter_->Remove(count * sizeof(T));
+        ::operator delete(p);
+    }
+
+    MemoryCounter* Counter() const noexcept {
+        return counter_;
+    }
+
+private:
+    MemoryCounter* counter_;
+};
+
+template <class T, class U>
+bool operator==(const CountingAllocator<T>& lhs,
+    const CountingAllocator<U>& rhs)
+{
+    return lhs.Counter() == rhs.Counter();
+}
+
+template <class T, class U>
+bool operator!=(const CountingAllocator<T>& lhs,
+    const CountingAllocator<U>& rhs)
+{
+    return lhs.Counter() != rhs.Counter();
+}
+
+// The table types being compared. Each variant takes its memory from a
+// resource, which also tells the most memory the tables held at once:
+// for the standard allocator, the peak of the bytes requested, which
+// leaves out the overhead the heap adds to each allocation, and for an
+// arena, the size of its blocks, which includes freed memory it hasn't
+// reused yet and the unused end of its last block.
+struct StdTables
+{
+    typedef MemoryCounter Resource;
+
+    template <class Key, class Value>
+    using Map = std::unordered_map<Key, Value, std::hash<Key>,
+        std::equal_to<Key>, CountingAllocator<std::pair<const Key, Value>>>;
+
+    template <class Key>
+    using Set = std::unordered_set<Key, std::hash<Key>, std::equal_to<Key>,
+        CountingAllocator<Key>>;
+
+    static size_t PeakSize(const Resource& resource) {
+        return resource.PeakSize();
+    }
+};
+
+// What the samples use when BUILD_INSIGHTS_USE_STD_HASH_TABLES is defined.
+struct StdTablesInArena
+{
+    typedef MonotonicArena Resource;
+
+    template <class Key, class Value>
+    using Map = std::unordered_map<Key, Value, std::hash<Key>,
+        std::equal_to<Key>, ArenaAllocator<std::pair<const Key, Value>>>;
+
+    template <class Key>
+    using Set = std::unordered_set<Key, std::hash<Key>, std::equal_to<Key>,
+        ArenaAllocator<Key>>;
+
+    static size_t PeakSize(const Resource& resource) {
+        return resource.HeldSize();
+    }
+};
+
+// What the samples use by default.
+struct FlatTablesInArena
+{
+    typedef MonotonicArena Resource;
+
+    template <class Key, class Value>
+    using Map = FlatHashMap<Key, Value, std::hash<Key>, std::equal_to<Key>,
+        ArenaAllocator<std::pair<Key, Value>>>;
+
+    template <class Key>
+    using Set = FlatHashSet<Key, std::hash<Key>, std::equal_to<Key>,
+        ArenaAllocator<Key>>;
+
+    static size_t PeakSize(const Resource& resource) {
+        return resource.HeldSize();
+    }
+};
+
+// A synthetic workload shaped like the per-analysis state of TopHeaders:
+// each front-end pass looks up the headers it includes, which are skewed
+// towards a few popular ones, and adds itself to the set of passes of
+// each. Each pass also adds and then removes the ids of the activities
+// that ran concurrently with it, like BottleneckCompileFinder.
+class HashTableBenchmark
+{
+public:
+    static const size_t HEADER_COUNT = 20000;
+    static const size_t INCLUDES_PER_PASS = 300;
+    static const size_t CONCURRENT_IDS_PER_PASS = 200;
+
+    HashTableBenchmark(unsigned long long passCount, int repetitionCount,
+        ReportWriter& report):
+        passCount_{passCount > 0 ? passCount : 20000},
+        repetitionCount_{repetitionCount > 0 ? repetitionCount : 3},
+        report_{report},
+        headerPaths_{},
+        includes_{}
+    {
+        for (size_t i = 0; i < HEADER_COUNT; ++i)
+        {
+            headerPaths_.push_back("c:\\program files\\microsoft visual "
+                "studio\\include\\header_" + std::to_string(i) + ".h");
+        }
+
+        // Drawn once, so that all variants do the same lookups.
+        std::mt19937_64 random{1};
+
+        includes_.reserve(passCount_ * INCLUDES_PER_PASS);
+
+        for (size_t i = 0; i < passCount_ * INCLUDES_PER_PASS; ++i)
+        {
+            double uniform = static_cast<double>(random() % 1000000) / 1e6;
+
+            includes_.push_back(static_cast<uint32_t>(
+                uniform * uniform * uniform * HEADER_COUNT));
+        }
+    }
+
+    int Run()
+    {
+        if (report_.IsText())
+        {
+            std::cout << "Passes: " << passCount_ << "\t Headers: " <<
+                HEADER_COUNT << "\t Lookups: " << includes_.size() <<
+                "\t Best of " << repetitionCount_ << " runs\n\n";
+        }
+
+        unsigned long long stdChecksum = Measure<StdTables>("StdTables");
+        unsigned long long stdInArenaChecksum =
+            Measure<StdTablesInArena>("StdTablesInArena");
+        unsigned long long flatChecksum =
+            Measure<FlatTablesInArena>("FlatTablesInArena");
+
+        bool checksumsMatch = stdChecksum == stdInArenaChecksum &&
+            stdChecksum == flatChecksum;
+
+        if (report_.IsText() && !checksumsMatch) {
+            std::cout << "\nWARNING: the variants computed different results.\n";
+        }
+
+        return checksumsMatch ? 0 : -1;
+    }
+
+private:
+    template <class Set>
+    struct HeaderInfo
+    {
+        std::chrono::nanoseconds Duration;
+        Set PassIds;
+    };
+
+    // Keeps the fastest of several runs, and the memory used by the
+    // tables in the last one.
+    template <class Tables>
+    unsigned long long Measure(const char* name)
+    {
+        using namespace std::chrono;
+
+        nanoseconds best = nanoseconds::max();
+        size_t peakSize = 0;
+        unsigned long long checksum = 0;
+
+        for (int i = 0; i < repetitionCount_; ++i)
+        {
+            typename Tables::Resource resource;
+
+            auto start = steady_clock::now();
+
+            checksum = RunWorkload<Tables>(resource);
+
+            best = std::min(best, duration_cast<nanoseconds>(
+                steady_clock::now() - start));
+
+            peakSize = Tables::PeakSize(resource);
+        }
+
+        PrintVariant(name, best, peakSize);
+
+        return checksum;
+    }
+
+    template <class Tables>
+    unsigned long long RunWorkload(typename Tables::Resource& resource)
+    {
+        typedef typename Tables::template Set<unsigned long long> PassIdSet;
+
+        typename Tables::template Map<std::string, HeaderInfo<PassIdSet>>
+            headers{ resource };
+
+        typename Tables::template Map<unsigned long long, unsigned long long>
+            concurrentIds{ resource };
+
+        const uint32_t* include = includes_.data();
+
+        for (unsigned long long pass = 0; pass < passCount_; ++pass)
+        {
+            for (size_t i = 0; i < INCLUDES_PER_PASS; ++i)
+            {
+                auto result = headers.try_emplace(headerPaths_[*include++],
+                    HeaderInfo<PassIdSet>{ std::chrono::nanoseconds{0},
+                        PassIdSet{ resource } });
+
+                result.first->second.Duration += std::chrono::nanoseconds{5};
+                result.first->second.PassIds.insert(pass);
+            }
+
+            unsigned long long firstId = pass * 1000;
+
+            for (size_t i = 0; i < CONCURRENT_IDS_PER_PASS; ++i) {
+                concurrentIds[firstId + i] = i;
+            }
+
+            for (size_t i = 0; i < CONCURRENT_IDS_PER_PASS; ++i) {
+                concurrentIds.erase(firstId + i);
+            }
+        }
+
+        unsigned long long checksum = concurrentIds.size();
+
+        for (auto& entry : headers)
+        {
+            checksum += entry.second.PassIds.size() *
+                static_cast<unsigned long long>(entry.second.Duration.count());
+        }
+
+        return checksum;
+    }
+
+    void PrintVariant(const char* name, std::chrono::nanoseconds time,
+        size_t peakSize)
+    {
+        using namespace std::chrono;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Variant")
+                .Field("Name", name)
+                .Field("DurationMs", duration_cast<milliseconds>(
+                    time).count())
+                .Field("TableMemoryMB", peakSize / (1024 * 1024))
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << std::left << std::setw(20) << name << std::right <<
+            std::setw(10) << duration_cast<milliseconds>(time).count() <<
+            " ms\t" << std::setw(6) << peakSize / (1024 * 1024) <<
+            " MB of tables\n";
+    }
+
+    unsigned long long passCount_;
+    int repetitionCount_;
+
+    ReportWriter& report_;
+
+    std::vector<std::string> headerPaths_;
+
+    // The header included by each lookup, in order.
+    std::vector<uint32_t> includes_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    unsigned long long passCount = 0;
+    int repetitionCount = 0;
+
+    if (argc >= 2) {
+        passCount = std::strtoull(argv[1], nullptr, 10);
+    }
+
+    if (argc >= 3) {
+        repetitionCount = std::atoi(argv[2]);
+    }
+
+    HashTableBenchmark benchmark{ passCount, repetitionCount, report };
+
+    return benchmark.Run();
+}
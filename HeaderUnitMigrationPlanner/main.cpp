@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+using namespace SimpleEvents;
+
+class HeaderUnitMigrationPlanner : public IAnalyzer
+{
+    struct HeaderInfo
+    {
+        std::string Path;
+
+        // Time spent parsing the header textually, and the number of
+        // front-end passes that include it.
+        std::chrono::nanoseconds TextualDuration;
+        unsigned long long InclusionCount;
+        unsigned long long LastPassId;
+
+        // Time spent creating a header unit from the header, when the
+        // build already does.
+        std::chrono::nanoseconds IfcDuration;
+        unsigned long long IfcCount;
+
+        // Filled in at the end of the analysis.
+        std::chrono::nanoseconds CreationEstimate;
+        std::chrono::nanoseconds ImportEstimate;
+        std::chrono::nanoseconds NetSavings;
+
+        bool operator<(const HeaderInfo& other) const {
+            return NetSavings > other.NetSavings;
+        }
+    };
+
+    // A header parsed by a front-end pass that hasn't finished yet.
+    struct PendingParse
+    {
+        size_t HeaderIndex;
+        std::chrono::nanoseconds Duration;
+    };
+
+public:
+    HeaderUnitMigrationPlanner(int countToDump, int importCostPercent,
+        ReportWriter& report):
+        countToDump_{countToDump > 0 ? static_cast<size_t>(countToDump) : 10},
+        importCostPercent_{importCostPercent >= 0 ?
+            importCostPercent : DEFAULT_IMPORT_COST_PERCENT},
+        report_{report},
+        arena_{},
+        headerIndices_{ arena_ },
+        headerUnitPassIds_{ arena_ },
+        pendingParses_{ arena_ },
+        headers_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &HeaderUnitMigrationPlanner::OnStopFile);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &HeaderUnitMigrationPlanner::OnStopFrontEndPass);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        MatchEventStackInMemberFunction(eventStack, this,
+            &HeaderUnitMigrationPlanner::OnHeaderUnitEvent);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnHeaderUnitEvent(FrontEndPass fe, HeaderUnit headerUnit)
+    {
+        headerUnitPassIds_.insert(fe.EventInstanceId());
+    }
+
+    // Whether a pass creates a header unit is only known once the pass
+    // has ended, so the headers it parses are kept aside until then.
+    // Headers parsed while creating a header unit aren't textual
+    // includes that the header unit would save.
+    void OnStopFile(FrontEndPass fe, FrontEndFileGroup files)
+    {
+        // The first file of the group is the translation unit itself.
+        if (files.Size() < 2) {
+            return;
+        }
+
+        size_t headerIndex = FindHeader(files.Back().Path());
+
+        pendingParses_[fe.EventInstanceId()].push_back(
+            { headerIndex, files.Back().Duration() });
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe)
+    {
+        auto itPending = pendingParses_.find(fe.EventInstanceId());
+
+        auto itHeaderUnit = headerUnitPassIds_.find(fe.EventInstanceId());
+
+        if (itHeaderUnit != headerUnitPassIds_.end())
+        {
+            headerUnitPassIds_.erase(itHeaderUnit);
+
+            // The header of a header unit is only known from the input
+            // source path of the pass that created it.
+            if (fe.InputSourcePath())
+            {
+                HeaderInfo& header = headers_[FindHeader(
+                    MakeAbsolute(cl, fe.InputSourcePath()))];
+
+                header.IfcDuration += fe.Duration();
+                ++header.IfcCount;
+            }
+        }
+        else if (itPending != pendingParses_.end())
+        {
+            for (auto& parse : itPending->second)
+            {
+                HeaderInfo& header = headers_[parse.HeaderIndex];
+
+                // Headers with include guards are only parsed once per
+                // pass, but others may be parsed several times.
+                if (header.LastPassId != fe.EventInstanceId())
+                {
+                    ++header.InclusionCount;
+                    header.LastPassId = fe.EventInstanceId();
+                }
+
+                header.TextualDuration += parse.Duration;
+            }
+        }
+
+        if (itPending != pendingParses_.end()) {
+            pendingParses_.erase(itPending);
+        }
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        using namespace std::chrono;
+
+        std::vector<HeaderInfo*> sorted;
+
+        nanoseconds textualDuration{0};
+        unsigned long long headerUnitCount = 0;
+
+        for (auto& header : headers_)
+        {
+            if (header.IfcCount > 0) {
+                ++headerUnitCount;
+            }
+
+            if (header.InclusionCount == 0) {
+                continue;
+            }
+
+            Estimate(header);
+
+            textualDuration += header.TextualDuration;
+            sorted.push_back(&header);
+        }
+
+        size_t countToDump = std::min(sorted.size(), countToDump_);
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end(), [](const HeaderInfo* lhs, const HeaderInfo* rhs) {
+                return *lhs < *rhs;
+            });
+
+        if (report_.IsText())
+        {
+            std::cout << "Headers parsed textually: " << sorted.size() <<
+                " (" << duration_cast<milliseconds>(textualDuration).count() <<
+                " ms)\t Header units created: " << headerUnitCount <<
+                "\t Import cost: " << importCostPercent_ <<
+                "% of a textual parse\n\n";
+
+            std::cout << "Top " << countToDump << " headers by estimated "
+                "net savings of converting them to header units:\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i) {
+            PrintHeader(*sorted[i]);
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    // Importing a header unit is much cheaper than parsing the header,
+    // but isn't free, and the trace doesn't record how long it takes.
+    // It is estimated as a percentage of the time that a textual parse
+    // of the same header takes.
+    static const int DEFAULT_IMPORT_COST_PERCENT = 10;
+
+    // Converting a header to a header unit replaces all of its textual
+    // parses by a single creation of the header unit, plus an import by
+    // each translation unit that used to include it. The creation cost
+    // is the measured one when the build already creates a header unit
+    // from the header, and that of an average textual parse otherwise.
+    void Estimate(HeaderInfo& header)
+    {
+        using namespace std::chrono;
+
+        nanoseconds averageParse = header.TextualDuration /
+            static_cast<long long>(header.InclusionCount);
+
+        header.CreationEstimate = averageParse;
+
+        if (header.IfcCount > 0) {
+            header.CreationEstimate = header.IfcDuration /
+                static_cast<long long>(header.IfcCount);
+        }
+
+        header.ImportEstimate = header.TextualDuration *
+            importCostPercent_ / 100;
+
+        header.NetSavings = header.TextualDuration -
+            header.CreationEstimate - header.ImportEstimate;
+    }
+
+    void PrintHeader(const HeaderInfo& header)
+    {
+        using namespace std::chrono;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Header")
+                .Field("Path", header.Path)
+                .Field("NetSavingsMs", duration_cast<milliseconds>(
+                    header.NetSavings).count())
+                .Field("TextualMs", duration_cast<milliseconds>(
+                    header.TextualDuration).count())
+                .Field("InclusionCount", header.InclusionCount)
+                .Field("HasHeaderUnit", header.IfcCount > 0)
+                .Field("IfcMs", duration_cast<milliseconds>(
+                    header.IfcDuration).count())
+                .Field("CreationEstimateMs", duration_cast<milliseconds>(
+                    header.CreationEstimate).count())
+                .Field("ImportEstimateMs", duration_cast<milliseconds>(
+                    header.ImportEstimate).count())
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << header.Path << "\n";
+
+        std::cout << "    Net savings: " << duration_cast<milliseconds>(
+            header.NetSavings).count() << " ms\t textual: " <<
+            duration_cast<milliseconds>(header.TextualDuration).count() <<
+            " ms in " << header.InclusionCount << " passes\t creation: " <<
+            duration_cast<milliseconds>(header.CreationEstimate).count() <<
+            " ms" << (header.IfcCount > 0 ? " (measured)" : " (estimated)") <<
+            "\t imports: " << duration_cast<milliseconds>(
+                header.ImportEstimate).count() << " ms\n\n";
+    }
+
+    static std::string MakeAbsolute(const Invocation& invocation,
+        const wchar_t* path)
+    {
+        bool isAbsolute = path[0] == L'\\' || path[0] == L'/' ||
+            (path[0] != L'\0' && path[1] == L':');
+
+        if (isAbsolute) {
+            return ToUtf8(path);
+        }
+
+        std::wstring absolutePath = invocation.WorkingDirectory();
+
+        absolutePath += L'\\';
+        absolutePath += path;
+
+        return ToUtf8(absolutePath.c_str());
+    }
+
+    // Headers are identified by their lowercase path, with the separators
+    // made uniform, so that the textual includes of a header and the
+    // header unit created from it are joined.
+    size_t FindHeader(const std::string& path)
+    {
+        std::string key = path;
+
+        std::transform(key.begin(), key.end(), key.begin(),
+            [](unsigned char c) {
+                return c == '/' ? '\\' : static_cast<char>(std::tolower(c));
+            });
+
+        auto result = headerIndices_.try_emplace(std::move(key),
+            headers_.size());
+
+        if (result.second)
+        {
+            headers_.push_back(HeaderInfo{});
+            headers_.back().Path = path;
+        }
+
+        return result.first->second;
+    }
+
+    size_t countToDump_;
+    int importCostPercent_;
+
+    ReportWriter& report_;
+
+    MonotonicArena arena_;
+
+    HashMap<std::string, size_t> headerIndices_;
+
+    HashSet<unsigned long long> headerUnitPassIds_;
+
+    HashMap<unsigned long long, std::vector<PendingParse>> pendingParses_;
+
+    std::vector<HeaderInfo> headers_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int countToDump = 0;
+
+    if (argc >= 3) {
+        countToDump = std::atoi(argv[2]);
+    }
+
+    int importCostPercent = -1;
+
+    if (argc >= 4) {
+        importCostPercent = std::atoi(argv[3]);
+    }
+
+    HeaderUnitMigrationPlanner planner{ countToDump, importCostPercent,
+        report };
+
+    auto group = MakeStaticAnalyzerGroup(&planner);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+class LinkerBreakdown : public IAnalyzer
+{
+    // The time spent in one kind of activity directly under a linker,
+    // such as Pass1, Pass2 or LTCG.
+    struct ActivityTime
+    {
+        unsigned short EventId;
+        std::string Name;
+        std::chrono::nanoseconds Duration;
+
+        bool operator<(const ActivityTime& other) const {
+            return Duration > other.Duration;
+        }
+    };
+
+    struct LinkInfo
+    {
+        unsigned InvocationId;
+        std::string WorkingDirectory;
+        long long StartTimestamp;
+        long long StopTimestamp;
+        std::chrono::nanoseconds Duration;
+        std::vector<ActivityTime> Activities;
+
+        // Linkers started by this one, which happens when the linker
+        // restarts itself, for example to switch to the 64-bit toolset
+        // or when incremental linking fails.
+        unsigned RestartCount;
+        std::chrono::nanoseconds RestartedDuration;
+
+        // Wall time during which this link was the only invocation
+        // running in the build.
+        std::chrono::nanoseconds AloneTime;
+
+        bool operator<(const LinkInfo& other) const
+        {
+            if (AloneTime != other.AloneTime) {
+                return AloneTime > other.AloneTime;
+            }
+
+            return Duration > other.Duration;
+        }
+    };
+
+public:
+    LinkerBreakdown(int linkCountToDump, ReportWriter& report):
+        linkCountToDump_{linkCountToDump > 0 ?
+            static_cast<size_t>(linkCountToDump) : 10},
+        report_{report},
+        tickFrequency_{0},
+        buildStartTimestamp_{std::numeric_limits<long long>::max()},
+        buildStopTimestamp_{std::numeric_limits<long long>::min()},
+        lastCompilerStopTimestamp_{NO_TIMESTAMP},
+        activeLinks_{},
+        links_{},
+        invocationIntervals_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        size_t size = eventStack.Size();
+        unsigned short eventId = eventStack.Back().EventId();
+
+        if (eventId != EVENT_ID_LINKER && size >= 2 &&
+            eventStack[size - 2].EventId() == EVENT_ID_LINKER)
+        {
+            OnStopLinkerActivity(eventStack[size - 2], eventStack.Back());
+        }
+
+        switch (eventId)
+        {
+        case EVENT_ID_COMPILER:
+        case EVENT_ID_LINKER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &LinkerBreakdown::OnStopInvocation);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopLinkerActivity(const RawEvent& linker, const RawEvent& child)
+    {
+        std::vector<ActivityTime>& activities =
+            activeLinks_[linker.EventInstanceId()].Activities;
+
+        AddActivityTime(activities, child.EventId(), child.EventName(),
+            child.Duration());
+    }
+
+    void OnStopInvocation(InvocationGroup group)
+    {
+        const Invocation& invocation = group.Back();
+
+        // Invocations that were started by another one, like a linker
+        // started by CL or a linker that restarted itself, don't run in
+        // parallel with their parent.
+        if (group.Size() == 1)
+        {
+            tickFrequency_ = invocation.TickFrequency();
+
+            invocationIntervals_.emplace_back(invocation.StartTimestamp(),
+                invocation.StopTimestamp());
+
+            buildStartTimestamp_ = std::min(buildStartTimestamp_,
+                invocation.StartTimestamp());
+            buildStopTimestamp_ = std::max(buildStopTimestamp_,
+                invocation.StopTimestamp());
+
+            if (invocation.Type() == Invocation::Type::CL)
+            {
+                lastCompilerStopTimestamp_ = std::max(
+                    lastCompilerStopTimestamp_, invocation.StopTimestamp());
+            }
+        }
+
+        if (invocation.Type() != Invocation::Type::LINK) {
+            return;
+        }
+
+        LinkInfo link{};
+
+        auto it = activeLinks_.find(invocation.EventInstanceId());
+
+        if (it != activeLinks_.end())
+        {
+            link = std::move(it->second);
+            activeLinks_.erase(it);
+        }
+
+        link.InvocationId = invocation.InvocationId();
+        link.WorkingDirectory = ToUtf8(invocation.WorkingDirectory());
+        link.StartTimestamp = invocation.StartTimestamp();
+        link.StopTimestamp = invocation.StopTimestamp();
+        link.Duration = invocation.Duration();
+
+        size_t size = group.Size();
+
+        if (size >= 2 && group[size - 2].Type() == Invocation::Type::LINK)
+        {
+            // A restart: the work of the restarted linker is accounted
+            // for in the linker that started it.
+            LinkInfo& parent = activeLinks_[group[size - 2].EventInstanceId()];
+
+            parent.RestartCount += 1 + link.RestartCount;
+            parent.RestartedDuration += link.Duration;
+
+            for (auto& activity : link.Activities)
+            {
+                AddActivityTime(parent.Activities, activity.EventId,
+                    activity.Name.c_str(), activity.Duration);
+            }
+
+            return;
+        }
+
+        links_.push_back(std::move(link));
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        ComputeAloneTimes();
+
+        PrintSummary();
+
+        size_t countToDump = std::min(links_.size(), linkCountToDump_);
+
+        std::partial_sort(links_.begin(), links_.begin() + countToDump,
+            links_.end());
+
+        if (report_.IsText())
+        {
+            std::cout << "\nTop " << countToDump <<
+                " link invocations by time spent running alone:\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i) {
+            PrintLink(links_[i]);
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    static const long long NO_TIMESTAMP =
+        std::numeric_limits<long long>::min();
+
+    static void AddActivityTime(std::vector<ActivityTime>& activities,
+        unsigned short eventId, const char* name,
+        std::chrono::nanoseconds duration)
+    {
+        // There are only a handful of kinds of linker activities, so a
+        // linear search is faster than a hash table.
+        for (auto& activity : activities)
+        {
+            if (activity.EventId == eventId)
+            {
+                activity.Duration += duration;
+                return;
+            }
+        }
+
+        activities.push_back({ eventId, name ? name : "", duration });
+    }
+
+    static std::chrono::nanoseconds TicksToNanoseconds(long long ticks,
+        long long tickFrequency)
+    {
+        if (tickFrequency <= 0) {
+            return std::chrono::nanoseconds{0};
+        }
+
+        return std::chrono::nanoseconds{static_cast<long long>(
+            static_cast<double>(ticks) * 1000000000. / tickFrequency)};
+    }
+
+    // Sweeps over the start and stop timestamps of all top-level
+    // invocations to find the periods during which only one of them
+    // was running, and then intersects each link with these periods.
+    void ComputeAloneTimes()
+    {
+        std::vector<std::pair<long long, int>> edges;
+
+        edges.reserve(invocationIntervals_.size() * 2);
+
+        for (auto& interval : invocationIntervals_)
+        {
+            edges.emplace_back(interval.first, 1);
+            edges.emplace_back(interval.second, -1);
+        }
+
+        // Stops sort before starts at the same timestamp so that
+        // back-to-back invocations don't count as overlapping.
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<std::pair<long long, long long>> aloneIntervals;
+
+        long long previousTimestamp = 0;
+        int concurrency = 0;
+
+        for (auto& edge : edges)
+        {
+            if (concurrency == 1 && edge.first > previousTimestamp) {
+                aloneIntervals.emplace_back(previousTimestamp, edge.first);
+            }
+
+            concurrency += edge.second;
+            previousTimestamp = edge.first;
+        }
+
+        for (auto& link : links_)
+        {
+            long long aloneTicks = 0;
+
+            // Alone intervals are sorted and disjoint: start with the
+            // first one that ends after the link starts.
+            auto it = std::upper_bound(aloneIntervals.begin(),
+                aloneIntervals.end(), link.StartTimestamp,
+                [](long long timestamp,
+                    const std::pair<long long, long long>& interval) {
+                    return timestamp < interval.second;
+                });
+
+            for (; it != aloneIntervals.end() &&
+                it->first < link.StopTimestamp; ++it)
+            {
+                aloneTicks += std::min(it->second, link.StopTimestamp) -
+                    std::max(it->first, link.StartTimestamp);
+            }
+
+            link.AloneTime = TicksToNanoseconds(aloneTicks, tickFrequency_);
+        }
+    }
+
+    void PrintSummary()
+    {
+        using namespace std::chrono;
+
+        nanoseconds wallTime{0};
+        nanoseconds linkTime{0};
+        nanoseconds linkAloneTime{0};
+        nanoseconds tailTime{0};
+
+        if (!invocationIntervals_.empty())
+        {
+            wallTime = TicksToNanoseconds(
+                buildStopTimestamp_ - buildStartTimestamp_, tickFrequency_);
+
+            // Whatever runs after the last compiler invocation is only
+            // linking, and adds directly to the build time.
+            if (lastCompilerStopTimestamp_ != NO_TIMESTAMP &&
+                lastCompilerStopTimestamp_ < buildStopTimestamp_)
+            {
+                tailTime = TicksToNanoseconds(
+                    buildStopTimestamp_ - lastCompilerStopTimestamp_,
+                    tickFrequency_);
+            }
+        }
+
+        unsigned long long restartCount = 0;
+
+        for (auto& link : links_)
+        {
+            linkTime += link.Duration;
+            linkAloneTime += link.AloneTime;
+            restartCount += link.RestartCount;
+        }
+
+        double alonePercent = wallTime.count() == 0 ? 0. :
+            static_cast<double>(linkAloneTime.count()) /
+                wallTime.count() * 100.;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Summary")
+                .Field("LinkCount", links_.size())
+                .Field("RestartCount", restartCount)
+                .Field("WallTimeMs", duration_cast<milliseconds>(
+                    wallTime).count())
+                .Field("LinkTimeMs", duration_cast<milliseconds>(
+                    linkTime).count())
+                .Field("LinkAloneTimeMs", duration_cast<milliseconds>(
+                    linkAloneTime).count())
+                .Field("LinkAlonePercent", alonePercent)
+                .Field("LinkTailTimeMs", duration_cast<milliseconds>(
+                    tailTime).count())
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << "Build wall time: " <<
+            duration_cast<milliseconds>(wallTime).count() << " ms\n";
+
+        std::cout << "Link invocations: " << links_.size() <<
+            " (" << restartCount << " restarts), " <<
+            duration_cast<milliseconds>(linkTime).count() << " ms in total\n";
+
+        std::cout << "Wall time during which a linker was the only "
+            "invocation running: " <<
+            duration_cast<milliseconds>(linkAloneTime).count() << " ms (" <<
+            std::fixed << std::setprecision(1) << alonePercent << "%)\n";
+
+        std::cout << "Wall time spent linking after the last compiler "
+            "invocation: " << duration_cast<milliseconds>(tailTime).count() <<
+            " ms\n";
+    }
+
+    void PrintLink(LinkInfo& link)
+    {
+        using namespace std::chrono;
+
+        std::sort(link.Activities.begin(), link.Activities.end());
+
+        nanoseconds activityTime{0};
+
+        for (auto& activity : link.Activities) {
+            activityTime += activity.Duration;
+        }
+
+        // Time of the linker that is not covered by any of its
+        // activities, including the time before a restart.
+        nanoseconds otherTime = std::max(link.Duration - activityTime,
+            nanoseconds{0});
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Link")
+                .Field("InvocationId", link.InvocationId)
+                .Field("DurationMs", duration_cast<milliseconds>(
+                    link.Duration).count())
+                .Field("AloneTimeMs", duration_cast<milliseconds>(
+                    link.AloneTime).count())
+                .Field("RestartCount", link.RestartCount)
+                .Field("RestartedDurationMs", duration_cast<milliseconds>(
+                    link.RestartedDuration).count())
+                .Field("OtherMs", duration_cast<milliseconds>(
+                    otherTime).count())
+                .Field("WorkingDirectory", link.WorkingDirectory)
+                .EndRecord();
+
+            for (auto& activity : link.Activities)
+            {
+                report_.BeginRecord("LinkActivity")
+                    .Field("InvocationId", link.InvocationId)
+                    .Field("Name", activity.Name)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        activity.Duration).count())
+                    .EndRecord();
+            }
+
+            return;
+        }
+
+        std::cout << "\nLink " << link.InvocationId << "\t Duration: " <<
+            duration_cast<milliseconds>(link.Duration).count() << " ms" <<
+            "\t Alone: " <<
+            duration_cast<milliseconds>(link.AloneTime).count() << " ms";
+
+        if (link.RestartCount)
+        {
+            std::cout << "\t Restarts: " << link.RestartCount << " (" <<
+                duration_cast<milliseconds>(
+                    link.Duration - link.RestartedDuration).count() <<
+                " ms before restarting)";
+        }
+
+        std::cout << "\t " << link.WorkingDirectory << "\n";
+
+        for (auto& activity : link.Activities) {
+            PrintActivity(activity.Name.c_str(), activity.Duration,
+                link.Duration);
+        }
+
+        PrintActivity("Other", otherTime, link.Duration);
+    }
+
+    static void PrintActivity(const char* name,
+        std::chrono::nanoseconds duration, std::chrono::nanoseconds total)
+    {
+        using namespace std::chrono;
+
+        double percent = total.count() == 0 ? 0. :
+            static_cast<double>(duration.count()) / total.count() * 100.;
+
+        std::cout << "    " << std::left << std::setw(28) << name <<
+            std::right << std::setw(10) <<
+            duration_cast<milliseconds>(duration).count() << " ms  (" <<
+            std::fixed << std::setprecision(1) << percent << "%)\n";
+    }
+
+    size_t linkCountToDump_;
+
+    ReportWriter& report_;
+
+    long long tickFrequency_;
+
+    long long buildStartTimestamp_;
+    long long buildStopTimestamp_;
+    long long lastCompilerStopTimestamp_;
+
+    // Maps linkers that are still running to what is known about them
+    // so far: their activities and restarts.
+    std::unordered_map<unsigned long long, LinkInfo> activeLinks_;
+
+    std::vector<LinkInfo> links_;
+
+    // Start and stop timestamps of all top-level invocations.
+    std::vector<std::pair<long long, long long>> invocationIntervals_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int linkCountToDump = 0;
+
+    if (argc >= 3) {
+        linkCountToDump = std::atoi(argv[2]);
+    }
+
+    LinkerBreakdown lb{ linkCountToDump, report };
+
+    auto group = MakeStaticAnalyzerGroup(&lb);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
@@ -1,52 +1,473 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <CppBuildInsights.hpp>
+#include "../Common/FunctionGroups.hpp"
+#include "../Common/NamePool.hpp"
+#include "../Common/ReportWriter.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
 
 class LongCodeGenFinder : public IAnalyzer
 {
+    struct LongFunction
+    {
+        uint32_t NameId;
+        std::chrono::milliseconds Duration;
+        unsigned InvocationId;
+
+        bool operator<(const LongFunction& other) const {
+            return Duration > other.Duration;
+        }
+    };
+
+    struct InvocationInfo
+    {
+        unsigned InvocationId;
+        bool IsCompiler;
+        size_t LongFunctionCount;
+        std::chrono::milliseconds LongFunctionDuration;
+        std::vector<LongFunction> TopFunctions;
+
+        bool operator<(const InvocationInfo& other) const {
+            return LongFunctionDuration > other.LongFunctionDuration;
+        }
+    };
+
+    // A counter of the Space-Saving heavy hitter sketch. Count is an
+    // upper bound of the number of times the function was slow, and
+    // Count - Error is a lower bound.
+    struct HeavyHitter
+    {
+        uint32_t NameId;
+        unsigned long long Count;
+        unsigned long long Error;
+        std::chrono::milliseconds TotalDuration;
+
+        bool operator<(const HeavyHitter& other) const {
+            return Count > other.Count;
+        }
+    };
+
 public:
+    LongCodeGenFinder(int functionCountToDump,
+        const NameOptions& nameOptions, ReportWriter& report):
+        report_{report},
+        functionCountToDump_{functionCountToDump > 0 ?
+            static_cast<size_t>(functionCountToDump) : 10},
+        nameOptions_{nameOptions},
+        namePool_{},
+        nextCompactionCount_{MIN_COMPACTION_COUNT},
+        functionGroups_{ static_cast<unsigned>(
+            std::max(nameOptions.GroupDepth, 0)) },
+        activeInvocations_{},
+        topFunctions_{},
+        topInvocations_{},
+        heavyHitters_{},
+        heavyHitterIndices_{}
+    {}
+
     // Called by the analysis driver every time an activity stop event
-    // is seen in the trace. 
+    // is seen in the trace.
     AnalysisControl OnStopActivity(const EventStack& eventStack) override
     {
         // This will check whether the event stack matches
-        // TopFunctionsFinder::CheckForTopFunction's signature.
+        // LongCodeGenFinder::CheckForLongFunctionCodeGen's signature.
         // If it does, it will forward the event to the function.
 
-        MatchEventStackInMemberFunction(eventStack, this, 
+        MatchEventStackInMemberFunction(eventStack, this,
             &LongCodeGenFinder::CheckForLongFunctionCodeGen);
 
+        MatchEventStackInMemberFunction(eventStack, this,
+            &LongCodeGenFinder::OnStopInvocation);
+
         // Tells the analysis driver to proceed to the next event
 
         return AnalysisControl::CONTINUE;
     }
 
-    // This function is used to capture Function activity events that are 
-    // within a CodeGeneration activity, and to print a list of functions 
-    // that take more than 500 milliseconds to generate.
+    // This function is used to capture Function activity events that are
+    // within a CodeGeneration activity, and to keep track of functions
+    // that take more than 500 milliseconds to generate. Only the longest
+    // ones are kept, so memory usage doesn't depend on the build size.
+    // When grouping, every function counts towards its group.
 
-    void CheckForLongFunctionCodeGen(CodeGeneration cg, Function f)
+    void CheckForLongFunctionCodeGen(Invocation invocation,
+        CodeGeneration cg, Function f)
     {
         using namespace std::chrono;
 
+        if (nameOptions_.GroupDepth >= 0) {
+            functionGroups_.Add(f.Name(), duration_cast<nanoseconds>(
+                f.Duration()));
+        }
+
         if (f.Duration() < milliseconds(500)) {
             return;
         }
 
-        std::cout << "Duration: " << duration_cast<milliseconds>(
-            f.Duration()).count();
+        milliseconds duration = duration_cast<milliseconds>(f.Duration());
+
+        auto result = activeInvocations_.try_emplace(
+            invocation.EventInstanceId(), InvocationInfo{});
+
+        InvocationInfo& info = result.first->second;
 
-        std::cout << "\t Function Name: " << f.Name() << std::endl;
+        if (result.second)
+        {
+            info.InvocationId = invocation.InvocationId();
+            info.IsCompiler = invocation.Type() == Invocation::Type::CL;
+        }
+
+        ++info.LongFunctionCount;
+        info.LongFunctionDuration += duration;
+
+        // The name is only read once, and every structure below refers
+        // to it by id.
+        uint32_t nameId = namePool_.Intern(f.Name());
+
+        PushBounded(info.TopFunctions, functionCountToDump_,
+            nameId, duration, info.InvocationId);
+
+        PushBounded(topFunctions_, functionCountToDump_,
+            nameId, duration, info.InvocationId);
+
+        CountHeavyHitter(nameId, duration);
+
+        CompactNamePool();
     }
+
+    void OnStopInvocation(Invocation invocation)
+    {
+        auto it = activeInvocations_.find(invocation.EventInstanceId());
+
+        if (it == activeInvocations_.end()) {
+            return;
+        }
+
+        AddTopInvocation(std::move(it->second));
+
+        activeInvocations_.erase(it);
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        // Invocations that never stopped in the trace still count.
+        for (auto& p : activeInvocations_) {
+            AddTopInvocation(std::move(p.second));
+        }
+
+        activeInvocations_.clear();
+
+        std::sort_heap(topFunctions_.begin(), topFunctions_.end());
+        std::sort_heap(topInvocations_.begin(), topInvocations_.end());
+
+        if (report_.IsText())
+        {
+            std::cout << "Top " << topFunctions_.size() <<
+                " functions that take more than 500 ms to generate:\n\n";
+        }
+
+        for (auto& f : topFunctions_) {
+            PrintFunction("Function", f);
+        }
+
+        if (report_.IsText())
+        {
+            std::cout << "\nTop " << topInvocations_.size() <<
+                " invocations by long function generation time:\n";
+        }
+
+        for (auto& info : topInvocations_)
+        {
+            std::sort_heap(info.TopFunctions.begin(),
+                info.TopFunctions.end());
+
+            if (report_.IsText())
+            {
+                std::cout << "\n" << (info.IsCompiler ? "CL " : "Link ") <<
+                    info.InvocationId << "\t Duration: " <<
+                    info.LongFunctionDuration.count() << " ms" <<
+                    "\t Long Functions: " << info.LongFunctionCount << "\n";
+            }
+            else
+            {
+                report_.BeginRecord("Invocation")
+                    .Field("Tool", info.IsCompiler ? "CL" : "Link")
+                    .Field("InvocationId", info.InvocationId)
+                    .Field("DurationMs", info.LongFunctionDuration.count())
+                    .Field("LongFunctionCount", info.LongFunctionCount)
+                    .EndRecord();
+            }
+
+            for (auto& f : info.TopFunctions) {
+                PrintFunction("InvocationFunction", f);
+            }
+        }
+
+        PrintHeavyHitters();
+
+        if (nameOptions_.GroupDepth >= 0) {
+            functionGroups_.Print(report_, functionCountToDump_,
+                nameOptions_);
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    // Keeps the longest functions in a heap whose front is the shortest
+    // one, so that it can be evicted cheaply.
+    static void PushBounded(std::vector<LongFunction>& heap, size_t capacity,
+        uint32_t nameId, std::chrono::milliseconds duration,
+        unsigned invocationId)
+    {
+        if (heap.size() >= capacity)
+        {
+            if (duration <= heap.front().Duration) {
+                return;
+            }
+
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+
+        heap.push_back({ nameId, duration, invocationId });
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    void AddTopInvocation(InvocationInfo&& info)
+    {
+        if (topInvocations_.size() < functionCountToDump_ ||
+            info.LongFunctionDuration >
+                topInvocations_.front().LongFunctionDuration)
+        {
+            topInvocations_.push_back(std::move(info));
+            std::push_heap(topInvocations_.begin(), topInvocations_.end());
+
+            if (topInvocations_.size() > functionCountToDump_)
+            {
+                std::pop_heap(topInvocations_.begin(),
+                    topInvocations_.end());
+                topInvocations_.pop_back();
+            }
+        }
+    }
+
+    // Space-Saving: when a name is not tracked and all counters are in
+    // use, the counter with the smallest count is given to the new name.
+    void CountHeavyHitter(uint32_t nameId,
+        std::chrono::milliseconds duration)
+    {
+        auto it = heavyHitterIndices_.find(nameId);
+
+        if (it != heavyHitterIndices_.end())
+        {
+            HeavyHitter& hh = heavyHitters_[it->second];
+
+            ++hh.Count;
+            hh.TotalDuration += duration;
+            return;
+        }
+
+        if (heavyHitters_.size() < HEAVY_HITTER_CAPACITY)
+        {
+            heavyHitterIndices_.emplace(nameId, heavyHitters_.size());
+            heavyHitters_.push_back({ nameId, 1, 0, duration });
+            return;
+        }
+
+        auto itMin = std::min_element(heavyHitters_.begin(),
+            heavyHitters_.end(), [](const HeavyHitter& a,
+                const HeavyHitter& b) { return a.Count < b.Count; });
+
+        heavyHitterIndices_.erase(itMin->NameId);
+        heavyHitterIndices_.emplace(nameId,
+            static_cast<size_t>(itMin - heavyHitters_.begin()));
+
+        itMin->Error = itMin->Count;
+        itMin->Count = itMin->Count + 1;
+        itMin->TotalDuration = duration;
+        itMin->NameId = nameId;
+    }
+
+    // The names of functions that were evicted from the heaps and from
+    // the sketch stay in the pool until it is compacted. Compacting it
+    // every time it doubles in size keeps its size proportional to the
+    // number of names still in use, at an amortized constant cost.
+    void CompactNamePool()
+    {
+        if (namePool_.Count() < nextCompactionCount_) {
+            return;
+        }
+
+        namePool_.Compact([this](auto update)
+        {
+            for (auto& f : topFunctions_) {
+                update(f.NameId);
+            }
+
+            for (auto& p : activeInvocations_)
+            {
+                for (auto& f : p.second.TopFunctions) {
+                    update(f.NameId);
+                }
+            }
+
+            for (auto& info : topInvocations_)
+            {
+                for (auto& f : info.TopFunctions) {
+                    update(f.NameId);
+                }
+            }
+
+            for (auto& hh : heavyHitters_) {
+                update(hh.NameId);
+            }
+        });
+
+        heavyHitterIndices_.clear();
+
+        for (size_t i = 0; i < heavyHitters_.size(); ++i) {
+            heavyHitterIndices_.emplace(heavyHitters_[i].NameId, i);
+        }
+
+        nextCompactionCount_ = std::max(MIN_COMPACTION_COUNT,
+            2 * namePool_.Count());
+    }
+
+    void PrintFunction(const char* recordType, const LongFunction& f)
+    {
+        if (!report_.IsText())
+        {
+            report_.BeginRecord(recordType)
+                .Field("InvocationId", f.InvocationId)
+                .Field("DurationMs", f.Duration.count())
+                .Field("Name", FormatName(namePool_.Name(f.NameId),
+                    nameOptions_))
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << "Duration: " << f.Duration.count();
+
+        std::cout << "\t Function Name: " <<
+            FormatName(namePool_.Name(f.NameId), nameOptions_) << "\n";
+    }
+
+    void PrintHeavyHitters()
+    {
+        std::vector<HeavyHitter> sorted;
+
+        for (auto& hh : heavyHitters_)
+        {
+            // Only report functions that are guaranteed to have been
+            // slow in more than one place.
+            if (hh.Count - hh.Error >= 2) {
+                sorted.push_back(hh);
+            }
+        }
+
+        size_t countToDump = std::min(sorted.size(), functionCountToDump_);
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end());
+
+        if (report_.IsText())
+        {
+            std::cout << "\nTop " << countToDump <<
+                " functions that are repeatedly slow to generate:\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const HeavyHitter& hh = sorted[i];
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("RepeatedFunction")
+                    .Field("MinCount", hh.Count - hh.Error)
+                    .Field("MaxCount", hh.Count)
+                    .Field("DurationMs", hh.TotalDuration.count())
+                    .Field("Name", FormatName(namePool_.Name(hh.NameId),
+                        nameOptions_))
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Count: " << hh.Count - hh.Error;
+
+            if (hh.Error) {
+                std::cout << "-" << hh.Count;
+            }
+
+            std::cout << "\t Duration: " << hh.TotalDuration.count();
+            std::cout << "\t Function Name: " <<
+                FormatName(namePool_.Name(hh.NameId), nameOptions_) << "\n";
+        }
+    }
+
+    static constexpr size_t HEAVY_HITTER_CAPACITY = 4096;
+
+    static constexpr size_t MIN_COMPACTION_COUNT = 2 * HEAVY_HITTER_CAPACITY;
+
+    ReportWriter& report_;
+
+    size_t functionCountToDump_;
+
+    NameOptions nameOptions_;
+
+    // Names of the functions referenced below.
+    NamePool namePool_;
+
+    size_t nextCompactionCount_;
+
+    // Code generation time of all functions, by normalized name.
+    FunctionGroups functionGroups_;
+
+    // Invocations that are still running, along with their longest
+    // functions so far.
+    std::unordered_map<unsigned long long,
+        InvocationInfo> activeInvocations_;
+
+    std::vector<LongFunction> topFunctions_;
+
+    std::vector<InvocationInfo> topInvocations_;
+
+    std::vector<HeavyHitter> heavyHitters_;
+
+    std::unordered_map<uint32_t, size_t> heavyHitterIndices_;
 };
 
 int main(int argc, char *argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    NameOptions nameOptions;
+
+    if (!ParseNameOptions(argc, argv, nameOptions)) return -1;
+
     if (argc <= 1) return -1;
 
-    LongCodeGenFinder lcgf;
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int functionCountToDump = 0;
+
+    if (argc >= 3) {
+        functionCountToDump = std::atoi(argv[2]);
+    }
+
+    LongCodeGenFinder lcgf{ functionCountToDump, nameOptions, report };
 
     // Let's make a group of analyzers that will receive
     // events in the trace. We only have one; easy!
@@ -55,4 +476,4 @@ int main(int argc, char *argv[])
     // argv[1] should contain the path to a trace file
     int numberOfPasses = 1;
     return Analyze(argv[1], numberOfPasses, group);
-}
\ No newline at end of file
+}
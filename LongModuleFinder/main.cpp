@@ -2,9 +2,9 @@
 #include <iomanip>
 #include <iostream>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
 #include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
@@ -24,9 +24,11 @@ class LongModuleFinder : public IAnalyzer
     };
 
 public:
-    LongModuleFinder() :
-        cachedFrontEndPassIds_{},
-        FrontEndPassData_{}
+    LongModuleFinder(ReportWriter& report) :
+        report_{report},
+        arena_{},
+        cachedFrontEndPassIds_{ arena_ },
+        FrontEndPassData_{ arena_ }
     {}
 
     AnalysisControl OnBeginAnalysisPass() override
@@ -93,26 +95,48 @@ public:
 
         for (auto& frontEndPassData : sortedFrontEndPassData)
         {
-            std::cout << "File Name: ";
-            std::wcout << frontEndPassData.Name;
-            std::cout << "\t\tCL Invocation " << frontEndPassData.InvocationId << "\t\tDuration: " << frontEndPassData.Duration << " s " << std::endl;
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("FrontEndPass")
+                    .Field("File", frontEndPassData.Name)
+                    .Field("InvocationId", frontEndPassData.InvocationId)
+                    .Field("DurationSeconds", frontEndPassData.Duration)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "File Name: " << ToUtf8(frontEndPassData.Name.c_str());
+            std::cout << "\t\tCL Invocation " << frontEndPassData.InvocationId << "\t\tDuration: " << frontEndPassData.Duration << " s \n";
         }
 
         return AnalysisControl::CONTINUE;
     }
 
 private:
-    std::unordered_set<unsigned long long> cachedFrontEndPassIds_;
+    ReportWriter& report_;
 
-    std::unordered_map<unsigned long long,
+    MonotonicArena arena_;
+
+    HashSet<unsigned long long> cachedFrontEndPassIds_;
+
+    HashMap<unsigned long long,
         FrontEndPassData> FrontEndPassData_;
 };
 
 int main(int argc, char* argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
     if (argc <= 1) return -1;
 
-    LongModuleFinder lmf;
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    LongModuleFinder lmf{ report };
 
     auto group = MakeStaticAnalyzerGroup(&lmf);
 
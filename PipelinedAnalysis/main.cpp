@@ -0,0 +1,713 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/NamePool.hpp"
+#include "../Common/ReportWriter.hpp"
+#include "../Common/SpscRing.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+// An activity, reduced to what the record analyses need. Records are
+// copied into the rings, so they are kept small.
+struct EventRecord
+{
+    uint64_t InstanceId;
+    int64_t StartTimestamp;
+    int64_t StopTimestamp;
+    uint32_t NameId;
+    uint16_t EventId;
+};
+
+// The strings referenced by records. They are only written by the
+// producer, and only read by the analyses once the producer is done.
+struct RecordNames
+{
+    NamePool Names;
+    std::unordered_map<uint16_t, uint32_t> EventNameIds;
+    long long TickFrequency = 0;
+
+    long long TicksToMilliseconds(int64_t ticks) const
+    {
+        return TickFrequency <= 0 ? 0 : static_cast<long long>(
+            static_cast<double>(ticks) * 1000. / TickFrequency);
+    }
+};
+
+// An analysis that runs on records instead of on the event stacks of the
+// SDK, so that it can run on a thread other than the one decoding the
+// trace.
+class RecordAnalysis
+{
+public:
+    RecordAnalysis():
+        recordCount_{0},
+        totalTicks_{0}
+    {}
+
+    virtual ~RecordAnalysis() {}
+
+    void OnRecord(const EventRecord& record)
+    {
+        ++recordCount_;
+        totalTicks_ += record.StopTimestamp - record.StartTimestamp;
+
+        Process(record);
+    }
+
+    // Used to check that each analysis saw the same records in every
+    // run.
+    unsigned long long RecordCount() const {
+        return recordCount_;
+    }
+
+    int64_t TotalTicks() const {
+        return totalTicks_;
+    }
+
+    virtual void Print(const RecordNames& names, size_t countToDump,
+        ReportWriter& report) = 0;
+
+protected:
+    virtual void Process(const EventRecord& record) = 0;
+
+private:
+    unsigned long long recordCount_;
+    int64_t totalTicks_;
+};
+
+// The count and aggregated duration of each kind of activity.
+class ActivitySummary : public RecordAnalysis
+{
+    struct EventKindInfo
+    {
+        uint16_t EventId;
+        size_t Count;
+        int64_t TotalTicks;
+
+        bool operator<(const EventKindInfo& other) const {
+            return TotalTicks > other.TotalTicks;
+        }
+    };
+
+public:
+    ActivitySummary():
+        arena_{},
+        kinds_{ arena_ }
+    {}
+
+    void Print(const RecordNames& names, size_t countToDump,
+        ReportWriter& report) override
+    {
+        std::vector<EventKindInfo> sorted;
+
+        for (auto& p : kinds_) {
+            sorted.push_back(p.second);
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+
+        if (report.IsText()) {
+            std::cout << "\nActivities:\n\n";
+        }
+
+        for (auto& info : sorted)
+        {
+            auto it = names.EventNameIds.find(info.EventId);
+
+            const char* name = it == names.EventNameIds.end() ? "" :
+                names.Names.Name(it->second);
+
+            long long durationMs = names.TicksToMilliseconds(info.TotalTicks);
+
+            if (!report.IsText())
+            {
+                report.BeginRecord("Activity")
+                    .Field("Name", name)
+                    .Field("Count", info.Count)
+                    .Field("DurationMs", durationMs)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Count: " << info.Count << "\t Duration: " <<
+                durationMs << " ms\t Name: " << name << "\n";
+        }
+    }
+
+protected:
+    void Process(const EventRecord& record) override
+    {
+        EventKindInfo& info = kinds_[record.EventId];
+
+        info.EventId = record.EventId;
+        ++info.Count;
+        info.TotalTicks += record.StopTimestamp - record.StartTimestamp;
+    }
+
+private:
+    MonotonicArena arena_;
+
+    HashMap<uint16_t, EventKindInfo> kinds_;
+};
+
+// The names, of activities of a given kind, with the longest aggregated
+// duration. For example, the files with the longest parsing time.
+class TopNames : public RecordAnalysis
+{
+    struct NamedDuration
+    {
+        uint32_t NameId;
+        size_t Count;
+        int64_t TotalTicks;
+
+        bool operator<(const NamedDuration& other) const {
+            return TotalTicks > other.TotalTicks;
+        }
+    };
+
+public:
+    TopNames(uint16_t eventId, const char* recordType, const char* title):
+        eventId_{eventId},
+        recordType_{recordType},
+        title_{title},
+        arena_{},
+        durations_{ arena_ }
+    {}
+
+    void Print(const RecordNames& names, size_t countToDump,
+        ReportWriter& report) override
+    {
+        std::vector<NamedDuration> sorted;
+
+        for (auto& p : durations_) {
+            sorted.push_back(p.second);
+        }
+
+        countToDump = std::min(sorted.size(), countToDump);
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end());
+
+        if (report.IsText()) {
+            std::cout << "\nTop " << countToDump << " " << title_ << ":\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const NamedDuration& entry = sorted[i];
+
+            long long durationMs = names.TicksToMilliseconds(entry.TotalTicks);
+
+            if (!report.IsText())
+            {
+                report.BeginRecord(recordType_)
+                    .Field("Count", entry.Count)
+                    .Field("DurationMs", durationMs)
+                    .Field("Name", names.Names.Name(entry.NameId))
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Count: " << entry.Count << "\t Duration: " <<
+                durationMs << " ms\t Name: " <<
+                names.Names.Name(entry.NameId) << "\n";
+        }
+    }
+
+protected:
+    void Process(const EventRecord& record) override
+    {
+        if (record.EventId != eventId_) {
+            return;
+        }
+
+        NamedDuration& entry = durations_[record.NameId];
+
+        entry.NameId = record.NameId;
+        ++entry.Count;
+        entry.TotalTicks += record.StopTimestamp - record.StartTimestamp;
+    }
+
+private:
+    uint16_t eventId_;
+    const char* recordType_;
+    const char* title_;
+
+    MonotonicArena arena_;
+
+    HashMap<uint32_t, NamedDuration> durations_;
+};
+
+// Delivers the records of a producer to the analyses. Serially, each
+// record is processed by every analysis before the producer continues.
+// Pipelined, each analysis runs on its own thread and is fed through its
+// own ring, so that producing records (decoding the trace) and each
+// analysis all overlap.
+class Pipeline
+{
+public:
+    Pipeline(const std::vector<RecordAnalysis*>& analyses, bool isPipelined):
+        analyses_{analyses},
+        isPipelined_{isPipelined},
+        rings_{},
+        threads_{},
+        recordCount_{0}
+    {}
+
+    ~Pipeline() {
+        Finish();
+    }
+
+    void Start()
+    {
+        if (!isPipelined_) {
+            return;
+        }
+
+        for (RecordAnalysis* analysis : analyses_)
+        {
+            rings_.push_back(std::make_unique<SpscRing<EventRecord>>(
+                RING_CAPACITY));
+
+            SpscRing<EventRecord>* ring = rings_.back().get();
+
+            threads_.emplace_back([ring, analysis]() {
+                EventRecord record;
+
+                while (ring->Pop(record)) {
+                    analysis->OnRecord(record);
+                }
+            });
+        }
+    }
+
+    void Publish(const EventRecord& record)
+    {
+        ++recordCount_;
+
+        if (!isPipelined_)
+        {
+            for (RecordAnalysis* analysis : analyses_) {
+                analysis->OnRecord(record);
+            }
+
+            return;
+        }
+
+        for (auto& ring : rings_) {
+            ring->Push(record);
+        }
+    }
+
+    // Waits for the analyses to process all the published records.
+    void Finish()
+    {
+        for (auto& ring : rings_) {
+            ring->Close();
+        }
+
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+
+        rings_.clear();
+        threads_.clear();
+    }
+
+    unsigned long long RecordCount() const {
+        return recordCount_;
+    }
+
+private:
+    static const size_t RING_CAPACITY = 64 * 1024;
+
+    std::vector<RecordAnalysis*> analyses_;
+    bool isPipelined_;
+
+    std::vector<std::unique_ptr<SpscRing<EventRecord>>> rings_;
+    std::vector<std::thread> threads_;
+
+    unsigned long long recordCount_;
+};
+
+// Produces a record for each activity of a trace, as the SDK decodes it.
+class TraceRecordProducer : public IAnalyzer
+{
+public:
+    TraceRecordProducer(RecordNames& names, Pipeline& pipeline):
+        names_{names},
+        pipeline_{pipeline},
+        pendingNameId_{0}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        auto& e = eventStack.Back();
+
+        pendingNameId_ = 0;
+
+        switch (e.EventId())
+        {
+        case EVENT_ID_FUNCTION:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceRecordProducer::OnFunction);
+            break;
+
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &TraceRecordProducer::OnFrontEndFile);
+            break;
+
+        default:
+            break;
+        }
+
+        uint16_t eventId = static_cast<uint16_t>(e.EventId());
+
+        if (names_.EventNameIds.find(eventId) == names_.EventNameIds.end()) {
+            names_.EventNameIds[eventId] = names_.Names.Intern(e.EventName());
+        }
+
+        names_.TickFrequency = e.TickFrequency();
+
+        pipeline_.Publish({ e.EventInstanceId(), e.StartTimestamp(),
+            e.StopTimestamp(), pendingNameId_, eventId });
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnFunction(Function f) {
+        pendingNameId_ = names_.Names.Intern(f.Name());
+    }
+
+    void OnFrontEndFile(FrontEndFile file) {
+        pendingNameId_ = names_.Names.Intern(file.Path());
+    }
+
+private:
+    RecordNames& names_;
+    Pipeline& pipeline_;
+
+    uint32_t pendingNameId_;
+};
+
+// Produces records with the same mix of activities as a typical trace,
+// without decoding one. Producing them costs much less than decoding, so
+// this measures the overhead of the pipeline itself.
+class SyntheticRecordProducer
+{
+public:
+    SyntheticRecordProducer(unsigned long long recordCount,
+        RecordNames& names):
+        recordCount_{recordCount},
+        fileNameIds_{},
+        functionNameIds_{},
+        state_{0x9E3779B97F4A7C15ull}
+    {
+        names.TickFrequency = TICK_FREQUENCY;
+
+        names.EventNameIds[EVENT_ID_FRONT_END_FILE] =
+            names.Names.Intern("FrontEndFile");
+        names.EventNameIds[EVENT_ID_FUNCTION] =
+            names.Names.Intern("Function");
+        names.EventNameIds[EVENT_ID_FRONT_END_PASS] =
+            names.Names.Intern("FrontEndPass");
+
+        for (size_t i = 0; i < FILE_COUNT; ++i)
+        {
+            std::string name = "synthetic\\header" + std::to_string(i) + ".h";
+            fileNameIds_.push_back(names.Names.Intern(name.c_str()));
+        }
+
+        for (size_t i = 0; i < FUNCTION_COUNT; ++i)
+        {
+            std::string name = "synthetic::function" + std::to_string(i);
+            functionNameIds_.push_back(names.Names.Intern(name.c_str()));
+        }
+    }
+
+    void Run(Pipeline& pipeline)
+    {
+        int64_t timestamp = 0;
+
+        for (unsigned long long i = 0; i < recordCount_; ++i)
+        {
+            uint64_t random = Next();
+
+            int64_t duration = static_cast<int64_t>(random % MAX_TICKS);
+
+            EventRecord record{ i + 1, timestamp, timestamp + duration, 0,
+                EVENT_ID_FRONT_END_PASS };
+
+            // Most activities are files and functions, which are also
+            // the ones that have names.
+            switch ((random >> 32) % 10)
+            {
+            case 0:
+                break;
+
+            case 1:
+            case 2:
+            case 3:
+                record.EventId = EVENT_ID_FUNCTION;
+                record.NameId = functionNameIds_[
+                    (random >> 40) % functionNameIds_.size()];
+                break;
+
+            default:
+                record.EventId = EVENT_ID_FRONT_END_FILE;
+                record.NameId = fileNameIds_[
+                    (random >> 40) % fileNameIds_.size()];
+                break;
+            }
+
+            pipeline.Publish(record);
+
+            timestamp += duration / 4;
+        }
+    }
+
+private:
+    static const long long TICK_FREQUENCY = 10000000;
+    static const int64_t MAX_TICKS = 100000;
+
+    static const size_t FILE_COUNT = 2000;
+    static const size_t FUNCTION_COUNT = 20000;
+
+    // xorshift64, which is deterministic so that every run produces the
+    // same records.
+    uint64_t Next()
+    {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+
+        return state_;
+    }
+
+    unsigned long long recordCount_;
+
+    std::vector<uint32_t> fileNameIds_;
+    std::vector<uint32_t> functionNameIds_;
+
+    uint64_t state_;
+};
+
+class PipelineBenchmark
+{
+    struct RunResult
+    {
+        std::chrono::nanoseconds Duration;
+        unsigned long long RecordCount;
+        std::vector<unsigned long long> AnalysisRecordCounts;
+        std::vector<int64_t> AnalysisTotalTicks;
+    };
+
+public:
+    PipelineBenchmark(const char* tracePath,
+        unsigned long long syntheticRecordCount, int countToDump,
+        ReportWriter& report):
+        tracePath_{tracePath},
+        syntheticRecordCount_{syntheticRecordCount},
+        countToDump_{countToDump > 0 ? static_cast<size_t>(countToDump) : 10},
+        report_{report},
+        names_{},
+        analyses_{}
+    {}
+
+    int Run()
+    {
+        RunResult serial;
+
+        if (!Measure(false, serial)) {
+            return -1;
+        }
+
+        RunResult pipelined;
+
+        if (!Measure(true, pipelined)) {
+            return -1;
+        }
+
+        bool resultsMatch = serial.RecordCount == pipelined.RecordCount &&
+            serial.AnalysisRecordCounts == pipelined.AnalysisRecordCounts &&
+            serial.AnalysisTotalTicks == pipelined.AnalysisTotalTicks;
+
+        if (report_.IsText())
+        {
+            std::cout << "Source: " << (syntheticRecordCount_ > 0 ?
+                "synthetic" : tracePath_) << "\t Records: " <<
+                pipelined.RecordCount << "\t Analyses: " <<
+                analyses_.size() << "\n\n";
+        }
+
+        PrintVariant("Serial", serial);
+        PrintVariant("Pipelined", pipelined);
+
+        for (auto& analysis : analyses_) {
+            analysis->Print(names_, countToDump_, report_);
+        }
+
+        if (report_.IsText() && !resultsMatch) {
+            std::cout << "\nWARNING: the analyses saw different records.\n";
+        }
+
+        return resultsMatch ? 0 : -1;
+    }
+
+private:
+    bool Measure(bool isPipelined, RunResult& result)
+    {
+        using namespace std::chrono;
+
+        names_ = RecordNames{};
+
+        analyses_.clear();
+        analyses_.push_back(std::make_unique<ActivitySummary>());
+        analyses_.push_back(std::make_unique<TopNames>(
+            static_cast<uint16_t>(EVENT_ID_FRONT_END_FILE), "File",
+            "files by aggregated parsing time"));
+        analyses_.push_back(std::make_unique<TopNames>(
+            static_cast<uint16_t>(EVENT_ID_FUNCTION), "Function",
+            "functions by aggregated code generation time"));
+
+        std::vector<RecordAnalysis*> analyses;
+
+        for (auto& analysis : analyses_) {
+            analyses.push_back(analysis.get());
+        }
+
+        // Synthetic names are interned before the clock starts, like
+        // the trace is opened before decoding starts.
+        std::unique_ptr<SyntheticRecordProducer> synthetic;
+
+        if (syntheticRecordCount_ > 0) {
+            synthetic = std::make_unique<SyntheticRecordProducer>(
+                syntheticRecordCount_, names_);
+        }
+
+        Pipeline pipeline{ analyses, isPipelined };
+
+        auto start = steady_clock::now();
+
+        pipeline.Start();
+
+        if (synthetic) {
+            synthetic->Run(pipeline);
+        }
+        else
+        {
+            TraceRecordProducer producer{ names_, pipeline };
+
+            auto group = MakeStaticAnalyzerGroup(&producer);
+
+            int numberOfPasses = 1;
+
+            if (Analyze(tracePath_, numberOfPasses, group) != 0) {
+                return false;
+            }
+        }
+
+        pipeline.Finish();
+
+        result.Duration = duration_cast<nanoseconds>(
+            steady_clock::now() - start);
+        result.RecordCount = pipeline.RecordCount();
+
+        for (auto& analysis : analyses_)
+        {
+            result.AnalysisRecordCounts.push_back(analysis->RecordCount());
+            result.AnalysisTotalTicks.push_back(analysis->TotalTicks());
+        }
+
+        return true;
+    }
+
+    void PrintVariant(const char* name, const RunResult& result)
+    {
+        using namespace std::chrono;
+
+        double seconds = duration_cast<duration<double>>(
+            result.Duration).count();
+
+        double recordsPerSecond = seconds <= 0. ? 0. :
+            static_cast<double>(result.RecordCount) / seconds;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("Variant")
+                .Field("Name", name)
+                .Field("DurationMs", duration_cast<milliseconds>(
+                    result.Duration).count())
+                .Field("RecordsPerSecond", recordsPerSecond)
+                .EndRecord();
+
+            return;
+        }
+
+        std::cout << std::left << std::setw(12) << name << std::right <<
+            std::setw(10) << duration_cast<milliseconds>(
+                result.Duration).count() << " ms\t" << std::fixed <<
+            std::setprecision(2) << recordsPerSecond / 1e6 <<
+            " M records/s\n";
+    }
+
+    const char* tracePath_;
+    unsigned long long syntheticRecordCount_;
+    size_t countToDump_;
+
+    ReportWriter& report_;
+
+    // The names and analyses of the last run.
+    RecordNames names_;
+    std::vector<std::unique_ptr<RecordAnalysis>> analyses_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    // argv[1] should contain the path to a trace file, or
+    // /synthetic:<count> to analyze that many generated records instead.
+    unsigned long long syntheticRecordCount = 0;
+
+    if (std::strncmp(argv[1], "/synthetic:", 11) == 0)
+    {
+        syntheticRecordCount = std::strtoull(argv[1] + 11, nullptr, 10);
+
+        if (syntheticRecordCount == 0) return -1;
+    }
+
+    int countToDump = 0;
+
+    if (argc >= 3) {
+        countToDump = std::atoi(argv[2]);
+    }
+
+    PipelineBenchmark benchmark{ argv[1], syntheticRecordCount, countToDump,
+        report };
+
+    return benchmark.Run();
+}
@@ -0,0 +1,572 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cwctype>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+using namespace SimpleEvents;
+
+class PrecompiledHeaderEffectiveness : public IAnalyzer
+{
+    // How the translation units of a CL invocation relate to a PCH.
+    enum PchRole
+    {
+        PCH_ROLE_NONE,
+        PCH_ROLE_CREATE,
+        PCH_ROLE_USE
+    };
+
+    struct InvocationInfo
+    {
+        PchRole Role;
+        size_t PchIndex;
+    };
+
+    // A header parsed by the consumers of a PCH, outside of the PCH.
+    struct HeaderInfo
+    {
+        std::string Path;
+        unsigned long long ConsumerCount;
+        unsigned long long LastPassId;
+        std::chrono::nanoseconds Duration;
+        std::chrono::nanoseconds ExclusiveDuration;
+
+        bool operator<(const HeaderInfo& other) const {
+            return ExclusiveDuration > other.ExclusiveDuration;
+        }
+    };
+
+    // A translation unit compiled with /Yu.
+    struct ConsumerInfo
+    {
+        unsigned InvocationId;
+        std::string Path;
+        std::chrono::nanoseconds Duration;
+        std::chrono::nanoseconds HeaderDuration;
+
+        bool operator<(const ConsumerInfo& other) const {
+            return HeaderDuration > other.HeaderDuration;
+        }
+    };
+
+    struct PchInfo
+    {
+        std::string Path;
+        std::string HeaderName;
+
+        unsigned CreatorInvocationId;
+        std::chrono::nanoseconds CreationDuration;
+
+        std::vector<ConsumerInfo> Consumers;
+        std::chrono::nanoseconds ConsumerDuration;
+        std::chrono::nanoseconds ConsumerHeaderDuration;
+
+        // Headers parsed by consumers, by lowercase path.
+        HashMap<std::string, HeaderInfo> Headers;
+
+        // Headers that enough consumers parse to belong in the PCH, and
+        // the exclusive time that consumers spend parsing them. Filled
+        // in at the end of the analysis.
+        std::vector<HeaderInfo> Candidates;
+        std::chrono::nanoseconds WastedDuration;
+
+        bool operator<(const PchInfo& other) const {
+            return WastedDuration > other.WastedDuration;
+        }
+    };
+
+public:
+    PrecompiledHeaderEffectiveness(int countToDump, ReportWriter& report):
+        countToDump_{countToDump > 0 ? static_cast<size_t>(countToDump) : 10},
+        report_{report},
+        arena_{},
+        invocations_{ arena_ },
+        pchIndices_{ arena_ },
+        consumerHeaderDurations_{ arena_ },
+        pchs_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &PrecompiledHeaderEffectiveness::OnStopFile);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &PrecompiledHeaderEffectiveness::OnStopFrontEndPass);
+            break;
+
+        case EVENT_ID_COMPILER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &PrecompiledHeaderEffectiveness::OnStopCompiler);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    AnalysisControl OnSimpleEvent(const EventStack& eventStack) override
+    {
+        MatchEventStackInMemberFunction(eventStack, this,
+            &PrecompiledHeaderEffectiveness::OnCompilerCommandLine);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    // The command line is the only place where the relationship between
+    // a PCH and the translation units that use it is recorded. A PCH is
+    // identified by its /Fp path when there is one, and otherwise by the
+    // name of its header and the working directory.
+    void OnCompilerCommandLine(Compiler cl, CommandLine commandLine)
+    {
+        PchRole role = PCH_ROLE_NONE;
+        std::wstring headerName;
+        std::wstring pchPath;
+
+        for (auto& arg : SplitCommandLine(commandLine.Value()))
+        {
+            if (arg.size() < 3 || (arg[0] != L'/' && arg[0] != L'-')) {
+                continue;
+            }
+
+            if (arg.compare(1, 2, L"Yc") == 0)
+            {
+                role = PCH_ROLE_CREATE;
+                headerName = arg.substr(3);
+            }
+            else if (arg.compare(1, 2, L"Yu") == 0)
+            {
+                role = PCH_ROLE_USE;
+                headerName = arg.substr(3);
+            }
+            else if (arg.compare(1, 2, L"Y-") == 0) {
+                role = PCH_ROLE_NONE;
+            }
+            else if (arg.compare(1, 2, L"Fp") == 0) {
+                pchPath = arg.substr(3);
+            }
+        }
+
+        if (role == PCH_ROLE_NONE) {
+            return;
+        }
+
+        std::wstring workingDirectory = cl.WorkingDirectory();
+        std::wstring path;
+
+        if (!pchPath.empty())
+        {
+            bool isAbsolute = pchPath[0] == L'\\' || pchPath[0] == L'/' ||
+                (pchPath.size() > 1 && pchPath[1] == L':');
+
+            path = isAbsolute ? pchPath : workingDirectory + L"\\" + pchPath;
+        }
+        else {
+            path = workingDirectory + L"\\" +
+                (headerName.empty() ? L"(default)" : headerName);
+        }
+
+        std::string key = ToUtf8(Lowercase(path).c_str());
+
+        auto result = pchIndices_.try_emplace(std::move(key), pchs_.size());
+
+        if (result.second)
+        {
+            pchs_.push_back(PchInfo{});
+
+            PchInfo& pch = pchs_.back();
+
+            pch.Path = ToUtf8(path.c_str());
+            pch.HeaderName = ToUtf8(headerName.c_str());
+            pch.Headers = HashMap<std::string, HeaderInfo>{ arena_ };
+        }
+
+        invocations_[cl.EventInstanceId()] = { role, result.first->second };
+    }
+
+    void OnStopFile(Compiler cl, FrontEndPass fe, FrontEndFileGroup files)
+    {
+        // The first file of the group is the translation unit itself.
+        if (files.Size() < 2) {
+            return;
+        }
+
+        auto itInvocation = invocations_.find(cl.EventInstanceId());
+
+        if (itInvocation == invocations_.end() ||
+            itInvocation->second.Role != PCH_ROLE_USE)
+        {
+            return;
+        }
+
+        PchInfo& pch = pchs_[itInvocation->second.PchIndex];
+
+        // Headers included directly by the translation unit account for
+        // all the header parsing time of the pass, without counting
+        // nested headers twice.
+        if (files.Size() == 2) {
+            consumerHeaderDurations_[fe.EventInstanceId()] +=
+                files.Back().Duration();
+        }
+
+        std::string path = files.Back().Path();
+
+        std::transform(path.begin(), path.end(), path.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        auto result = pch.Headers.try_emplace(std::move(path), HeaderInfo{});
+
+        HeaderInfo& header = result.first->second;
+
+        if (result.second) {
+            header.Path = files.Back().Path();
+        }
+
+        // Headers with include guards are only parsed once per pass, but
+        // others may be parsed several times.
+        if (header.LastPassId != fe.EventInstanceId())
+        {
+            ++header.ConsumerCount;
+            header.LastPassId = fe.EventInstanceId();
+        }
+
+        header.Duration += files.Back().Duration();
+        header.ExclusiveDuration += files.Back().ExclusiveDuration();
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe)
+    {
+        auto itInvocation = invocations_.find(cl.EventInstanceId());
+
+        if (itInvocation == invocations_.end()) {
+            return;
+        }
+
+        PchInfo& pch = pchs_[itInvocation->second.PchIndex];
+
+        if (itInvocation->second.Role == PCH_ROLE_CREATE)
+        {
+            pch.CreatorInvocationId = cl.InvocationId();
+            pch.CreationDuration += fe.Duration();
+            return;
+        }
+
+        std::chrono::nanoseconds headerDuration{0};
+
+        auto it = consumerHeaderDurations_.find(fe.EventInstanceId());
+
+        if (it != consumerHeaderDurations_.end())
+        {
+            headerDuration = std::min(it->second, fe.Duration());
+            consumerHeaderDurations_.erase(it);
+        }
+
+        pch.Consumers.push_back({ cl.InvocationId(),
+            ToUtf8(fe.InputSourcePath()), fe.Duration(), headerDuration });
+
+        pch.ConsumerDuration += fe.Duration();
+        pch.ConsumerHeaderDuration += headerDuration;
+    }
+
+    void OnStopCompiler(Compiler cl)
+    {
+        invocations_.erase(cl.EventInstanceId());
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        for (auto& pch : pchs_) {
+            FindCandidates(pch);
+        }
+
+        std::vector<PchInfo*> sorted;
+
+        for (auto& pch : pchs_)
+        {
+            if (!pch.Consumers.empty()) {
+                sorted.push_back(&pch);
+            }
+        }
+
+        size_t countToDump = std::min(sorted.size(), countToDump_);
+
+        std::partial_sort(sorted.begin(), sorted.begin() + countToDump,
+            sorted.end(), [](const PchInfo* lhs, const PchInfo* rhs) {
+                return *lhs < *rhs;
+            });
+
+        if (report_.IsText())
+        {
+            std::cout << "Top " << countToDump << " of " << sorted.size() <<
+                " precompiled headers by time spent parsing headers that "
+                "should be in them:\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i) {
+            PrintPch(*sorted[i]);
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    // Headers parsed by at least this fraction of the consumers of a
+    // PCH are worth adding to it.
+    static constexpr double CANDIDATE_CONSUMER_FRACTION = 0.5;
+
+    static std::wstring Lowercase(std::wstring str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(),
+            [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+
+        return str;
+    }
+
+    // Splits a command line into arguments, removing the quotes that
+    // surround paths with spaces.
+    static std::vector<std::wstring> SplitCommandLine(
+        const wchar_t* commandLine)
+    {
+        std::vector<std::wstring> args;
+        std::wstring arg;
+        bool inQuotes = false;
+
+        for (const wchar_t* p = commandLine; ; ++p)
+        {
+            if (*p == L'"') {
+                inQuotes = !inQuotes;
+                continue;
+            }
+
+            if (*p == L'\0' || (!inQuotes && std::iswspace(*p)))
+            {
+                if (!arg.empty()) {
+                    args.push_back(std::move(arg));
+                    arg.clear();
+                }
+
+                if (*p == L'\0') {
+                    break;
+                }
+
+                continue;
+            }
+
+            arg.push_back(*p);
+        }
+
+        return args;
+    }
+
+    // Ranks the headers of a PCH by the exclusive time consumers spend
+    // parsing them. Exclusive time is used so that a header and the
+    // headers it includes aren't counted twice in the wasted time.
+    void FindCandidates(PchInfo& pch)
+    {
+        double minConsumerCount = std::max(1.,
+            CANDIDATE_CONSUMER_FRACTION * pch.Consumers.size());
+
+        for (auto& p : pch.Headers)
+        {
+            const HeaderInfo& header = p.second;
+
+            // A header parsed by a single consumer gains nothing from
+            // being precompiled.
+            if (header.ConsumerCount < 2 ||
+                static_cast<double>(header.ConsumerCount) < minConsumerCount)
+            {
+                continue;
+            }
+
+            pch.Candidates.push_back(header);
+            pch.WastedDuration += header.ExclusiveDuration;
+        }
+
+        std::sort(pch.Candidates.begin(), pch.Candidates.end());
+
+        pch.Headers.clear();
+    }
+
+    void PrintPch(PchInfo& pch)
+    {
+        using namespace std::chrono;
+
+        double headerPercent = pch.ConsumerDuration.count() == 0 ? 0. :
+            static_cast<double>(pch.ConsumerHeaderDuration.count()) /
+                pch.ConsumerDuration.count() * 100.;
+
+        if (!report_.IsText())
+        {
+            report_.BeginRecord("PrecompiledHeader")
+                .Field("Path", pch.Path)
+                .Field("Header", pch.HeaderName)
+                .Field("CreatorInvocationId", pch.CreatorInvocationId)
+                .Field("CreationMs", duration_cast<milliseconds>(
+                    pch.CreationDuration).count())
+                .Field("ConsumerCount", pch.Consumers.size())
+                .Field("ConsumerFrontEndMs", duration_cast<milliseconds>(
+                    pch.ConsumerDuration).count())
+                .Field("ConsumerHeaderMs", duration_cast<milliseconds>(
+                    pch.ConsumerHeaderDuration).count())
+                .Field("WastedMs", duration_cast<milliseconds>(
+                    pch.WastedDuration).count())
+                .Field("CandidateCount", pch.Candidates.size())
+                .EndRecord();
+        }
+        else
+        {
+            std::cout << "\nPCH: " << pch.Path;
+
+            if (pch.CreatorInvocationId != 0)
+            {
+                std::cout << "\t Created by CL " << pch.CreatorInvocationId <<
+                    " in " << duration_cast<milliseconds>(
+                        pch.CreationDuration).count() << " ms";
+            }
+            else {
+                std::cout << "\t Not created in this trace";
+            }
+
+            std::cout << "\n    Consumers: " << pch.Consumers.size() <<
+                "\t Front-end time: " << duration_cast<milliseconds>(
+                    pch.ConsumerDuration).count() << " ms" <<
+                "\t Parsing headers outside of the PCH: " <<
+                duration_cast<milliseconds>(
+                    pch.ConsumerHeaderDuration).count() << " ms (" <<
+                std::fixed << std::setprecision(1) << headerPercent << "%)\n";
+
+            std::cout << "    Wasted: " << duration_cast<milliseconds>(
+                pch.WastedDuration).count() << " ms parsing " <<
+                pch.Candidates.size() << " headers used by at least " <<
+                static_cast<int>(CANDIDATE_CONSUMER_FRACTION * 100) <<
+                "% of consumers, outside of the PCH\n";
+        }
+
+        size_t candidateCount = std::min(pch.Candidates.size(), countToDump_);
+
+        for (size_t i = 0; i < candidateCount; ++i)
+        {
+            const HeaderInfo& header = pch.Candidates[i];
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("CandidateHeader")
+                    .Field("Pch", pch.Path)
+                    .Field("ConsumerCount", header.ConsumerCount)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        header.Duration).count())
+                    .Field("ExclusiveMs", duration_cast<milliseconds>(
+                        header.ExclusiveDuration).count())
+                    .Field("Path", header.Path)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "        " << header.ConsumerCount << "/" <<
+                pch.Consumers.size() << " consumers\t " <<
+                duration_cast<milliseconds>(header.ExclusiveDuration).count() <<
+                " ms exclusive, " <<
+                duration_cast<milliseconds>(header.Duration).count() <<
+                " ms inclusive\t " << header.Path << "\n";
+        }
+
+        size_t consumerCount = std::min(pch.Consumers.size(), countToDump_);
+
+        std::partial_sort(pch.Consumers.begin(),
+            pch.Consumers.begin() + consumerCount, pch.Consumers.end());
+
+        if (report_.IsText()) {
+            std::cout << "    Consumers that parse the most headers:\n";
+        }
+
+        for (size_t i = 0; i < consumerCount; ++i)
+        {
+            const ConsumerInfo& consumer = pch.Consumers[i];
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Consumer")
+                    .Field("Pch", pch.Path)
+                    .Field("InvocationId", consumer.InvocationId)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        consumer.Duration).count())
+                    .Field("HeaderMs", duration_cast<milliseconds>(
+                        consumer.HeaderDuration).count())
+                    .Field("Path", consumer.Path)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "        " << duration_cast<milliseconds>(
+                consumer.HeaderDuration).count() << " ms of " <<
+                duration_cast<milliseconds>(consumer.Duration).count() <<
+                " ms\t CL " << consumer.InvocationId << "\t " <<
+                consumer.Path << "\n";
+        }
+    }
+
+    size_t countToDump_;
+
+    ReportWriter& report_;
+
+    MonotonicArena arena_;
+
+    // CL invocations that are still running and that create or use a
+    // PCH.
+    HashMap<unsigned long long, InvocationInfo> invocations_;
+
+    // Maps lowercase PCH paths to their index in pchs_.
+    HashMap<std::string, size_t> pchIndices_;
+
+    // Maps front-end passes that are still running to the time they
+    // spent parsing headers so far.
+    HashMap<unsigned long long,
+        std::chrono::nanoseconds> consumerHeaderDurations_;
+
+    std::vector<PchInfo> pchs_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int countToDump = 0;
+
+    if (argc >= 3) {
+        countToDump = std::atoi(argv[2]);
+    }
+
+    PrecompiledHeaderEffectiveness pche{ countToDump, report };
+
+    auto group = MakeStaticAnalyzerGroup(&pche);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}
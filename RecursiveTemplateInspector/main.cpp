@@ -1,11 +1,14 @@
 #include <algorithm>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <set>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <vector>
 #include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+#include "../Common/Sampling.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
@@ -21,7 +24,7 @@ class RecursiveTemplateInspector : public IAnalyzer
         std::string RootSpecializationName;
         std::wstring File;
 
-        std::unordered_set<unsigned long long> VisitedInstantiations;
+        HashSet<unsigned long long> VisitedInstantiations;
 
         bool operator<(const TemplateSpecializationInfo& other) const {
             return TotalInstantiationTime > other.TotalInstantiationTime;
@@ -29,37 +32,65 @@ class RecursiveTemplateInspector : public IAnalyzer
     };
 
 public:
-    RecursiveTemplateInspector(int specializationCountToDump):
+    RecursiveTemplateInspector(int specializationCountToDump,
+        const SamplingOptions& samplingOptions, ReportWriter& report):
+        arena_{},
+        rootSpecializations_{ arena_ },
         specializationCountToDump_{
-            specializationCountToDump > 0 ? specializationCountToDump : 5 }
+            specializationCountToDump > 0 ? specializationCountToDump : 5 },
+        report_{report},
+        sampler_{samplingOptions},
+        hierarchyCount_{0},
+        hierarchyTime_{},
+        invocationHierarchyTimes_{ arena_ },
+        pruneSize_{MIN_PRUNE_SIZE}
     {
     }
 
     AnalysisControl OnStopActivity(const EventStack& eventStack)
         override
     {
+        if (!sampler_.Includes(eventStack)) {
+            return AnalysisControl::CONTINUE;
+        }
+
         MatchEventStackInMemberFunction(eventStack, this,
             &RecursiveTemplateInspector::OnTemplateRecursionTreeBranch);
 
+        if (eventStack.Size() == 1 &&
+            (eventStack.Back().EventId() == EVENT_ID_COMPILER ||
+                eventStack.Back().EventId() == EVENT_ID_LINKER))
+        {
+            OnStopInvocation(eventStack.Back().EventInstanceId());
+        }
+
         return AnalysisControl::CONTINUE;
     }
 
     AnalysisControl OnSimpleEvent(const EventStack& eventStack)
         override
     {
+        if (!sampler_.Includes(eventStack)) {
+            return AnalysisControl::CONTINUE;
+        }
+
         MatchEventStackInMemberFunction(eventStack, this,
             &RecursiveTemplateInspector::OnSymbolName);
 
         return AnalysisControl::CONTINUE;
     }
 
-    void OnTemplateRecursionTreeBranch(FrontEndPass fe, 
-        TemplateInstantiationGroup recursionTreeBranch)
+    void OnTemplateRecursionTreeBranch(InvocationGroup invocations,
+        FrontEndPass fe, TemplateInstantiationGroup recursionTreeBranch)
     {
         const TemplateInstantiation& root = recursionTreeBranch[0];
         const TemplateInstantiation& current = recursionTreeBranch.Back();
 
-        auto& info = rootSpecializations_[root.SpecializationSymbolKey()];
+        auto& info = rootSpecializations_.try_emplace(
+            root.SpecializationSymbolKey(), TemplateSpecializationInfo{
+                std::chrono::nanoseconds{0}, 0, 0, std::string{},
+                std::wstring{}, HashSet<unsigned long long>{ arena_ } }
+            ).first->second;
 
         auto& visitedSet = info.VisitedInstantiations;
 
@@ -99,10 +130,40 @@ public:
 
         info.TotalInstantiationTime = root.Duration();
 
+        ++hierarchyCount_;
+
+        if (sampler_.IsSampling()) {
+            invocationHierarchyTimes_[invocations[0].EventInstanceId()] +=
+                root.Duration();
+        }
+        else {
+            hierarchyTime_.Add(root.Duration());
+        }
+
         info.File = fe.InputSourcePath() ? fe.InputSourcePath() :
             fe.OutputObjectPath();
 
         visitedSet.clear();
+
+        // Pruning erases entries, which moves others in the table, so it
+        // comes after the last use of info.
+        if (rootSpecializations_.size() >= pruneSize_) {
+            PruneCompletedHierarchies();
+        }
+    }
+
+    // When sampling, the time of the hierarchies of a top-level
+    // invocation, and the invocations it started, is added to the
+    // estimate once it stops.
+    void OnStopInvocation(unsigned long long invocationInstanceId)
+    {
+        auto it = invocationHierarchyTimes_.find(invocationInstanceId);
+
+        if (it != invocationHierarchyTimes_.end())
+        {
+            hierarchyTime_.Add(it->second);
+            invocationHierarchyTimes_.erase(it);
+        }
     }
 
     void OnSymbolName(SymbolName symbolName)
@@ -120,8 +181,44 @@ public:
     {
         using namespace std::chrono;
 
+        // Invocations cut off by the end of the trace.
+        for (auto& p : invocationHierarchyTimes_) {
+            hierarchyTime_.Add(p.second);
+        }
+
+        invocationHierarchyTimes_.clear();
+
         auto topSpecializations = GetTopInstantiations();
-        
+
+        if (!report_.IsText())
+        {
+            if (sampler_.IsSampling())
+            {
+                report_.BeginRecord("TemplateHierarchyEstimate")
+                    .Field("SampleRate", sampler_.Rate())
+                    .Field("Count", EstimateCount(hierarchyCount_))
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        hierarchyTime_.Estimate(sampler_.Rate())).count())
+                    .Field("MarginMs", duration_cast<milliseconds>(
+                        hierarchyTime_.Margin(sampler_.Rate())).count())
+                    .EndRecord();
+            }
+
+            for (auto& info : topSpecializations)
+            {
+                report_.BeginRecord("TemplateHierarchy")
+                    .Field("File", info.File)
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        info.TotalInstantiationTime).count())
+                    .Field("MaxDepth", info.MaxDepth)
+                    .Field("InstantiationCount", info.InstantiationCount)
+                    .Field("RootName", info.RootSpecializationName)
+                    .EndRecord();
+            }
+
+            return AnalysisControl::CONTINUE;
+        }
+
         if (specializationCountToDump_ == 1) {
             std::cout << "Top template instantiation hierarchy:";
         }
@@ -130,28 +227,104 @@ public:
                 " template instantiation " << "hierarchies";
         }
             
-        std::cout << std::endl << std::endl;
+        if (sampler_.IsSampling())
+        {
+            std::cout << " in " << sampler_.Rate() * 100. <<
+                "% of invocations.\nEstimated for the whole build: " <<
+                EstimateCount(hierarchyCount_) << " hierarchies, " <<
+                duration_cast<milliseconds>(
+                    hierarchyTime_.Estimate(sampler_.Rate())).count() <<
+                " +/- " << duration_cast<milliseconds>(
+                    hierarchyTime_.Margin(sampler_.Rate())).count() <<
+                " ms (95% confidence)";
+        }
+
+        std::cout << "\n\n";
 
         for (auto& info : topSpecializations)
         {
-            std::wcout << "File:           " << 
-                info.File << std::endl;
+            std::cout  << "File:           " << 
+                ToUtf8(info.File.c_str()) << "\n";
             std::cout  << "Duration:       " << 
                 duration_cast<milliseconds>(
                     info.TotalInstantiationTime).count() << 
-                " ms" << std::endl;
+                " ms\n";
             std::cout  << "Max Depth:      " << 
-                info.MaxDepth << std::endl;
+                info.MaxDepth << "\n";
             std::cout  << "Instantiations: " << 
-                info.InstantiationCount << std::endl;
+                info.InstantiationCount << "\n";
             std::cout  << "Root Name:      " << 
-                info.RootSpecializationName << std::endl << std::endl;
+                info.RootSpecializationName << "\n\n";
         }
 
         return AnalysisControl::CONTINUE;
     }
 
 private:
+    unsigned long long EstimateCount(unsigned long long sampledCount) const
+    {
+        return static_cast<unsigned long long>(
+            static_cast<double>(sampledCount) / sampler_.Rate() + 0.5);
+    }
+
+    // Only the longest hierarchies are reported, and a hierarchy's
+    // duration is final once its root has stopped, so completed
+    // hierarchies that can no longer be among the longest don't need to
+    // be kept. Pruning them whenever the table has doubled keeps it
+    // proportional to the hierarchies being instantiated at the same
+    // time, instead of to all the hierarchies of the build.
+    void PruneCompletedHierarchies()
+    {
+        std::vector<std::chrono::nanoseconds> completedDurations;
+
+        for (auto& p : rootSpecializations_)
+        {
+            if (IsCompleted(p.second)) {
+                completedDurations.push_back(p.second.TotalInstantiationTime);
+            }
+        }
+
+        size_t countToKeep = static_cast<size_t>(specializationCountToDump_);
+
+        if (completedDurations.size() > countToKeep)
+        {
+            // The shortest duration that can still be reported. Ties are
+            // kept.
+            std::nth_element(completedDurations.begin(),
+                completedDurations.begin() + (countToKeep - 1),
+                completedDurations.end(),
+                std::greater<std::chrono::nanoseconds>());
+
+            std::chrono::nanoseconds minDuration =
+                completedDurations[countToKeep - 1];
+
+            std::vector<unsigned long long> keysToErase;
+
+            for (auto& p : rootSpecializations_)
+            {
+                if (IsCompleted(p.second) &&
+                    p.second.TotalInstantiationTime < minDuration)
+                {
+                    keysToErase.push_back(p.first);
+                }
+            }
+
+            for (unsigned long long key : keysToErase) {
+                rootSpecializations_.erase(key);
+            }
+        }
+
+        size_t pruneSize = 2 * rootSpecializations_.size();
+
+        pruneSize_ = pruneSize > MIN_PRUNE_SIZE ? pruneSize : MIN_PRUNE_SIZE;
+    }
+
+    static bool IsCompleted(const TemplateSpecializationInfo& info)
+    {
+        return info.TotalInstantiationTime.count() > 0 &&
+            info.VisitedInstantiations.empty();
+    }
+
     std::multiset<TemplateSpecializationInfo> GetTopInstantiations()
     {
         std::multiset<TemplateSpecializationInfo> topSpecializations;
@@ -177,24 +350,57 @@ private:
         return topSpecializations;
     }
 
+    MonotonicArena arena_;
+
     // A hash table that stores information about template instantiations
     // that are at the root of a recursive instantiation hierarchy.
-    std::unordered_map<unsigned long long, TemplateSpecializationInfo> rootSpecializations_;
+    HashMap<unsigned long long, TemplateSpecializationInfo> rootSpecializations_;
 
     int specializationCountToDump_;
+
+    ReportWriter& report_;
+
+    InvocationSampler sampler_;
+
+    // The number and total time of all the hierarchies, including those
+    // that aren't printed.
+    unsigned long long hierarchyCount_;
+    SampledTotal hierarchyTime_;
+
+    // The time of the hierarchies of each running top-level invocation,
+    // when sampling.
+    HashMap<unsigned long long, std::chrono::nanoseconds>
+        invocationHierarchyTimes_;
+
+    static const size_t MIN_PRUNE_SIZE = 4096;
+
+    size_t pruneSize_;
 };
 
 int main(int argc, char* argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    SamplingOptions samplingOptions;
+
+    if (!ParseSamplingOptions(argc, argv, samplingOptions)) return -1;
+
     if (argc <= 1) return -1;
 
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
     int specializationCountToDump = 0;
 
     if (argc >= 3) {
         specializationCountToDump = std::atoi(argv[2]);
     }
 
-    RecursiveTemplateInspector rti{specializationCountToDump};
+    RecursiveTemplateInspector rti{specializationCountToDump, samplingOptions,
+        report};
 
     auto group = MakeStaticAnalyzerGroup(&rti);
 
@@ -2,11 +2,16 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 #include <CppBuildInsights.hpp>
+#include "../Common/FlatHashMap.hpp"
+#include "../Common/ReportWriter.hpp"
+#include "../Common/Sampling.hpp"
+#include "../Common/SpilledRuns.hpp"
 
 using namespace Microsoft::Cpp::BuildInsights;
 using namespace Activities;
@@ -17,23 +22,61 @@ class TopHeaders : public IAnalyzer
     {
         std::chrono::nanoseconds TotalParsingTime;
         std::string Path;
-        std::unordered_set<unsigned long long> PassIds;
+        HashSet<unsigned long long> PassIds;
 
-        bool operator<(const FileInfo& other) const {
+        // The parsing time by invocation, used to estimate the parsing
+        // time of the whole build when only some invocations are sampled.
+        SampledTotal SampledParsingTime;
+    };
+
+    // The totals of a header, as written to disk when the table is
+    // spilled.
+    struct SpilledFileInfo
+    {
+        long long TotalParsingNanoseconds;
+        unsigned long long InclusionCount;
+        double SampledParsingSum;
+        double SampledParsingSumOfSquares;
+    };
+
+    typedef SpilledRuns<SpilledFileInfo>::Entry SpilledEntry;
+
+    // The totals of a header over the whole analysis.
+    struct HeaderSummary
+    {
+        std::chrono::nanoseconds TotalParsingTime;
+        std::string Path;
+        unsigned long long InclusionCount;
+        SampledTotal SampledParsingTime;
+
+        bool operator<(const HeaderSummary& other) const {
             return TotalParsingTime > other.TotalParsingTime;
         }
     };
 
 public:
-    TopHeaders(int headerCountToDump):
+    TopHeaders(int headerCountToDump, const SamplingOptions& samplingOptions,
+        const MemoryBudgetOptions& memoryBudgetOptions, ReportWriter& report):
         headerCountToDump_{headerCountToDump  > 0 ? 
             headerCountToDump : 5},
+        report_{report},
+        sampler_{samplingOptions},
         frontEndAggregatedDuration_{0},
-        fileInfo_{}
+        memoryBudget_{memoryBudgetOptions.BudgetBytes},
+        arena_{ new MonotonicArena{ ArenaBlockSize() } },
+        fileInfo_{ *arena_ },
+        invocationParsingTimes_{},
+        stringSize_{0},
+        hasSpillFailed_{false},
+        spilledRuns_{ memoryBudgetOptions.SpillDirectory, "TopHeaders" }
     {}
 
     AnalysisControl OnStopActivity(const EventStack& eventStack) override
     {
+        if (!sampler_.Includes(eventStack)) {
+            return AnalysisControl::CONTINUE;
+        }
+
         switch (eventStack.Back().EventId())
         {
         case EVENT_ID_FRONT_END_FILE:
@@ -49,14 +92,25 @@ public:
             frontEndAggregatedDuration_ += eventStack.Back().Duration();
             break;
 
+        case EVENT_ID_COMPILER:
+        case EVENT_ID_LINKER:
+            if (eventStack.Size() == 1) {
+                OnStopInvocation(eventStack.Back().EventInstanceId());
+            }
+            break;
+
         default:
             break;
         }
 
-        return AnalysisControl::CONTINUE;
+        // Continuing without the budget would run out of memory on the
+        // traces that need one.
+        return hasSpillFailed_ ? AnalysisControl::FAILURE :
+            AnalysisControl::CONTINUE;
     }
 
-    AnalysisControl OnStopFile(FrontEndPass fe, FrontEndFile file)
+    AnalysisControl OnStopFile(InvocationGroup invocations, FrontEndPass fe,
+        FrontEndFile file)
     {
         // Make the path lowercase for comparing
         std::string path = file.Path();
@@ -64,28 +118,90 @@ public:
         std::transform(path.begin(), path.end(), path.begin(),
             [](unsigned char c) { return std::tolower(c); });
 
-        auto result = fileInfo_.try_emplace(std::move(path), FileInfo{});
-
-        auto it = result.first;
-        bool wasInserted = result.second;
+        if (sampler_.IsSampling()) {
+            invocationParsingTimes_.Add(invocations[0].EventInstanceId(),
+                path, file.Duration());
+        }
 
-        FileInfo& fi = it->second;
+        FileInfo& fi = GetFileInfo(std::move(path));
 
         fi.PassIds.insert(fe.EventInstanceId());
+
         fi.TotalParsingTime += file.Duration();
 
-        if (result.second) {
+        if (!sampler_.IsSampling()) {
+            fi.SampledParsingTime.Add(file.Duration());
+        }
+
+        if (fi.Path.empty())
+        {
             fi.Path = file.Path();
+            stringSize_ += fi.Path.size();
+        }
+
+        if (IsOverBudget()) {
+            Spill();
         }
 
         return AnalysisControl::CONTINUE;
     }
 
+    // When sampling, the parsing time of each header by a top-level
+    // invocation, and the invocations it started, is added to its sampled
+    // total once the invocation stops.
+    void OnStopInvocation(unsigned long long invocationInstanceId)
+    {
+        invocationParsingTimes_.Stop(invocationInstanceId,
+            [this](const std::string& key, std::chrono::nanoseconds value) {
+                GetFileInfo(key).SampledParsingTime.Add(value);
+            });
+
+        if (IsOverBudget()) {
+            Spill();
+        }
+    }
+
     AnalysisControl OnEndAnalysis() override
     {
         using namespace std::chrono;
 
-        auto topHeaders = GetTopHeaders();
+        invocationParsingTimes_.StopAll(
+            [this](const std::string& key, std::chrono::nanoseconds value) {
+                GetFileInfo(key).SampledParsingTime.Add(value);
+            });
+
+        std::multiset<HeaderSummary> topHeaders;
+
+        if (!GetTopHeaders(topHeaders)) {
+            return AnalysisControl::FAILURE;
+        }
+
+        if (!report_.IsText())
+        {
+            for (auto& info : topHeaders)
+            {
+                report_.BeginRecord("Header")
+                    .Field("DurationMs", duration_cast<milliseconds>(
+                        info.SampledParsingTime.Estimate(
+                            sampler_.Rate())).count())
+                    .Field("FrontEndPercent", static_cast<double>(
+                        info.TotalParsingTime.count()) /
+                        frontEndAggregatedDuration_.count() * 100.)
+                    .Field("InclusionCount", EstimateCount(
+                        info.InclusionCount))
+                    .Field("Path", info.Path);
+
+                if (sampler_.IsSampling()) {
+                    report_.Field("MarginMs", duration_cast<milliseconds>(
+                        info.SampledParsingTime.Margin(
+                            sampler_.Rate())).count());
+                }
+
+                report_.EndRecord();
+            }
+
+            return AnalysisControl::CONTINUE;
+        }
 
         if (headerCountToDump_ == 1) {
             std::cout << "Top header file:";
@@ -95,7 +211,12 @@ public:
                 " header files:";
         }
 
-        std::cout << std::endl << std::endl;
+        if (sampler_.IsSampling()) {
+            std::cout << " (estimated from " << sampler_.Rate() * 100. <<
+                "% of invocations, with 95% confidence intervals)";
+        }
+
+        std::cout << "\n\n";
 
         for (auto& info : topHeaders)
         {
@@ -105,64 +226,245 @@ public:
 
             std::cout << "Aggregated Parsing Duration: " <<
                 duration_cast<milliseconds>(
-                    info.TotalParsingTime).count() << 
-                " ms" << std::endl;
+                    info.SampledParsingTime.Estimate(
+                        sampler_.Rate())).count();
+
+            if (sampler_.IsSampling()) {
+                std::cout << " +/- " << duration_cast<milliseconds>(
+                    info.SampledParsingTime.Margin(
+                        sampler_.Rate())).count();
+            }
+
+            std::cout << " ms\n";
             std::cout << "Front-End Time Percentage:   " <<
-                std::setprecision(2) << frontEndPercentage << "% " << 
-                std::endl;
+                std::setprecision(2) << frontEndPercentage << "% \n";
             std::cout << "Inclusion Count:             " <<
-                info.PassIds.size() << std::endl;
+                EstimateCount(info.InclusionCount) << "\n";
             std::cout << "Path: " <<
-                info.Path << std::endl << std::endl;
+                info.Path << "\n\n";
         }
 
         return AnalysisControl::CONTINUE;
     }
 
 private:
-    std::multiset<FileInfo> GetTopHeaders()
+    // The table's arena is the only memory that spilling gives back, so
+    // its blocks are kept small compared to the budget.
+    static const size_t MIN_BLOCKS_PER_BUDGET = 16;
+
+    size_t ArenaBlockSize() const
+    {
+        size_t blockSize = memoryBudget_ / MIN_BLOCKS_PER_BUDGET;
+
+        if (blockSize == 0 || blockSize > MonotonicArena::DEFAULT_BLOCK_SIZE) {
+            return MonotonicArena::DEFAULT_BLOCK_SIZE;
+        }
+
+        return blockSize;
+    }
+
+    // The memory used by the table and the per-invocation sums: the
+    // blocks held by the arena, which include the arrays that tables
+    // left behind when they grew, and the strings, which are allocated
+    // on the heap.
+    bool IsOverBudget() const
+    {
+        if (memoryBudget_ == 0 || fileInfo_.empty()) {
+            return false;
+        }
+
+        return arena_->HeldSize() + stringSize_ +
+            invocationParsingTimes_.EstimatedSize() > memoryBudget_;
+    }
+
+    // Returns the entry of a header. Entries that are created after the
+    // header's entry was spilled have no path until it is parsed again.
+    template <class Key>
+    FileInfo& GetFileInfo(Key&& key)
     {
-        std::multiset<FileInfo> topHeaders;
+        size_t keySize = key.size();
+
+        auto result = fileInfo_.try_emplace(std::forward<Key>(key), FileInfo{
+            std::chrono::nanoseconds{0}, std::string{},
+            HashSet<unsigned long long>{ *arena_ }, SampledTotal{} });
+
+        if (result.second) {
+            stringSize_ += keySize;
+        }
+
+        return result.first->second;
+    }
+
+    unsigned long long EstimateCount(unsigned long long sampledCount) const
+    {
+        return static_cast<unsigned long long>(
+            static_cast<double>(sampledCount) / sampler_.Rate() + 0.5);
+    }
+
+    // Writes the table to disk as a run sorted by path, and empties it.
+    // The arena of the table is replaced, so that its memory goes back
+    // to the heap. If the run can't be written, the analysis fails.
+    //
+    // A pass whose headers are split by a spill is counted once in each
+    // run, so inclusion counts can be slightly too high.
+    bool Spill()
+    {
+        std::vector<SpilledEntry> entries;
+
+        entries.reserve(fileInfo_.size());
 
         for (auto& p : fileInfo_)
         {
-            if (topHeaders.size() < headerCountToDump_) {
-                topHeaders.insert(p.second);
-            }
-            else
+            const FileInfo& fi = p.second;
+
+            entries.push_back({ p.first, fi.Path, SpilledFileInfo{
+                fi.TotalParsingTime.count(), fi.PassIds.size(),
+                fi.SampledParsingTime.Sum(),
+                fi.SampledParsingTime.SumOfSquares() } });
+        }
+
+        std::sort(entries.begin(), entries.end(),
+            [](const SpilledEntry& lhs, const SpilledEntry& rhs) {
+                return lhs.Key < rhs.Key;
+            });
+
+        if (!spilledRuns_.WriteRun(entries))
+        {
+            hasSpillFailed_ = true;
+            return false;
+        }
+
+        std::unique_ptr<MonotonicArena> arena{
+            new MonotonicArena{ ArenaBlockSize() } };
+
+        fileInfo_ = HashMap<std::string, FileInfo>{ *arena };
+        arena_ = std::move(arena);
+
+        stringSize_ = 0;
+
+        return true;
+    }
+
+    void AddToTopHeaders(std::multiset<HeaderSummary>& topHeaders,
+        HeaderSummary&& summary)
+    {
+        if (topHeaders.size() < headerCountToDump_) {
+            topHeaders.insert(std::move(summary));
+        }
+        else
+        {
+            auto itLast = --topHeaders.end();
+
+            if (summary.TotalParsingTime >
+                itLast->TotalParsingTime)
             {
-                auto itLast = --topHeaders.end();
+                topHeaders.insert(std::move(summary));
+                topHeaders.erase(itLast);
+            }
+        }
+    }
 
-                if (p.second.TotalParsingTime >
-                    itLast->TotalParsingTime)
-                {
-                    topHeaders.insert(p.second);
-                    topHeaders.erase(itLast);
-                }
+    bool GetTopHeaders(std::multiset<HeaderSummary>& topHeaders)
+    {
+        if (spilledRuns_.RunCount() == 0)
+        {
+            for (auto& p : fileInfo_)
+            {
+                AddToTopHeaders(topHeaders, { p.second.TotalParsingTime,
+                    p.second.Path, p.second.PassIds.size(),
+                    p.second.SampledParsingTime });
             }
+
+            return true;
         }
 
-        return topHeaders;
+        // Spill what is left, so that each header's totals can be
+        // combined from all runs in a single merge.
+        if (!Spill()) {
+            return false;
+        }
+
+        return spilledRuns_.Merge(
+            [](SpilledEntry& into, const SpilledEntry& from)
+            {
+                into.Data.TotalParsingNanoseconds +=
+                    from.Data.TotalParsingNanoseconds;
+                into.Data.InclusionCount += from.Data.InclusionCount;
+                into.Data.SampledParsingSum += from.Data.SampledParsingSum;
+                into.Data.SampledParsingSumOfSquares +=
+                    from.Data.SampledParsingSumOfSquares;
+
+                if (into.Text.empty()) {
+                    into.Text = from.Text;
+                }
+            },
+            [this, &topHeaders](const SpilledEntry& entry)
+            {
+                AddToTopHeaders(topHeaders, { std::chrono::nanoseconds{
+                        entry.Data.TotalParsingNanoseconds },
+                    entry.Text, entry.Data.InclusionCount,
+                    SampledTotal{ entry.Data.SampledParsingSum,
+                        entry.Data.SampledParsingSumOfSquares } });
+            });
     }
 
     int headerCountToDump_;
 
+    ReportWriter& report_;
+
+    InvocationSampler sampler_;
+
     std::chrono::nanoseconds frontEndAggregatedDuration_;
 
-    std::unordered_map<std::string, FileInfo> fileInfo_;
+    // With a memory budget, the table is spilled to disk whenever it and
+    // the per-invocation sums exceed the budget, and the runs are merged
+    // at the end of the analysis.
+    size_t memoryBudget_;
+
+    std::unique_ptr<MonotonicArena> arena_;
+
+    HashMap<std::string, FileInfo> fileInfo_;
+
+    // The parsing time of each header by each running top-level
+    // invocation, when sampling.
+    InvocationSums<std::string> invocationParsingTimes_;
+
+    // The size of the keys and paths of the table.
+    size_t stringSize_;
+
+    bool hasSpillFailed_;
+
+    SpilledRuns<SpilledFileInfo> spilledRuns_;
 };
 
 int main(int argc, char* argv[])
 {
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    SamplingOptions samplingOptions;
+
+    if (!ParseSamplingOptions(argc, argv, samplingOptions)) return -1;
+
+    MemoryBudgetOptions memoryBudgetOptions;
+
+    if (!ParseMemoryBudgetOptions(argc, argv, memoryBudgetOptions)) return -1;
+
     if (argc <= 1) return -1;
 
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
     int headerCountToDump = 0;
 
     if (argc >= 3) {
         headerCountToDump = std::atoi(argv[2]);
     }
 
-    TopHeaders th{ headerCountToDump };
+    TopHeaders th{ headerCountToDump, samplingOptions, memoryBudgetOptions,
+        report };
 
     auto group = MakeStaticAnalyzerGroup(&th);
 
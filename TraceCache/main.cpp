@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+#include "../Common/TraceCache.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+
+// Runs analyses directly on the columns of a memory-mapped trace cache.
+// Each analysis only touches the columns it needs, and no trace decoding
+// takes place.
+class CachedTraceAnalysis
+{
+    struct EventKindInfo
+    {
+        uint16_t EventId;
+        size_t Count;
+        int64_t TotalTicks;
+
+        bool operator<(const EventKindInfo& other) const {
+            return TotalTicks > other.TotalTicks;
+        }
+    };
+
+    struct NamedDuration
+    {
+        uint32_t NameId;
+        size_t Count;
+        int64_t TotalTicks;
+
+        bool operator<(const NamedDuration& other) const {
+            return TotalTicks > other.TotalTicks;
+        }
+    };
+
+public:
+    CachedTraceAnalysis(const TraceCacheReader& cache, int countToDump,
+        ReportWriter& report):
+        cache_{cache},
+        countToDump_{countToDump > 0 ? static_cast<size_t>(countToDump) : 10},
+        report_{report}
+    {}
+
+    void Run()
+    {
+        SummarizeEventKinds();
+        FindLongestFunctions();
+        FindTopFiles();
+    }
+
+private:
+    // Count and aggregated duration of each kind of activity.
+    void SummarizeEventKinds()
+    {
+        const uint16_t* eventIds = cache_.EventIds();
+        const int64_t* starts = cache_.StartTimestamps();
+        const int64_t* stops = cache_.StopTimestamps();
+
+        std::unordered_map<uint16_t, EventKindInfo> kinds;
+
+        for (size_t i = 0; i < cache_.EventCount(); ++i)
+        {
+            EventKindInfo& info = kinds[eventIds[i]];
+
+            info.EventId = eventIds[i];
+            ++info.Count;
+            info.TotalTicks += stops[i] - starts[i];
+        }
+
+        std::vector<EventKindInfo> sorted;
+
+        for (auto& p : kinds) {
+            sorted.push_back(p.second);
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+
+        if (report_.IsText()) {
+            std::cout << "Activities:\n\n";
+        }
+
+        for (auto& info : sorted)
+        {
+            const char* name = cache_.EventName(info.EventId);
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Activity")
+                    .Field("Name", name)
+                    .Field("Count", info.Count)
+                    .Field("DurationMs", TicksToMilliseconds(info.TotalTicks))
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Count: " << info.Count << "\t Duration: " <<
+                TicksToMilliseconds(info.TotalTicks) << " ms\t Name: " <<
+                name << "\n";
+        }
+    }
+
+    // Equivalent of LongCodeGenFinder: the functions that took the
+    // longest to generate.
+    void FindLongestFunctions()
+    {
+        const uint16_t* eventIds = cache_.EventIds();
+        const uint32_t* nameIds = cache_.NameIds();
+        const int64_t* starts = cache_.StartTimestamps();
+        const int64_t* stops = cache_.StopTimestamps();
+
+        std::vector<NamedDuration> functions;
+
+        for (size_t i = 0; i < cache_.EventCount(); ++i)
+        {
+            if (eventIds[i] != EVENT_ID_FUNCTION) {
+                continue;
+            }
+
+            functions.push_back({ nameIds[i], 1, stops[i] - starts[i] });
+        }
+
+        PrintTop("Function", "functions by code generation time",
+            functions);
+    }
+
+    // Equivalent of TopHeaders: the files with the longest aggregated
+    // parsing time.
+    void FindTopFiles()
+    {
+        const uint16_t* eventIds = cache_.EventIds();
+        const uint32_t* nameIds = cache_.NameIds();
+        const int64_t* starts = cache_.StartTimestamps();
+        const int64_t* stops = cache_.StopTimestamps();
+
+        std::unordered_map<uint32_t, NamedDuration> files;
+
+        for (size_t i = 0; i < cache_.EventCount(); ++i)
+        {
+            if (eventIds[i] != EVENT_ID_FRONT_END_FILE) {
+                continue;
+            }
+
+            NamedDuration& file = files[nameIds[i]];
+
+            file.NameId = nameIds[i];
+            ++file.Count;
+            file.TotalTicks += stops[i] - starts[i];
+        }
+
+        std::vector<NamedDuration> sorted;
+
+        for (auto& p : files) {
+            sorted.push_back(p.second);
+        }
+
+        PrintTop("File", "files by aggregated parsing time", sorted);
+    }
+
+    void PrintTop(const char* recordType, const char* title,
+        std::vector<NamedDuration>& entries)
+    {
+        size_t countToDump = std::min(entries.size(), countToDump_);
+
+        std::partial_sort(entries.begin(), entries.begin() + countToDump,
+            entries.end());
+
+        if (report_.IsText()) {
+            std::cout << "\nTop " << countToDump << " " << title << ":\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const NamedDuration& entry = entries[i];
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord(recordType)
+                    .Field("Count", entry.Count)
+                    .Field("DurationMs", TicksToMilliseconds(entry.TotalTicks))
+                    .Field("Name", cache_.String(entry.NameId))
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << "Count: " << entry.Count << "\t Duration: " <<
+                TicksToMilliseconds(entry.TotalTicks) << " ms\t Name: " <<
+                cache_.String(entry.NameId) << "\n";
+        }
+    }
+
+    long long TicksToMilliseconds(int64_t ticks) const
+    {
+        long long tickFrequency = cache_.TickFrequency();
+
+        return tickFrequency <= 0 ? 0 : static_cast<long long>(
+            static_cast<double>(ticks) * 1000. / tickFrequency);
+    }
+
+    const TraceCacheReader& cache_;
+
+    size_t countToDump_;
+
+    ReportWriter& report_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    // argv[1] should contain the path to a trace file, and argv[2] can
+    // contain the path of its cache. By default, the cache is written
+    // next to the trace.
+    const char* tracePath = argv[1];
+
+    std::string cachePath = argc >= 3 ? argv[2] :
+        std::string{ tracePath } + ".bicache";
+
+    int countToDump = 0;
+
+    if (argc >= 4) {
+        countToDump = std::atoi(argv[3]);
+    }
+
+    TraceCacheReader cache;
+
+    if (!cache.Open(cachePath, tracePath))
+    {
+        // The cache is missing or out of date. Decode the trace once
+        // to build it.
+        TraceCacheWriter writer{ cachePath, tracePath };
+
+        auto group = MakeStaticAnalyzerGroup(&writer);
+
+        int numberOfPasses = 1;
+        int result = Analyze(tracePath, numberOfPasses, group);
+
+        if (result != RESULT_CODE_SUCCESS) {
+            return result;
+        }
+
+        if (!writer.IsComplete() || !cache.Open(cachePath, tracePath)) {
+            return -1;
+        }
+    }
+
+    CachedTraceAnalysis analysis{ cache, countToDump, report };
+
+    analysis.Run();
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/BuildMetrics.hpp"
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+
+// Compares the metrics collected from a baseline and a candidate trace,
+// and reports the entities whose time changed the most.
+class TraceDiff
+{
+    struct MetricDelta
+    {
+        const std::string* Name;
+        std::chrono::nanoseconds Baseline;
+        std::chrono::nanoseconds Candidate;
+        size_t BaselineCount;
+        size_t CandidateCount;
+
+        std::chrono::nanoseconds Delta() const {
+            return Candidate - Baseline;
+        }
+
+        bool operator<(const MetricDelta& other) const {
+            return std::abs(Delta().count()) > std::abs(other.Delta().count());
+        }
+    };
+
+public:
+    TraceDiff(const BuildMetricsCollector& baseline,
+        const BuildMetricsCollector& candidate, int deltaCountToDump,
+        ReportWriter& report):
+        baseline_{baseline},
+        candidate_{candidate},
+        deltaCountToDump_{deltaCountToDump > 0 ?
+            static_cast<size_t>(deltaCountToDump) : 10},
+        report_{report}
+    {}
+
+    void Run()
+    {
+        for (int i = 0; i < BUILD_METRIC_CATEGORY_COUNT; ++i) {
+            Compare(static_cast<BuildMetricCategory>(i));
+        }
+    }
+
+private:
+    void Compare(BuildMetricCategory category)
+    {
+        using namespace std::chrono;
+
+        auto& baseline = baseline_.Metrics(category);
+        auto& candidate = candidate_.Metrics(category);
+
+        std::vector<MetricDelta> deltas;
+
+        nanoseconds baselineTotal{0};
+        nanoseconds candidateTotal{0};
+
+        // Hash join on the entity key. Entities that only exist on one
+        // side are compared against zero.
+        for (auto& p : baseline)
+        {
+            auto it = candidate.find(p.first);
+
+            MetricDelta delta{ &p.second.Name, p.second.Duration,
+                nanoseconds{0}, p.second.Count, 0 };
+
+            if (it != candidate.end())
+            {
+                delta.Candidate = it->second.Duration;
+                delta.CandidateCount = it->second.Count;
+            }
+
+            baselineTotal += delta.Baseline;
+            deltas.push_back(delta);
+        }
+
+        for (auto& p : candidate)
+        {
+            candidateTotal += p.second.Duration;
+
+            if (baseline.find(p.first) != baseline.end()) {
+                continue;
+            }
+
+            deltas.push_back({ &p.second.Name, nanoseconds{0},
+                p.second.Duration, 0, p.second.Count });
+        }
+
+        size_t countToDump = std::min(deltas.size(), deltaCountToDump_);
+
+        std::partial_sort(deltas.begin(), deltas.begin() + countToDump,
+            deltas.end());
+
+        const char* categoryName = BuildMetricCategoryName(category);
+
+        if (report_.IsText())
+        {
+            std::cout << categoryName << ": " <<
+                duration_cast<milliseconds>(baselineTotal).count() <<
+                " ms -> " <<
+                duration_cast<milliseconds>(candidateTotal).count() <<
+                " ms\n\n";
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const MetricDelta& delta = deltas[i];
+
+            long long deltaMs = duration_cast<milliseconds>(
+                delta.Delta()).count();
+
+            if (!report_.IsText())
+            {
+                report_.BeginRecord("Delta")
+                    .Field("Category", categoryName)
+                    .Field("DeltaMs", deltaMs)
+                    .Field("BaselineMs", duration_cast<milliseconds>(
+                        delta.Baseline).count())
+                    .Field("CandidateMs", duration_cast<milliseconds>(
+                        delta.Candidate).count())
+                    .Field("BaselineCount", delta.BaselineCount)
+                    .Field("CandidateCount", delta.CandidateCount)
+                    .Field("Name", *delta.Name)
+                    .EndRecord();
+
+                continue;
+            }
+
+            std::cout << (deltaMs >= 0 ? "+" : "") << deltaMs << " ms\t(" <<
+                duration_cast<milliseconds>(delta.Baseline).count() <<
+                " -> " <<
+                duration_cast<milliseconds>(delta.Candidate).count() <<
+                " ms, count " << delta.BaselineCount << " -> " <<
+                delta.CandidateCount << ")\t " << *delta.Name << "\n";
+        }
+
+        if (report_.IsText()) {
+            std::cout << "\n";
+        }
+    }
+
+    const BuildMetricsCollector& baseline_;
+    const BuildMetricsCollector& candidate_;
+
+    size_t deltaCountToDump_;
+
+    ReportWriter& report_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 2) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    int deltaCountToDump = 0;
+
+    if (argc >= 4) {
+        deltaCountToDump = std::atoi(argv[3]);
+    }
+
+    BuildMetricsCollector baseline;
+    BuildMetricsCollector candidate;
+
+    int baselineResult = 0;
+    int candidateResult = 0;
+
+    // argv[1] and argv[2] should contain the paths to the baseline and
+    // candidate traces. Both are analyzed at the same time, each on its
+    // own thread.
+    std::thread baselineThread{ [&]()
+    {
+        auto group = MakeStaticAnalyzerGroup(&baseline);
+
+        int numberOfPasses = 1;
+        baselineResult = Analyze(argv[1], numberOfPasses, group);
+    } };
+
+    {
+        auto group = MakeStaticAnalyzerGroup(&candidate);
+
+        int numberOfPasses = 1;
+        candidateResult = Analyze(argv[2], numberOfPasses, group);
+    }
+
+    baselineThread.join();
+
+    if (baselineResult != RESULT_CODE_SUCCESS) return baselineResult;
+    if (candidateResult != RESULT_CODE_SUCCESS) return candidateResult;
+
+    TraceDiff diff{ baseline, candidate, deltaCountToDump, report };
+
+    diff.Run();
+
+    return 0;
+}
@@ -0,0 +1,646 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cwctype>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <CppBuildInsights.hpp>
+#include "../Common/ReportWriter.hpp"
+
+using namespace Microsoft::Cpp::BuildInsights;
+using namespace Activities;
+
+// Proposes unity build batches: groups of translation units of the same
+// project that include many of the same headers. Compiling such a group
+// as a single translation unit parses each shared header only once.
+//
+// Comparing every pair of translation units is quadratic, so candidate
+// pairs are found with MinHash signatures of each translation unit's set
+// of headers, and locality-sensitive hashing (LSH) on bands of these
+// signatures. Only pairs that land in the same bucket for at least one
+// band are compared exactly. Batches are then grown greedily from the
+// pairs with the most shared parsing time, as long as the estimated
+// compile time of the batch stays under the target.
+class UnityBuildRecommender : public IAnalyzer
+{
+    // MinHash signature length, split into LSH bands. With 16 bands of
+    // 4 rows, pairs whose header sets have a Jaccard similarity of about
+    // 0.5 or more are very likely to become candidates.
+    static const size_t SIGNATURE_SIZE = 64;
+    static const size_t BAND_COUNT = 16;
+    static const size_t ROWS_PER_BAND = SIGNATURE_SIZE / BAND_COUNT;
+
+    // Limits the number of candidate pairs produced by very large LSH
+    // buckets, such as those of translation units that only include
+    // common system headers. Each translation unit in a bucket is only
+    // paired with this many of its neighbors.
+    static const size_t MAX_BUCKET_NEIGHBORS = 8;
+
+    struct HeaderInfo
+    {
+        std::string Path;
+        std::chrono::nanoseconds TotalExclusiveTime;
+        size_t ParseCount;
+    };
+
+    struct TranslationUnitInfo
+    {
+        uint32_t ProjectId;
+        std::string Path;
+
+        // Front-end and back-end time of this translation unit.
+        std::chrono::nanoseconds Duration;
+
+        // Sorted ids of the headers included by this translation unit.
+        std::vector<uint32_t> Headers;
+
+        uint64_t Signature[SIGNATURE_SIZE];
+    };
+
+    struct ActiveInvocation
+    {
+        uint32_t ProjectId;
+
+        // Maps lowercase source paths to their translation unit, to
+        // attribute back-end time to it.
+        std::unordered_map<std::wstring, uint32_t> TranslationUnits;
+    };
+
+    struct CandidatePair
+    {
+        uint32_t First;
+        uint32_t Second;
+        std::chrono::nanoseconds SharedTime;
+
+        bool operator<(const CandidatePair& other) const {
+            return SharedTime > other.SharedTime;
+        }
+    };
+
+    struct Batch
+    {
+        std::vector<uint32_t> Members;
+        std::vector<uint32_t> Headers;
+        std::chrono::nanoseconds Duration;
+        std::chrono::nanoseconds Savings;
+
+        bool operator<(const Batch& other) const {
+            return Savings > other.Savings;
+        }
+    };
+
+public:
+    UnityBuildRecommender(std::chrono::nanoseconds targetBatchDuration,
+        int batchCountToDump, ReportWriter& report):
+        targetBatchDuration_{targetBatchDuration},
+        batchCountToDump_{batchCountToDump > 0 ?
+            static_cast<size_t>(batchCountToDump) : 10},
+        report_{report},
+        headerIds_{},
+        headers_{},
+        projectIds_{},
+        projects_{},
+        translationUnits_{},
+        activeInvocations_{},
+        activeFrontEndPasses_{}
+    {}
+
+    AnalysisControl OnStopActivity(const EventStack& eventStack) override
+    {
+        switch (eventStack.Back().EventId())
+        {
+        case EVENT_ID_FRONT_END_FILE:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &UnityBuildRecommender::OnStopFile);
+            break;
+
+        case EVENT_ID_FRONT_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &UnityBuildRecommender::OnStopFrontEndPass);
+            break;
+
+        case EVENT_ID_BACK_END_PASS:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &UnityBuildRecommender::OnStopBackEndPass);
+            break;
+
+        case EVENT_ID_COMPILER:
+            MatchEventStackInMemberFunction(eventStack, this,
+                &UnityBuildRecommender::OnStopCompiler);
+            break;
+
+        default:
+            break;
+        }
+
+        return AnalysisControl::CONTINUE;
+    }
+
+    void OnStopFile(FrontEndPass fe, FrontEndFileGroup files)
+    {
+        // The first file of the group is the source file itself.
+        if (files.Size() < 2) {
+            return;
+        }
+
+        const FrontEndFile& file = files.Back();
+
+        std::string path = file.Path();
+
+        std::transform(path.begin(), path.end(), path.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+
+        auto result = headerIds_.try_emplace(std::move(path),
+            static_cast<uint32_t>(headers_.size()));
+
+        if (result.second) {
+            headers_.push_back({ file.Path(), std::chrono::nanoseconds{0}, 0 });
+        }
+
+        uint32_t headerId = result.first->second;
+
+        HeaderInfo& header = headers_[headerId];
+
+        header.TotalExclusiveTime += file.ExclusiveDuration();
+        ++header.ParseCount;
+
+        activeFrontEndPasses_[fe.EventInstanceId()].push_back(headerId);
+    }
+
+    void OnStopFrontEndPass(Compiler cl, FrontEndPass fe)
+    {
+        std::vector<uint32_t> headers;
+
+        auto it = activeFrontEndPasses_.find(fe.EventInstanceId());
+
+        if (it != activeFrontEndPasses_.end())
+        {
+            headers = std::move(it->second);
+            activeFrontEndPasses_.erase(it);
+        }
+
+        std::sort(headers.begin(), headers.end());
+        headers.erase(std::unique(headers.begin(), headers.end()),
+            headers.end());
+
+        // A translation unit without a source file can't be included in a
+        // unity file.
+        if (fe.InputSourcePath() == nullptr) {
+            return;
+        }
+
+        ActiveInvocation& invocation = GetInvocation(cl);
+
+        uint32_t id = static_cast<uint32_t>(translationUnits_.size());
+
+        translationUnits_.push_back(TranslationUnitInfo{});
+
+        TranslationUnitInfo& tu = translationUnits_.back();
+
+        tu.ProjectId = invocation.ProjectId;
+        tu.Path = ToUtf8(fe.InputSourcePath());
+        tu.Duration = fe.Duration();
+        tu.Headers = std::move(headers);
+
+        ComputeSignature(tu);
+
+        invocation.TranslationUnits[LowercasePath(fe.InputSourcePath())] = id;
+    }
+
+    void OnStopBackEndPass(Compiler cl, BackEndPass be)
+    {
+        auto itInvocation = activeInvocations_.find(cl.EventInstanceId());
+
+        if (itInvocation == activeInvocations_.end()) {
+            return;
+        }
+
+        auto& translationUnits = itInvocation->second.TranslationUnits;
+
+        auto it = translationUnits.find(LowercasePath(be.InputSourcePath()));
+
+        if (it == translationUnits.end()) {
+            return;
+        }
+
+        translationUnits_[it->second].Duration += be.Duration();
+    }
+
+    void OnStopCompiler(Compiler cl)
+    {
+        activeInvocations_.erase(cl.EventInstanceId());
+    }
+
+    AnalysisControl OnEndAnalysis() override
+    {
+        std::vector<std::chrono::nanoseconds> headerCosts;
+
+        headerCosts.reserve(headers_.size());
+
+        // A header's cost is its average exclusive parsing time, which
+        // is the time saved for each translation unit that no longer
+        // needs to parse it.
+        for (auto& header : headers_)
+        {
+            headerCosts.push_back(header.ParseCount == 0 ?
+                std::chrono::nanoseconds{0} :
+                header.TotalExclusiveTime /
+                static_cast<std::chrono::nanoseconds::rep>(header.ParseCount));
+        }
+
+        std::vector<CandidatePair> candidates =
+            FindCandidatePairs(headerCosts);
+
+        std::vector<Batch> batches = BuildBatches(candidates, headerCosts);
+
+        PrintBatches(batches);
+
+        return AnalysisControl::CONTINUE;
+    }
+
+private:
+    static std::wstring LowercasePath(const wchar_t* path)
+    {
+        std::wstring lowercase = path ? path : L"";
+
+        std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+            [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+
+        return lowercase;
+    }
+
+    static uint64_t Mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+
+        return x;
+    }
+
+    ActiveInvocation& GetInvocation(const Compiler& cl)
+    {
+        auto result = activeInvocations_.try_emplace(cl.EventInstanceId(),
+            ActiveInvocation{});
+
+        ActiveInvocation& invocation = result.first->second;
+
+        if (!result.second) {
+            return invocation;
+        }
+
+        // Translation units are only batched with others of the same
+        // project, identified by the working directory of the compiler.
+        std::wstring workingDirectory = LowercasePath(cl.WorkingDirectory());
+
+        auto project = projectIds_.try_emplace(std::move(workingDirectory),
+            static_cast<uint32_t>(projects_.size()));
+
+        if (project.second) {
+            projects_.push_back(ToUtf8(cl.WorkingDirectory()));
+        }
+
+        invocation.ProjectId = project.first->second;
+
+        return invocation;
+    }
+
+    // The i-th hash function of a header is derived from two base hashes
+    // of its id, which is as effective for MinHash as independent hash
+    // functions and much cheaper to compute.
+    static void ComputeSignature(TranslationUnitInfo& tu)
+    {
+        std::fill(tu.Signature, tu.Signature + SIGNATURE_SIZE,
+            std::numeric_limits<uint64_t>::max());
+
+        for (uint32_t headerId : tu.Headers)
+        {
+            uint64_t h1 = Mix(headerId + 0x9E3779B97F4A7C15ull);
+            uint64_t h2 = Mix(h1) | 1;
+
+            for (size_t i = 0; i < SIGNATURE_SIZE; ++i) {
+                tu.Signature[i] = std::min(tu.Signature[i], h1 + i * h2);
+            }
+        }
+    }
+
+    std::chrono::nanoseconds SharedTime(const std::vector<uint32_t>& lhs,
+        const std::vector<uint32_t>& rhs,
+        const std::vector<std::chrono::nanoseconds>& headerCosts) const
+    {
+        std::chrono::nanoseconds sharedTime{0};
+
+        auto itLhs = lhs.begin();
+        auto itRhs = rhs.begin();
+
+        while (itLhs != lhs.end() && itRhs != rhs.end())
+        {
+            if (*itLhs < *itRhs) {
+                ++itLhs;
+            }
+            else if (*itRhs < *itLhs) {
+                ++itRhs;
+            }
+            else
+            {
+                sharedTime += headerCosts[*itLhs];
+                ++itLhs;
+                ++itRhs;
+            }
+        }
+
+        return sharedTime;
+    }
+
+    std::vector<CandidatePair> FindCandidatePairs(
+        const std::vector<std::chrono::nanoseconds>& headerCosts) const
+    {
+        std::unordered_set<uint64_t> seenPairs;
+        std::vector<CandidatePair> candidates;
+
+        for (size_t band = 0; band < BAND_COUNT; ++band)
+        {
+            std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+
+            for (uint32_t id = 0; id < translationUnits_.size(); ++id)
+            {
+                const TranslationUnitInfo& tu = translationUnits_[id];
+
+                if (tu.Headers.empty()) {
+                    continue;
+                }
+
+                uint64_t key = Mix(tu.ProjectId + 1);
+
+                for (size_t row = 0; row < ROWS_PER_BAND; ++row)
+                {
+                    key = Mix(key ^
+                        tu.Signature[band * ROWS_PER_BAND + row]);
+                }
+
+                buckets[key].push_back(id);
+            }
+
+            for (auto& p : buckets)
+            {
+                const std::vector<uint32_t>& bucket = p.second;
+
+                for (size_t i = 0; i < bucket.size(); ++i)
+                {
+                    size_t end = std::min(bucket.size(),
+                        i + 1 + MAX_BUCKET_NEIGHBORS);
+
+                    for (size_t j = i + 1; j < end; ++j)
+                    {
+                        uint32_t first = bucket[i];
+                        uint32_t second = bucket[j];
+
+                        // Different projects can collide on the same
+                        // bucket key.
+                        if (translationUnits_[first].ProjectId !=
+                            translationUnits_[second].ProjectId)
+                        {
+                            continue;
+                        }
+
+                        uint64_t pairKey =
+                            (static_cast<uint64_t>(first) << 32) | second;
+
+                        if (!seenPairs.insert(pairKey).second) {
+                            continue;
+                        }
+
+                        std::chrono::nanoseconds sharedTime = SharedTime(
+                            translationUnits_[first].Headers,
+                            translationUnits_[second].Headers, headerCosts);
+
+                        if (sharedTime.count() > 0) {
+                            candidates.push_back({ first, second, sharedTime });
+                        }
+                    }
+                }
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+
+        return candidates;
+    }
+
+    std::vector<Batch> BuildBatches(
+        const std::vector<CandidatePair>& candidates,
+        const std::vector<std::chrono::nanoseconds>& headerCosts) const
+    {
+        std::vector<Batch> batches;
+        std::vector<uint32_t> batchOf(translationUnits_.size());
+
+        batches.reserve(translationUnits_.size());
+
+        for (uint32_t id = 0; id < translationUnits_.size(); ++id)
+        {
+            const TranslationUnitInfo& tu = translationUnits_[id];
+
+            batchOf[id] = id;
+            batches.push_back({ { id }, tu.Headers, tu.Duration,
+                std::chrono::nanoseconds{0} });
+        }
+
+        std::vector<uint32_t> mergedHeaders;
+
+        for (auto& candidate : candidates)
+        {
+            uint32_t first = batchOf[candidate.First];
+            uint32_t second = batchOf[candidate.Second];
+
+            if (first == second) {
+                continue;
+            }
+
+            Batch& lhs = batches[first];
+            Batch& rhs = batches[second];
+
+            // The batches may have grown since this pair was scored, so
+            // the shared time is recomputed on their current headers.
+            std::chrono::nanoseconds sharedTime = SharedTime(lhs.Headers,
+                rhs.Headers, headerCosts);
+
+            std::chrono::nanoseconds duration = lhs.Duration + rhs.Duration -
+                sharedTime;
+
+            if (sharedTime.count() <= 0 || duration > targetBatchDuration_) {
+                continue;
+            }
+
+            // Merge the smaller batch into the larger one.
+            if (lhs.Members.size() < rhs.Members.size()) {
+                std::swap(first, second);
+            }
+
+            Batch& into = batches[first];
+            Batch& from = batches[second];
+
+            mergedHeaders.clear();
+
+            std::set_union(into.Headers.begin(), into.Headers.end(),
+                from.Headers.begin(), from.Headers.end(),
+                std::back_inserter(mergedHeaders));
+
+            into.Headers.swap(mergedHeaders);
+            into.Duration = duration;
+            into.Savings += from.Savings + sharedTime;
+
+            for (uint32_t member : from.Members)
+            {
+                batchOf[member] = first;
+                into.Members.push_back(member);
+            }
+
+            from = Batch{};
+        }
+
+        batches.erase(std::remove_if(batches.begin(), batches.end(),
+            [](const Batch& batch) { return batch.Members.size() < 2; }),
+            batches.end());
+
+        std::sort(batches.begin(), batches.end());
+
+        return batches;
+    }
+
+    void PrintBatches(const std::vector<Batch>& batches)
+    {
+        using namespace std::chrono;
+
+        nanoseconds totalSavings{0};
+        size_t batchedCount = 0;
+
+        for (auto& batch : batches)
+        {
+            totalSavings += batch.Savings;
+            batchedCount += batch.Members.size();
+        }
+
+        size_t countToDump = std::min(batches.size(), batchCountToDump_);
+
+        if (report_.IsText())
+        {
+            std::cout << "Found " << batches.size() << " unity batches " <<
+                "covering " << batchedCount << " of " <<
+                translationUnits_.size() << " translation units, saving " <<
+                duration_cast<milliseconds>(totalSavings).count() <<
+                " ms of parsing in total.\n\n";
+
+            if (countToDump > 0) {
+                std::cout << "Top " << countToDump << " batches:\n\n";
+            }
+        }
+
+        for (size_t i = 0; i < countToDump; ++i)
+        {
+            const Batch& batch = batches[i];
+
+            const std::string& project =
+                projects_[translationUnits_[batch.Members[0]].ProjectId];
+
+            if (!report_.IsText())
+            {
+                for (uint32_t member : batch.Members)
+                {
+                    report_.BeginRecord("BatchMember")
+                        .Field("Batch", i)
+                        .Field("Project", project)
+                        .Field("BatchDurationMs", duration_cast<milliseconds>(
+                            batch.Duration).count())
+                        .Field("BatchSavingsMs", duration_cast<milliseconds>(
+                            batch.Savings).count())
+                        .Field("Path", translationUnits_[member].Path)
+                        .EndRecord();
+                }
+
+                continue;
+            }
+
+            std::cout << "Project:   " << project << "\n";
+            std::cout << "Files:     " << batch.Members.size() << "\n";
+            std::cout << "Duration:  " <<
+                duration_cast<milliseconds>(batch.Duration).count() <<
+                " ms (estimated)\n";
+            std::cout << "Savings:   " <<
+                duration_cast<milliseconds>(batch.Savings).count() <<
+                " ms\n";
+
+            for (uint32_t member : batch.Members) {
+                std::cout << "\t" << translationUnits_[member].Path << "\n";
+            }
+
+            std::cout << "\n";
+        }
+    }
+
+    std::chrono::nanoseconds targetBatchDuration_;
+    size_t batchCountToDump_;
+
+    ReportWriter& report_;
+
+    std::unordered_map<std::string, uint32_t> headerIds_;
+    std::vector<HeaderInfo> headers_;
+
+    std::unordered_map<std::wstring, uint32_t> projectIds_;
+    std::vector<std::string> projects_;
+
+    std::vector<TranslationUnitInfo> translationUnits_;
+
+    std::unordered_map<unsigned long long, ActiveInvocation> activeInvocations_;
+
+    // Maps front-end passes that are still running to the ids of the
+    // headers they included so far.
+    std::unordered_map<unsigned long long,
+        std::vector<uint32_t>> activeFrontEndPasses_;
+};
+
+int main(int argc, char* argv[])
+{
+    ReportOptions reportOptions;
+
+    if (!ParseReportOptions(argc, argv, reportOptions)) return -1;
+
+    if (argc <= 1) return -1;
+
+    ReportWriter report{ reportOptions };
+
+    if (!report.IsValid()) return -1;
+
+    // argv[2] can contain the target compile time of a batch, in
+    // seconds, and argv[3] the number of batches to print.
+    int targetBatchSeconds = 0;
+    int batchCountToDump = 0;
+
+    if (argc >= 3) {
+        targetBatchSeconds = std::atoi(argv[2]);
+    }
+
+    if (argc >= 4) {
+        batchCountToDump = std::atoi(argv[3]);
+    }
+
+    std::chrono::seconds targetBatchDuration{
+        targetBatchSeconds > 0 ? targetBatchSeconds : 30 };
+
+    UnityBuildRecommender ubr{ targetBatchDuration, batchCountToDump, report };
+
+    auto group = MakeStaticAnalyzerGroup(&ubr);
+
+    // argv[1] should contain the path to a trace file
+    int numberOfPasses = 1;
+    return Analyze(argv[1], numberOfPasses, group);
+}